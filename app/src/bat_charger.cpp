@@ -11,8 +11,8 @@
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(bat_charger, CONFIG_BAT_LOG_LEVEL);
 
-#include <functional>
 #include <math.h> // for fabs function
+#include <stddef.h>
 #include <stdio.h>
 
 #include "board.h"
@@ -22,6 +22,26 @@ LOG_MODULE_REGISTER(bat_charger, CONFIG_BAT_LOG_LEVEL);
 extern DeviceStatus dev_stat;
 extern LoadOutput load;
 
+// battery temperature change (°C) before temperature-compensated setpoints are recalculated
+#define CHARGER_TEMP_DEADBAND 0.5F
+
+// thermal resistance between battery and ambient (K/W), typical value for a 12V/100Ah lead-acid
+// block with natural convection
+#define BAT_THERMAL_RESISTANCE 0.5F
+
+// maximum number of batteries in series supported by auto-detection (48V system)
+#define BAT_SERIES_MAX 4
+
+// number of consistent voltage samples (1 per second) required for auto-detection
+#define BAT_DETECT_SAMPLES 10
+
+// lower end of the voltage range for detection of deeply discharged batteries relative to the
+// absolute minimum voltage (approx. 1.45 V/cell for lead-acid batteries)
+#define BAT_DETECT_RECHARGE_FACTOR 0.9F
+
+// time (s) until a fallback multiplier is used if the detection is not successful
+#define BAT_DETECT_TIMEOUT 300
+
 // DISCHARGE_CURRENT_MAX used to estimate current-compensation of load disconnect voltage
 #if BOARD_HAS_LOAD_OUTPUT
 #define DISCHARGE_CURRENT_MAX DT_PROP(DT_CHILD(DT_PATH(outputs), load), current_max)
@@ -207,87 +227,127 @@ void battery_conf_init(BatConf *bat, int type, int num_cells, float nominal_capa
     }
 }
 
+/*
+ * Offsets of BatConf members are stored as uint8_t in the rule table to keep it small
+ */
+static_assert(sizeof(BatConf) < UINT8_MAX, "BatConf too large for battery_conf_rules");
+
+#define BAT_CONF_FIELD(member) static_cast<uint8_t>(offsetof(BatConf, member))
+
+// indicates that no reference value or no condition is used for a rule
+#define BAT_CONF_NONE UINT8_MAX
+
+enum BatConfRuleComparison : uint8_t
+{
+    RULE_GREATER_THAN,
+    RULE_LESS_THAN,
+};
+
+/**
+ * Plausibility rule for a float member of BatConf
+ *
+ * The rule passes if: value <comparison> (reference * factor + offset)
+ *
+ * If a condition is specified, the rule is only evaluated if the bool member at the condition
+ * offset is true.
+ */
+struct BatConfRuleDef
+{
+    uint16_t flag;      ///< Bit in failed rules bitmask (see enum BatConfRule)
+    uint8_t value;      ///< Offset of the float member to be checked
+    uint8_t comparison; ///< One of enum BatConfRuleComparison
+    uint8_t reference;  ///< Offset of the float member used as reference (or BAT_CONF_NONE)
+    uint8_t condition;  ///< Offset of the bool member enabling this rule (or BAT_CONF_NONE)
+    float factor;       ///< Factor applied to the reference value
+    float offset;       ///< Offset added to the (scaled) reference value
+    const char *text;   ///< Message printed if the rule failed
+};
+
+// things to check:
+// - load_disconnect/reconnect hysteresis makes sense?
+// - cutoff current not extremely low/high
+// - capacity plausible
+//
+/* clang-format off */
+static const BatConfRuleDef battery_conf_rules[] = {
+    { BAT_CONF_RULE_LOAD_HYSTERESIS,
+      BAT_CONF_FIELD(load_reconnect_voltage), RULE_GREATER_THAN,
+      BAT_CONF_FIELD(load_disconnect_voltage), BAT_CONF_NONE, 1.0F, 0.4F,
+      "Load Reconnect Voltage must be higher than Load Disconnect Voltage + 0.4" },
+    { BAT_CONF_RULE_RECHARGE_TOPPING,
+      BAT_CONF_FIELD(recharge_voltage), RULE_LESS_THAN,
+      BAT_CONF_FIELD(topping_voltage), BAT_CONF_NONE, 1.0F, -0.4F,
+      "Recharge Voltage must be lower than Topping Voltage - 0.4" },
+    { BAT_CONF_RULE_RECHARGE_LOAD,
+      BAT_CONF_FIELD(recharge_voltage), RULE_GREATER_THAN,
+      BAT_CONF_FIELD(load_disconnect_voltage), BAT_CONF_NONE, 1.0F, 1.0F,
+      "Recharge Voltage must be higher than Load Disconnect Voltage + 1.0" },
+    { BAT_CONF_RULE_LOAD_ABS_MIN,
+      BAT_CONF_FIELD(load_disconnect_voltage), RULE_GREATER_THAN,
+      BAT_CONF_FIELD(absolute_min_voltage), BAT_CONF_NONE, 1.0F, 0.4F,
+      "Load Disconnect Voltage must be higher than Absolute Min Voltage + 0.4" },
+    { BAT_CONF_RULE_INT_RESISTANCE,
+      BAT_CONF_FIELD(internal_resistance), RULE_LESS_THAN,
+      BAT_CONF_FIELD(load_disconnect_voltage), BAT_CONF_NONE, 0.1F / DISCHARGE_CURRENT_MAX, 0.0F,
+      "Internal Battery Resistance must not cause more than 10% drop at Max Discharge Current" },
+    { BAT_CONF_RULE_WIRE_RESISTANCE,
+      BAT_CONF_FIELD(wire_resistance), RULE_LESS_THAN,
+      BAT_CONF_FIELD(topping_voltage), BAT_CONF_NONE, 0.03F / DISCHARGE_CURRENT_MAX, 0.0F,
+      "Wire Resistances must not cause more than 3% drop at Max Discharge Current" },
+    { BAT_CONF_RULE_CUTOFF_CURRENT_MAX,
+      BAT_CONF_FIELD(topping_cutoff_current), RULE_LESS_THAN,
+      BAT_CONF_FIELD(nominal_capacity), BAT_CONF_NONE, 0.1F, 0.0F,
+      "Topping Cutoff Current must be less than 10% of Nominal Capacity (C/10)" },
+    { BAT_CONF_RULE_CUTOFF_CURRENT_MIN,
+      BAT_CONF_FIELD(topping_cutoff_current), RULE_GREATER_THAN,
+      BAT_CONF_NONE, BAT_CONF_NONE, 0.0F, 0.01F,
+      "Topping Cutoff Current must be higher than 0.01A" },
+    { BAT_CONF_RULE_FLOAT_TOPPING,
+      BAT_CONF_FIELD(float_voltage), RULE_LESS_THAN,
+      BAT_CONF_FIELD(topping_voltage), BAT_CONF_FIELD(float_enabled), 1.0F, 0.0F,
+      "Floating Charge Voltage must be lower than Topping Voltage" },
+    { BAT_CONF_RULE_FLOAT_LOAD,
+      BAT_CONF_FIELD(float_voltage), RULE_GREATER_THAN,
+      BAT_CONF_FIELD(load_disconnect_voltage), BAT_CONF_FIELD(float_enabled), 1.0F, 0.0F,
+      "Floating Charge Voltage must be higher than Load Disconnect Voltage" },
+};
+/* clang-format on */
+
+static inline float bat_conf_float(const BatConf *bat_conf, uint8_t offset)
+{
+    return *reinterpret_cast<const float *>(reinterpret_cast<const uint8_t *>(bat_conf) + offset);
+}
+
 // checks settings in bat_conf for plausibility
-bool battery_conf_check(BatConf *bat_conf)
+bool battery_conf_check(BatConf *bat_conf, uint32_t *failed_rules)
 {
-    // things to check:
-    // - load_disconnect/reconnect hysteresis makes sense?
-    // - cutoff current not extremely low/high
-    // - capacity plausible
-    //
+    uint32_t failed = 0;
 
-    struct condition
-    {
-        std::function<bool()> func;
-        const char *text;
-    };
-
-    const condition conditions[] = {
-        { .func =
-              [bat_conf]() {
-                  return bat_conf->load_reconnect_voltage
-                         > (bat_conf->load_disconnect_voltage + 0.4);
-              },
-          .text = "Load Reconnect Voltage must be higher than Load Disconnect Voltage + 0.4" },
-        { .func =
-              [bat_conf]() {
-                  return bat_conf->recharge_voltage < (bat_conf->topping_voltage - 0.4);
-              },
-          .text = "Recharge Voltage must be lower than Topping Voltage - 0.4" },
-        { .func =
-              [bat_conf]() {
-                  return bat_conf->recharge_voltage > (bat_conf->load_disconnect_voltage + 1);
-              },
-          .text = "Recharge Voltage must be higher than Load Disconnect Voltage + 1.0" },
-        { .func =
-              [bat_conf]() {
-                  return bat_conf->load_disconnect_voltage > (bat_conf->absolute_min_voltage + 0.4);
-              },
-          .text = "Load Disconnecct Voltage must be higher than Absolute Min Voltage + 0.4" },
-        { .func =
-              [bat_conf]() {
-                  return bat_conf->internal_resistance
-                         < bat_conf->load_disconnect_voltage * 0.1 / DISCHARGE_CURRENT_MAX;
-              },
-          .text = "Internal Battery Resistance must not cause more than 10% drop at Max Discharge "
-                  "Current" },
-        { .func =
-              [bat_conf]() {
-                  return bat_conf->wire_resistance
-                         < bat_conf->topping_voltage * 0.03 / DISCHARGE_CURRENT_MAX;
-              },
-          .text = "Wire Resistances must not cause more than 3% drop at Max Discharge Current" },
-        { .func =
-              [bat_conf]() {
-                  return bat_conf->topping_cutoff_current < (bat_conf->nominal_capacity / 10.0);
-              },
-          .text = "Topping Cutoff Current must be less than 10% of Nominal Capacity (C/10)" },
-        { .func = [bat_conf]() { return bat_conf->topping_cutoff_current > 0.01; },
-          .text = "Topping Cutoff Current must be higher than 0.01A" },
-        { .func =
-              [bat_conf]() {
-                  return bat_conf->float_enabled == false
-                         || bat_conf->float_voltage < bat_conf->topping_voltage;
-              },
-          .text = "Floating Charge Voltage must be lower than Topping Voltage" },
-        { .func =
-              [bat_conf]() {
-                  return bat_conf->float_enabled == false
-                         || bat_conf->float_voltage > bat_conf->load_disconnect_voltage;
-              },
-          .text = "Floating Charge Voltage must be higher than Topping Voltage" },
-    };
-
-    bool result = true;
-    for (auto cond : conditions) {
-        bool cond_res = cond.func();
-        if (cond_res == false) {
-            LOG_ERR("battery_conf_check: failed condition '%s'", cond.text);
+    for (const BatConfRuleDef &rule : battery_conf_rules) {
+        if (rule.condition != BAT_CONF_NONE
+            && *(reinterpret_cast<const uint8_t *>(bat_conf) + rule.condition) == false)
+        {
+            continue;
+        }
+
+        float limit = rule.offset;
+        if (rule.reference != BAT_CONF_NONE) {
+            limit += bat_conf_float(bat_conf, rule.reference) * rule.factor;
+        }
+
+        float value = bat_conf_float(bat_conf, rule.value);
+        bool passed = (rule.comparison == RULE_GREATER_THAN) ? value > limit : value < limit;
+        if (!passed) {
+            LOG_ERR("battery_conf_check: failed condition '%s'", rule.text);
+            failed |= rule.flag;
         }
-        result = result && cond_res;
     }
 
-    return result;
+    if (failed_rules != NULL) {
+        *failed_rules = failed;
+    }
+
+    return failed == 0;
 }
 
 void battery_conf_overwrite(BatConf *source, BatConf *destination, Charger *charger)
@@ -314,6 +374,10 @@ void battery_conf_overwrite(BatConf *source, BatConf *destination, Charger *char
     destination->internal_resistance = source->internal_resistance;
     destination->wire_resistance = source->wire_resistance;
 
+    if (charger != NULL) {
+        charger->invalidate_setpoints();
+    }
+
     // reset Ah counter and SOH if battery nominal capacity was changed
     if (destination->nominal_capacity != source->nominal_capacity) {
         destination->nominal_capacity = source->nominal_capacity;
@@ -349,23 +413,126 @@ bool battery_conf_changed(BatConf *a, BatConf *b)
             || a->wire_resistance != b->wire_resistance);
 }
 
-void Charger::detect_num_batteries(BatConf *bat) const
+/*
+ * Find the number of series batteries matching the given voltage range of a single battery
+ *
+ * @returns Series multiplier, 0 if no multiplier matches or -1 if multiple multipliers match
+ */
+static int16_t series_multiplier_candidate(float voltage, float single_min, float single_max,
+                                           float single_topping, float voltage_max)
 {
-    if (port->bus->voltage > bat->absolute_min_voltage * 2
-        && port->bus->voltage < bat->absolute_max_voltage * 2)
-    {
-        port->bus->series_multiplier = 2;
-        printf("Detected two batteries (total %.2f V max)\n", bat->topping_voltage * 2);
+    int16_t candidate = 0;
+    for (int16_t n = 1; n <= BAT_SERIES_MAX; n++) {
+        if (voltage > single_min * n && voltage < single_max * n
+            && single_topping * n <= voltage_max)
+        {
+            if (candidate != 0) {
+                // voltage ranges overlap for different multipliers: no decision possible
+                return -1;
+            }
+            candidate = n;
+        }
+    }
+    return candidate;
+}
+
+bool Charger::detect_num_batteries(BatConf *bat, float voltage_max)
+{
+    if (num_batteries_confidence >= 100) {
+        return true;
+    }
+
+    float voltage = port->bus->voltage_filtered;
+    int16_t candidate =
+        series_multiplier_candidate(voltage, bat->absolute_min_voltage, bat->absolute_max_voltage,
+                                    bat->topping_voltage, voltage_max);
+    if (candidate == 0) {
+        // deeply discharged batteries below absolute minimum voltage
+        candidate = series_multiplier_candidate(
+            voltage, bat->absolute_min_voltage * BAT_DETECT_RECHARGE_FACTOR,
+            bat->absolute_min_voltage, bat->topping_voltage, voltage_max);
+    }
+    if (candidate < 0) {
+        candidate = 0;
+    }
+
+    if (candidate != 0 && candidate == num_batteries_candidate) {
+        num_batteries_samples++;
     }
     else {
-        printf("Detected single battery (%.2f V max)\n", bat->topping_voltage);
+        num_batteries_samples = (candidate != 0) ? 1 : 0;
+    }
+    num_batteries_candidate = candidate;
+    if (num_batteries_samples > BAT_DETECT_SAMPLES) {
+        num_batteries_samples = BAT_DETECT_SAMPLES;
+    }
+    num_batteries_confidence = num_batteries_samples * 100 / BAT_DETECT_SAMPLES;
+
+    if (num_batteries_confidence >= 100) {
+        port->bus->series_multiplier = candidate;
+        dev_stat.clear_error(ERR_BAT_NUM_UNKNOWN);
+        printf("Detected %d series batteries (total %.2f V max)\n", candidate,
+               bat->topping_voltage * candidate);
+        return true;
+    }
+
+    if (dev_stat.has_error(ERR_BAT_NUM_UNKNOWN)) {
+        // fallback multiplier is used until the detection is successful
+        return true;
     }
+
+    if (num_batteries_detect_time < BAT_DETECT_TIMEOUT) {
+        num_batteries_detect_time++;
+        // no charging until the system voltage is known
+        port->pos_current_limit = 0;
+        return false;
+    }
+
+    // Fallback: The lowest multiplier where the voltage doesn't exceed the absolute maximum is
+    // safe, as a higher multiplier could result in overcharging.
+    for (int16_t n = 1; n <= BAT_SERIES_MAX; n++) {
+        if (voltage < bat->absolute_max_voltage * n && bat->topping_voltage * n <= voltage_max) {
+            port->bus->series_multiplier = n;
+            dev_stat.set_error(ERR_BAT_NUM_UNKNOWN);
+            printf("Number of series batteries unknown, assuming %d\n", n);
+            return true;
+        }
+    }
+
+    port->pos_current_limit = 0;
+    return false;
 }
 
-void Charger::update_soc(BatConf *bat_conf)
+void Charger::estimate_temperature(BatConf *bat_conf, float ambient_temp)
 {
-    static int soc_filtered = 0; // SOC / 100 for better filtering
+    if (ext_temp_sensor) {
+        bat_temp_estimated = false;
+        return;
+    }
+
+    if (!bat_temp_estimated) {
+        // no previous estimation available: start with ambient temperature
+        bat_temperature = ambient_temp;
+        bat_temp_estimated = true;
+        return;
+    }
+
+    float heating_power =
+        port->current_filtered * port->current_filtered * bat_conf->internal_resistance;
+    float steady_state_temp = ambient_temp + heating_power * BAT_THERMAL_RESISTANCE;
 
+    // invalid values written via ThingSet are only reverted after the write
+    uint32_t time_constant = temp_time_constant;
+    if (time_constant < BAT_TEMP_TIME_CONSTANT_MIN) {
+        time_constant = BAT_TEMP_TIME_CONSTANT_MIN;
+    }
+
+    // first-order low-pass filter with time step of 1s
+    bat_temperature += (steady_state_temp - bat_temperature) / time_constant;
+}
+
+void Charger::update_soc(BatConf *bat_conf)
+{
     if (fabs(port->current) < 0.2) {
         int soc_new = (int)((port->bus->voltage - bat_conf->ocv_empty)
                             / (bat_conf->ocv_full - bat_conf->ocv_empty) * 10000.0);
@@ -396,6 +563,80 @@ void Charger::enter_state(int next_state)
     LOG_DBG("Enter State: %d", next_state);
     time_state_changed = uptime();
     state = next_state;
+    apply_voltage_target();
+}
+
+void Charger::update_setpoints(BatConf *bat_conf)
+{
+    if (setpoints.valid && setpoints.series_multiplier == port->bus->series_multiplier
+        && fabsf(bat_temperature - setpoints.temperature) < CHARGER_TEMP_DEADBAND)
+    {
+        return;
+    }
+
+    setpoints.temperature = bat_temperature;
+    setpoints.series_multiplier = port->bus->series_multiplier;
+
+    setpoints.voltage_compensation = bat_conf->temperature_compensation * (bat_temperature - 25);
+    setpoints.topping_voltage = bat_conf->topping_voltage + setpoints.voltage_compensation;
+    setpoints.float_voltage = bat_conf->float_voltage + setpoints.voltage_compensation;
+    setpoints.equalization_voltage =
+        bat_conf->equalization_voltage + setpoints.voltage_compensation;
+    setpoints.absolute_max_voltage = bat_conf->absolute_max_voltage;
+    setpoints.overvoltage_recovery_voltage =
+        (bat_conf->absolute_max_voltage - 0.5F) * port->bus->series_multiplier;
+
+    /*
+     * Negative sign for compensation of actual resistance
+     *
+     * droop_res is multiplied with number of series connected batteries to calculate control
+     * voltage, so we need to divide by number of batteries here for correction
+     */
+    port->bus->sink_droop_res =
+        -bat_conf->wire_resistance / static_cast<float>(port->bus->series_multiplier);
+
+    /*
+     * In discharging direction also include battery internal resistance for current-compensation
+     * of voltage setpoints
+     */
+    port->bus->src_droop_res =
+        -bat_conf->wire_resistance / static_cast<float>(port->bus->series_multiplier)
+        - bat_conf->internal_resistance;
+
+    setpoints.valid = true;
+
+    apply_voltage_target();
+}
+
+void Charger::apply_voltage_target()
+{
+    switch (state) {
+        case CHG_STATE_BULK:
+        case CHG_STATE_TOPPING:
+            port->bus->sink_voltage_intercept = setpoints.topping_voltage;
+            break;
+        case CHG_STATE_FLOAT:
+            port->bus->sink_voltage_intercept = setpoints.float_voltage;
+            break;
+        case CHG_STATE_EQUALIZATION:
+            port->bus->sink_voltage_intercept = setpoints.equalization_voltage;
+            break;
+        case CHG_STATE_FOLLOWER:
+            // safety limit only, current is controlled by external device
+            port->bus->sink_voltage_intercept = setpoints.absolute_max_voltage;
+            break;
+        case CHG_STATE_PROFILE:
+            if (profile_active() && profile_step < profile->num_steps
+                && profile->steps[profile_step].type != CHG_STEP_REST)
+            {
+                port->bus->sink_voltage_intercept =
+                    profile->steps[profile_step].voltage + setpoints.voltage_compensation;
+            }
+            break;
+        default:
+            // keep previous target voltage in idle state
+            break;
+    }
 }
 
 void Charger::discharge_control(BatConf *bat_conf)
@@ -404,8 +645,9 @@ void Charger::discharge_control(BatConf *bat_conf)
 
     if (!empty) {
         // as we don't have a proper SOC estimation, we determine an empty battery by the main
-        // load output being switched off
-        if (flags_check(&load.error_flags, ERR_LOAD_SHEDDING)) {
+        // load output being switched off because of low voltage (shedding requested by the
+        // LoadManager may happen at high SOC already)
+        if (load.low_voltage_disconnect) {
             empty = true;
             num_deep_discharges++;
 
@@ -423,7 +665,7 @@ void Charger::discharge_control(BatConf *bat_conf)
         }
     }
     else {
-        if (!flags_check(&load.error_flags, ERR_LOAD_SHEDDING)) {
+        if (!load.low_voltage_disconnect) {
             empty = false;
         }
     }
@@ -474,6 +716,8 @@ void Charger::discharge_control(BatConf *bat_conf)
 
 void Charger::charge_control(BatConf *bat_conf)
 {
+    update_setpoints(bat_conf);
+
     // check battery temperature for charging direction
     if (bat_temperature > bat_conf->charge_temp_max) {
         port->pos_current_limit = 0;
@@ -487,12 +731,17 @@ void Charger::charge_control(BatConf *bat_conf)
     }
 
     if (dev_stat.has_error(ERR_BAT_OVERVOLTAGE)
-        && port->bus->voltage
-               < (bat_conf->absolute_max_voltage - 0.5F) * port->bus->series_multiplier)
+        && port->bus->voltage < setpoints.overvoltage_recovery_voltage)
     {
         dev_stat.clear_error(ERR_BAT_OVERVOLTAGE);
     }
 
+    if (num_batteries_confidence < 100 && !dev_stat.has_error(ERR_BAT_NUM_UNKNOWN)) {
+        // number of batteries not yet detected and no fallback available
+        port->pos_current_limit = 0;
+        return;
+    }
+
     if (state != CHG_STATE_FOLLOWER && (uptime() - time_last_ctrl_msg) <= 1) {
         enter_state(CHG_STATE_FOLLOWER);
     }
@@ -509,25 +758,22 @@ void Charger::charge_control(BatConf *bat_conf)
                 && bat_temperature < bat_conf->charge_temp_max - 1
                 && bat_temperature > bat_conf->charge_temp_min + 1)
             {
-                port->bus->sink_voltage_intercept =
-                    bat_conf->topping_voltage
-                    + bat_conf->temperature_compensation * (bat_temperature - 25);
                 port->pos_current_limit = bat_conf->charge_current_max;
                 target_current_control = port->pos_current_limit;
                 full = false;
                 dev_stat.clear_error(ERR_BAT_CHG_OVERTEMP);
                 dev_stat.clear_error(ERR_BAT_CHG_UNDERTEMP);
                 dev_stat.clear_error(ERR_BAT_OVERVOLTAGE);
-                enter_state(CHG_STATE_BULK);
+                if (profile_active()) {
+                    enter_profile_step(0);
+                }
+                else {
+                    enter_state(CHG_STATE_BULK);
+                }
             }
             break;
         }
         case CHG_STATE_BULK: {
-            // continuously adjust voltage setting for temperature compensation
-            port->bus->sink_voltage_intercept =
-                bat_conf->topping_voltage
-                + bat_conf->temperature_compensation * (bat_temperature - 25);
-
             if (port->bus->voltage > port->bus->sink_control_voltage()) {
                 target_voltage_timer = 0;
                 enter_state(CHG_STATE_TOPPING);
@@ -535,11 +781,6 @@ void Charger::charge_control(BatConf *bat_conf)
             break;
         }
         case CHG_STATE_TOPPING: {
-            // continuously adjust voltage setting for temperature compensation
-            port->bus->sink_voltage_intercept =
-                bat_conf->topping_voltage
-                + bat_conf->temperature_compensation * (bat_temperature - 25);
-
             // power sharing: multiple devices in parallel supply the same current
             target_current_control = port->current_filtered;
 
@@ -569,14 +810,10 @@ void Charger::charge_control(BatConf *bat_conf)
                         || num_deep_discharges - deep_dis_last_equalization
                                >= bat_conf->equalization_trigger_deep_cycles))
                 {
-                    port->bus->sink_voltage_intercept = bat_conf->equalization_voltage;
                     port->pos_current_limit = bat_conf->equalization_current_limit;
                     enter_state(CHG_STATE_EQUALIZATION);
                 }
                 else if (bat_conf->float_enabled) {
-                    port->bus->sink_voltage_intercept =
-                        bat_conf->float_voltage
-                        + bat_conf->temperature_compensation * (bat_temperature - 25);
                     enter_state(CHG_STATE_FLOAT);
                 }
                 else {
@@ -587,11 +824,6 @@ void Charger::charge_control(BatConf *bat_conf)
             break;
         }
         case CHG_STATE_FLOAT: {
-            // continuously adjust voltage setting for temperature compensation
-            port->bus->sink_voltage_intercept =
-                bat_conf->float_voltage
-                + bat_conf->temperature_compensation * (bat_temperature - 25);
-
             target_current_control = port->current_filtered;
 
             if (port->bus->voltage >= port->bus->sink_control_voltage()) {
@@ -612,11 +844,6 @@ void Charger::charge_control(BatConf *bat_conf)
             break;
         }
         case CHG_STATE_EQUALIZATION: {
-            // continuously adjust voltage setting for temperature compensation
-            port->bus->sink_voltage_intercept =
-                bat_conf->equalization_voltage
-                + bat_conf->temperature_compensation * (bat_temperature - 25);
-
             target_current_control = port->current_filtered;
 
             // current or time limit for equalization reached
@@ -628,9 +855,6 @@ void Charger::charge_control(BatConf *bat_conf)
                 discharged_Ah = 0; // reset coulomb counter again
 
                 if (bat_conf->float_enabled) {
-                    port->bus->sink_voltage_intercept =
-                        bat_conf->float_voltage
-                        + bat_conf->temperature_compensation * (bat_temperature - 25);
                     enter_state(CHG_STATE_FLOAT);
                 }
                 else {
@@ -644,41 +868,185 @@ void Charger::charge_control(BatConf *bat_conf)
             if ((uptime() - time_last_ctrl_msg) > 1) {
                 // go back to normal state machine
                 port->pos_current_limit = bat_conf->charge_current_max;
-                enter_state(CHG_STATE_BULK);
+                if (profile_active()) {
+                    enter_profile_step(0);
+                }
+                else {
+                    enter_state(CHG_STATE_BULK);
+                }
             }
             else {
                 // set current target as received from external device
+                // (voltage is limited to absolute maximum, see apply_voltage_target)
                 port->pos_current_limit = target_current_control;
-                // set safety limit for voltage
-                port->bus->sink_voltage_intercept = bat_conf->absolute_max_voltage;
             }
             break;
         }
+        case CHG_STATE_PROFILE: {
+            if (profile_active()) {
+                profile_control(bat_conf);
+            }
+            else {
+                // profile was removed during charging
+                port->pos_current_limit = bat_conf->charge_current_max;
+                enter_state(CHG_STATE_BULK);
+            }
+            break;
+        }
+    }
+}
+
+void Charger::enter_profile_step(uint16_t step_index)
+{
+    const ChargeStep *step = &profile->steps[step_index];
+
+    LOG_DBG("Enter profile step: %d", step_index);
+
+    // a final step without termination criteria is held like float charging, so the battery
+    // is considered full when reaching it
+    if (step_index > 0 && step_index == profile->num_steps - 1 && step->termination == 0) {
+        full = true;
+        num_full_charges++;
+        discharged_Ah = 0; // reset coulomb counter
+    }
+    else if (step_index == 0) {
+        full = false;
+    }
+
+    profile_step = step_index;
+    profile_step_Ah = 0;
+    profile_dvdt_voltage = port->bus->voltage_filtered;
+    time_profile_dvdt = uptime();
+    time_target_voltage_reached = uptime();
+    enter_state(CHG_STATE_PROFILE);
+}
+
+void Charger::profile_control(BatConf *bat_conf)
+{
+    if (profile_step >= profile->num_steps) {
+        // profile was replaced by a shorter one
+        enter_profile_step(0);
+    }
+
+    const ChargeStep *step = &profile->steps[profile_step];
+    uint32_t step_time = uptime() - time_state_changed;
+    bool last_step = (profile_step == profile->num_steps - 1);
+    bool finished = false;
+
+    switch (step->type) {
+        case CHG_STEP_CC:
+            port->pos_current_limit = step->current;
+            target_current_control = port->pos_current_limit;
+            break;
+        case CHG_STEP_CV:
+            port->pos_current_limit = step->current;
+            // power sharing: multiple devices in parallel supply the same current
+            target_current_control = port->current_filtered;
+            break;
+        case CHG_STEP_PULSE:
+            if (step_time % (step->pulse_on_time + step->pulse_off_time) < step->pulse_on_time) {
+                port->pos_current_limit = step->current;
+            }
+            else {
+                port->pos_current_limit = 0;
+            }
+            target_current_control = port->pos_current_limit;
+            break;
+        default:
+            port->pos_current_limit = 0;
+            target_current_control = 0;
+            break;
+    }
+
+    bool voltage_reached =
+        step->type != CHG_STEP_REST
+        && port->bus->voltage_filtered >= port->bus->sink_control_voltage() - 0.05F;
+    if (voltage_reached) {
+        time_target_voltage_reached = uptime();
+    }
+
+    // this function is called once per second
+    profile_step_Ah += port->current_filtered / 3600.0F;
+
+    if (step->type == CHG_STEP_CC && port->bus->voltage > port->bus->sink_control_voltage()) {
+        finished = true;
+    }
+
+    if ((step->termination & CHG_TERM_CURRENT) && voltage_reached
+        && port->current_filtered < step->cutoff_current)
+    {
+        finished = true;
+    }
+
+    if ((step->termination & CHG_TERM_TIME) && step_time >= step->duration) {
+        finished = true;
+    }
+
+    if ((step->termination & CHG_TERM_AH) && profile_step_Ah >= step->charge_Ah) {
+        finished = true;
+    }
+
+    if ((step->termination & CHG_TERM_DVDT) && uptime() - time_profile_dvdt >= 60) {
+        float dv = (port->bus->voltage_filtered - profile_dvdt_voltage)
+                   / port->bus->series_multiplier;
+        if (dv <= step->dvdt) {
+            finished = true;
+        }
+        profile_dvdt_voltage = port->bus->voltage_filtered;
+        time_profile_dvdt = uptime();
+    }
+
+    if (finished) {
+        if (!last_step) {
+            enter_profile_step(profile_step + 1);
+        }
+        else {
+            full = true;
+            num_full_charges++;
+            discharged_Ah = 0; // reset coulomb counter
+            port->pos_current_limit = 0;
+            enter_state(CHG_STATE_IDLE);
+        }
+    }
+    else if (last_step && step->termination == 0
+             && uptime() - time_target_voltage_reached > bat_conf->float_recharge_time
+             && port->bus->voltage_filtered
+                    < port->bus->sink_control_voltage(bat_conf->recharge_voltage))
+    {
+        // the battery was discharged while holding the final step: restart the profile
+        enter_profile_step(0);
     }
 }
 
-void Charger::init_terminal(BatConf *bat) const
+void Charger::init_terminal(BatConf *bat)
 {
-    port->bus->sink_voltage_intercept = bat->topping_voltage;
+    // calculates droop resistances and compensated voltages
+    invalidate_setpoints();
+    update_setpoints(bat);
+
+    port->bus->sink_voltage_intercept = setpoints.topping_voltage;
     port->bus->src_voltage_intercept = bat->load_disconnect_voltage;
 
     port->neg_current_limit = -bat->discharge_current_max;
     port->pos_current_limit = bat->charge_current_max;
+}
 
-    /*
-     * Negative sign for compensation of actual resistance
-     *
-     * droop_res is multiplied with number of series connected batteries to calculate control
-     * voltage, so we need to divide by number of batteries here for correction
-     */
-    port->bus->sink_droop_res =
-        -bat->wire_resistance / static_cast<float>(port->bus->series_multiplier);
+void Charger::restart_profile()
+{
+    // if the profile was removed, charge_control continues with the normal state machine
+    if (state == CHG_STATE_PROFILE && profile_active()) {
+        enter_profile_step(0);
+    }
+}
 
-    /*
-     * In discharging direction also include battery internal resistance for current-compensation
-     * of voltage setpoints
-     */
-    port->bus->src_droop_res =
-        -bat->wire_resistance / static_cast<float>(port->bus->series_multiplier)
-        - bat->internal_resistance;
+void Charger::resume_state(BatConf *bat)
+{
+    apply_voltage_target();
+
+    if (state == CHG_STATE_EQUALIZATION) {
+        port->pos_current_limit = bat->equalization_current_limit;
+    }
+    else if (state == CHG_STATE_IDLE) {
+        port->pos_current_limit = 0;
+    }
 }
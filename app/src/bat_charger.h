@@ -17,10 +17,17 @@
 #include <stdint.h>
 #include <time.h>
 
+#include "charge_profile.h"
 #include "power_port.h"
 
 #define CHARGER_TIME_NEVER INT32_MIN
 
+/*
+ * Valid range of the battery thermal time constant (s), see Charger::temp_time_constant
+ */
+#define BAT_TEMP_TIME_CONSTANT_MIN 60
+#define BAT_TEMP_TIME_CONSTANT_MAX 86400
+
 /**
  * Battery cell types
  */
@@ -333,18 +340,51 @@ enum ChargerState
      * match the current of the other controller.
      */
     CHG_STATE_FOLLOWER,
+
+    /**
+     * Custom charge profile
+     *
+     * Replaces bulk, topping, float and equalization phases if a user-programmed charge profile
+     * is configured. The steps of the profile are executed one after the other.
+     */
+    CHG_STATE_PROFILE,
 };
 
+/**
+ * Charger setpoints derived from battery configuration and state
+ *
+ * The setpoints are cached and only recalculated if the battery temperature changed by more than
+ * a small deadband, the number of series batteries changed or the BatConf was updated.
+ */
+typedef struct
+{
+    float topping_voltage;              ///< Temperature-compensated topping voltage (V)
+    float float_voltage;                ///< Temperature-compensated float voltage (V)
+    float equalization_voltage;         ///< Temperature-compensated equalization voltage (V)
+    float voltage_compensation;         ///< Temperature compensation offset (V)
+    float absolute_max_voltage;         ///< Absolute max. voltage of single battery (V)
+    float overvoltage_recovery_voltage; ///< Total voltage to clear overvoltage error (V)
+    float temperature;                  ///< Battery temperature used for calculation (°C)
+    int16_t series_multiplier;          ///< Number of series batteries used for calculation
+    bool valid;                         ///< False if setpoints must be recalculated
+} ChargerSetpoints;
+
 /**
  * Charger configuration and battery state
  */
 class Charger
 {
 public:
-    Charger(PowerPort *pwr_port) : port(pwr_port){};
+    Charger(PowerPort *pwr_port, const ChargeProfile *chg_profile = NULL)
+        : port(pwr_port), profile(chg_profile){};
 
     PowerPort *port;
 
+    /**
+     * Custom charge profile (only used if it contains at least one step)
+     */
+    const ChargeProfile *profile;
+
     /**
      * Current charger state (see enum ChargerState)
      */
@@ -360,6 +400,25 @@ public:
      */
     bool ext_temp_sensor;
 
+    /**
+     * Flag to indicate that bat_temperature is estimated using a thermal model because no
+     * external temperature sensor is available
+     */
+    bool bat_temp_estimated;
+
+    /**
+     * Thermal time constant of battery and enclosure (s) used for temperature estimation
+     */
+    uint32_t temp_time_constant = CONFIG_BAT_TEMP_TIME_CONSTANT;
+
+    /**
+     * Confidence of the detected number of series batteries (%)
+     *
+     * Charging is only allowed if this value reached 100% or if a fallback is used after a
+     * timeout (indicated by ERR_BAT_NUM_UNKNOWN).
+     */
+    uint16_t num_batteries_confidence;
+
     /**
      * Estimated usable capacity (Ah) based on coulomb counting
      */
@@ -385,6 +444,11 @@ public:
      */
     uint16_t soc = 100;
 
+    /**
+     * Filtered SOC based on open circuit voltage (0.01 %)
+     */
+    int soc_filtered = 0;
+
     /**
      * State of Health (%)
      */
@@ -438,9 +502,67 @@ public:
     float target_current_control;
 
     /**
-     * Detect if two batteries are connected in series (12V/24V auto-detection)
+     * Cached setpoints derived from BatConf, battery temperature and series multiplier
+     */
+    ChargerSetpoints setpoints = {};
+
+    /**
+     * Index of currently active step if charging with custom charge profile
+     */
+    uint16_t profile_step;
+
+    /**
+     * Charge (Ah) transferred to the battery during current profile step
+     */
+    float profile_step_Ah;
+
+    /**
+     * Battery voltage at last dV/dt evaluation of current profile step
+     */
+    float profile_dvdt_voltage;
+
+    /**
+     * Timestamp of last dV/dt evaluation of current profile step
      */
-    void detect_num_batteries(BatConf *bat) const;
+    time_t time_profile_dvdt = CHARGER_TIME_NEVER;
+
+    /**
+     * Series multiplier matching the last voltage sample during detection (0 if none or
+     * ambiguous)
+     */
+    int16_t num_batteries_candidate;
+
+    /**
+     * Number of consecutive samples with the same unique series multiplier candidate
+     */
+    uint16_t num_batteries_samples;
+
+    /**
+     * Time (s) since start of the detection of the number of series batteries
+     */
+    uint16_t num_batteries_detect_time;
+
+    /**
+     * Detect number of batteries connected in series (12/24/36/48V auto-detection)
+     *
+     * The filtered bus voltage is observed over several seconds. The detection is only finished
+     * if exactly one series multiplier matches the measured voltage for all samples, considering
+     * the voltage limits of the battery chemistry and of the hardware. If no multiplier matches,
+     * a slightly lower voltage range is checked to detect deeply discharged batteries. Charging
+     * is not allowed before the detection is finished.
+     *
+     * If the detection is not successful within a timeout, the lowest multiplier which doesn't
+     * result in overcharging is used and ERR_BAT_NUM_UNKNOWN is set. The detection continues
+     * until a unique multiplier is found.
+     *
+     * Must be called once per second until it returns true.
+     *
+     * @param bat Battery configuration of a single battery
+     * @param voltage_max Maximum voltage of the hardware at the battery terminal
+     *
+     * @returns true if the detection is finished
+     */
+    bool detect_num_batteries(BatConf *bat, float voltage_max);
 
     /**
      * Discharging control update (for load output), should be called once per second
@@ -452,6 +574,19 @@ public:
      */
     void charge_control(BatConf *bat_conf);
 
+    /**
+     * Battery temperature estimation if no external sensor is connected
+     *
+     * A first-order thermal model with the given ambient temperature as reference and additional
+     * heating caused by the current through the battery internal resistance is used.
+     *
+     * Must be called exactly once per second.
+     *
+     * @param bat_conf Battery configuration (for internal resistance)
+     * @param ambient_temp Ambient temperature reference, e.g. internal MCU temperature (°C)
+     */
+    void estimate_temperature(BatConf *bat_conf, float ambient_temp);
+
     /**
      * SOC estimation
      *
@@ -464,10 +599,66 @@ public:
      *
      * @param bat Configuration to be used for terminal setpoints
      */
-    void init_terminal(BatConf *bat) const;
+    void init_terminal(BatConf *bat);
+
+    /**
+     * Apply voltage target and current limit of a charger state restored after a warm restart
+     *
+     * Must be called after init_terminal, as the terminal is initialized for bulk charging.
+     *
+     * @param bat Configuration to be used for terminal setpoints
+     */
+    void resume_state(BatConf *bat);
+
+    /**
+     * Start again with the first step after the custom charge profile was changed
+     *
+     * Must be called with the charge profile lock held (see charge_profile_lock).
+     */
+    void restart_profile();
+
+    /**
+     * Recalculate cached setpoints if necessary and apply them to the terminal and bus
+     *
+     * Called by charge_control, so it usually does not have to be called separately.
+     *
+     * @param bat_conf Battery configuration used for the calculation
+     */
+    void update_setpoints(BatConf *bat_conf);
+
+    /**
+     * Force recalculation of cached setpoints, e.g. after the battery configuration was changed
+     */
+    void invalidate_setpoints()
+    {
+        setpoints.valid = false;
+    }
 
 private:
     void enter_state(int next_state);
+
+    /**
+     * Set bus target voltage from cached setpoints depending on current state
+     */
+    void apply_voltage_target();
+
+    /**
+     * Check if a custom charge profile is configured
+     */
+    bool profile_active() const
+    {
+        return profile != NULL && profile->num_steps > 0;
+    }
+
+    /**
+     * Start given step of the custom charge profile
+     */
+    void enter_profile_step(uint16_t step_index);
+
+    /**
+     * Custom charge profile execution, called by charge_control in CHG_STATE_PROFILE
+     */
+    void profile_control(BatConf *bat_conf);
 };
 
 /**
@@ -484,10 +675,36 @@ private:
  */
 void battery_conf_init(BatConf *bat, int type, int num_cells, float nominal_capacity);
 
+/**
+ * Battery configuration plausibility rules
+ *
+ * Each enum represents a unique bit in the failed rules bitmask reported by battery_conf_check().
+ */
+enum BatConfRule
+{
+    BAT_CONF_RULE_LOAD_HYSTERESIS = 1U << 0,    ///< Load reconnect > load disconnect + 0.4 V
+    BAT_CONF_RULE_RECHARGE_TOPPING = 1U << 1,   ///< Recharge < topping - 0.4 V
+    BAT_CONF_RULE_RECHARGE_LOAD = 1U << 2,      ///< Recharge > load disconnect + 1.0 V
+    BAT_CONF_RULE_LOAD_ABS_MIN = 1U << 3,       ///< Load disconnect > absolute min + 0.4 V
+    BAT_CONF_RULE_INT_RESISTANCE = 1U << 4,     ///< Max. 10% drop at max. discharge current
+    BAT_CONF_RULE_WIRE_RESISTANCE = 1U << 5,    ///< Max. 3% drop at max. discharge current
+    BAT_CONF_RULE_CUTOFF_CURRENT_MAX = 1U << 6, ///< Topping cut-off current < C/10
+    BAT_CONF_RULE_CUTOFF_CURRENT_MIN = 1U << 7, ///< Topping cut-off current > 0.01 A
+    BAT_CONF_RULE_FLOAT_TOPPING = 1U << 8,      ///< Float < topping (if float enabled)
+    BAT_CONF_RULE_FLOAT_LOAD = 1U << 9,         ///< Float > load disconnect (if float enabled)
+};
+
 /**
  * Checks battery user settings for plausibility
+ *
+ * The rules are evaluated from a constant table without any dynamic memory allocation.
+ *
+ * @param bat Battery configuration to be checked
+ * @param failed_rules Optional pointer to store bitmask of failed rules (see enum BatConfRule)
+ *
+ * @returns true if all rules passed
  */
-bool battery_conf_check(BatConf *bat);
+bool battery_conf_check(BatConf *bat, uint32_t *failed_rules = NULL);
 
 /**
  * Overwrites battery settings (config should be checked first)
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "charge_profile.h"
+
+#include <zephyr/kernel.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(charge_profile, CONFIG_BAT_LOG_LEVEL);
+
+#include <math.h>
+#include <string.h>
+
+#define CHG_TERM_ALL (CHG_TERM_CURRENT | CHG_TERM_TIME | CHG_TERM_DVDT | CHG_TERM_AH)
+
+K_MUTEX_DEFINE(profile_lock);
+
+static inline uint16_t get_u16(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+static inline void put_u16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = value & 0xFF;
+    buf[1] = value >> 8;
+}
+
+static bool charge_step_valid(const ChargeStep *step, bool last, float voltage_max,
+                              float current_max)
+{
+    if (step->type < CHG_STEP_CC || step->type > CHG_STEP_PULSE) {
+        LOG_ERR("Invalid step type %d", step->type);
+        return false;
+    }
+
+    if ((step->termination & ~CHG_TERM_ALL) != 0) {
+        LOG_ERR("Invalid termination flags 0x%x", step->termination);
+        return false;
+    }
+
+    if (step->type != CHG_STEP_REST
+        && (step->voltage <= 0 || step->voltage > voltage_max || step->current <= 0
+            || step->current > current_max))
+    {
+        LOG_ERR("Step voltage or current out of range");
+        return false;
+    }
+
+    if (step->type == CHG_STEP_PULSE && (step->pulse_on_time == 0 || step->pulse_off_time == 0)) {
+        LOG_ERR("Pulse on and off times must not be zero");
+        return false;
+    }
+
+    // CC steps are always finished when reaching the voltage limit, all other steps need at
+    // least one termination criterion (except for a CV or pulse step at the end of the profile)
+    if (step->termination == 0 && step->type != CHG_STEP_CC
+        && (!last || step->type == CHG_STEP_REST))
+    {
+        LOG_ERR("Step without termination criteria");
+        return false;
+    }
+
+    if (((step->termination & CHG_TERM_CURRENT) && step->cutoff_current <= 0)
+        || ((step->termination & CHG_TERM_TIME) && step->duration == 0)
+        || ((step->termination & CHG_TERM_AH) && step->charge_Ah <= 0))
+    {
+        LOG_ERR("Invalid termination limits");
+        return false;
+    }
+
+    return true;
+}
+
+bool charge_profile_decode(ChargeProfile *profile, const uint8_t *data, size_t len,
+                           float voltage_max, float current_max)
+{
+    ChargeProfile tmp;
+
+    // unused steps are copied to the profile as well, so they must not contain random data
+    memset(&tmp, 0, sizeof(tmp));
+
+    if (len == 0) {
+        profile->num_steps = 0;
+        return true;
+    }
+
+    if (len < CHARGE_PROFILE_HEADER_SIZE || data[0] != CHARGE_PROFILE_FORMAT_VERSION) {
+        LOG_ERR("Unsupported charge profile format");
+        return false;
+    }
+
+    tmp.num_steps = data[1];
+    if (tmp.num_steps > CHARGE_PROFILE_MAX_STEPS
+        || len != CHARGE_PROFILE_HEADER_SIZE + tmp.num_steps * CHARGE_PROFILE_STEP_SIZE)
+    {
+        LOG_ERR("Invalid charge profile length");
+        return false;
+    }
+
+    for (int i = 0; i < tmp.num_steps; i++) {
+        const uint8_t *buf = &data[CHARGE_PROFILE_HEADER_SIZE + i * CHARGE_PROFILE_STEP_SIZE];
+        ChargeStep *step = &tmp.steps[i];
+
+        step->type = buf[0];
+        step->termination = buf[1];
+        step->voltage = get_u16(&buf[2]) * 0.001F;
+        step->current = get_u16(&buf[4]) * 0.01F;
+        step->cutoff_current = get_u16(&buf[6]) * 0.01F;
+        step->duration = get_u16(&buf[8]) * 60;
+        step->dvdt = static_cast<int16_t>(get_u16(&buf[10])) * 0.001F;
+        step->charge_Ah = get_u16(&buf[12]) * 0.1F;
+        step->pulse_on_time = buf[14];
+        step->pulse_off_time = buf[15];
+
+        if (!charge_step_valid(step, i == tmp.num_steps - 1, voltage_max, current_max)) {
+            LOG_ERR("Charge profile step %d rejected", i);
+            return false;
+        }
+    }
+
+    memcpy(profile, &tmp, sizeof(ChargeProfile));
+    return true;
+}
+
+size_t charge_profile_encode(const ChargeProfile *profile, uint8_t *buf, size_t size)
+{
+    size_t len = CHARGE_PROFILE_HEADER_SIZE + profile->num_steps * CHARGE_PROFILE_STEP_SIZE;
+
+    if (profile->num_steps == 0 || len > size) {
+        return 0;
+    }
+
+    buf[0] = CHARGE_PROFILE_FORMAT_VERSION;
+    buf[1] = profile->num_steps;
+
+    for (int i = 0; i < profile->num_steps; i++) {
+        uint8_t *step_buf = &buf[CHARGE_PROFILE_HEADER_SIZE + i * CHARGE_PROFILE_STEP_SIZE];
+        const ChargeStep *step = &profile->steps[i];
+
+        step_buf[0] = step->type;
+        step_buf[1] = step->termination;
+        put_u16(&step_buf[2], step->voltage * 1000.0F + 0.5F);
+        put_u16(&step_buf[4], step->current * 100.0F + 0.5F);
+        put_u16(&step_buf[6], step->cutoff_current * 100.0F + 0.5F);
+        put_u16(&step_buf[8], step->duration / 60);
+        put_u16(&step_buf[10], static_cast<int16_t>(lroundf(step->dvdt * 1000.0F)));
+        put_u16(&step_buf[12], step->charge_Ah * 10.0F + 0.5F);
+        step_buf[14] = step->pulse_on_time;
+        step_buf[15] = step->pulse_off_time;
+    }
+
+    return len;
+}
+
+void charge_profile_lock()
+{
+    k_mutex_lock(&profile_lock, K_FOREVER);
+}
+
+void charge_profile_unlock()
+{
+    k_mutex_unlock(&profile_lock);
+}
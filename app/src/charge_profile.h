@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef CHARGE_PROFILE_H
+#define CHARGE_PROFILE_H
+
+/** @file
+ *
+ * @brief User-programmable multi-stage charge profiles
+ *
+ * A charge profile replaces the fixed bulk/topping/float/equalization sequence of the charger
+ * state machine by a sequence of configurable steps. It is uploaded as a compact binary blob
+ * (see charge_profile_decode) and stored in NVM together with the other settings.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef CONFIG_CHARGE_PROFILE_MAX_STEPS
+#define CHARGE_PROFILE_MAX_STEPS CONFIG_CHARGE_PROFILE_MAX_STEPS
+#else
+#define CHARGE_PROFILE_MAX_STEPS 8
+#endif
+
+/**
+ * Version of the binary charge profile format
+ */
+#define CHARGE_PROFILE_FORMAT_VERSION 1
+
+#define CHARGE_PROFILE_HEADER_SIZE 2
+#define CHARGE_PROFILE_STEP_SIZE   16
+
+/**
+ * Maximum size of an encoded charge profile (bytes)
+ */
+#define CHARGE_PROFILE_SIZE_MAX \
+    (CHARGE_PROFILE_HEADER_SIZE + CHARGE_PROFILE_MAX_STEPS * CHARGE_PROFILE_STEP_SIZE)
+
+/**
+ * Charge profile step types
+ */
+enum ChargeStepType
+{
+    /**
+     * Constant current
+     *
+     * Charging with the specified current limit. The step is finished as soon as the voltage
+     * limit is reached (or any of the additional termination criteria).
+     */
+    CHG_STEP_CC = 1,
+
+    /**
+     * Constant voltage
+     *
+     * Charging at the specified voltage with the specified current limit until one of the
+     * termination criteria is met.
+     */
+    CHG_STEP_CV,
+
+    /**
+     * Rest
+     *
+     * No charging current, e.g. to let the voltage relax before the next step.
+     */
+    CHG_STEP_REST,
+
+    /**
+     * Pulse charging
+     *
+     * Current is switched between the current limit and zero with the specified on and off
+     * times. The voltage limit applies during the on-phase.
+     */
+    CHG_STEP_PULSE,
+};
+
+/**
+ * Charge profile step termination criteria
+ *
+ * Each enum represents a unique bit in the termination field of a step. The step is finished
+ * as soon as any of the enabled criteria is met.
+ */
+enum ChargeStepTermination
+{
+    CHG_TERM_CURRENT = 1U << 0, ///< Current below cut-off current at target voltage
+    CHG_TERM_TIME = 1U << 1,    ///< Step duration exceeded
+    CHG_TERM_DVDT = 1U << 2,    ///< Voltage change per minute below threshold
+    CHG_TERM_AH = 1U << 3,      ///< Charged Ah in this step exceeded
+};
+
+/**
+ * Single step of a charge profile
+ */
+typedef struct
+{
+    uint8_t type;           ///< One of enum ChargeStepType
+    uint8_t termination;    ///< Bitmask of enum ChargeStepTermination
+    uint8_t pulse_on_time;  ///< On-time for pulse charging (s)
+    uint8_t pulse_off_time; ///< Off-time for pulse charging (s)
+    float voltage;          ///< Target or limit voltage of single battery (V)
+    float current;          ///< Current limit (A)
+    float cutoff_current;   ///< Cut-off current for CHG_TERM_CURRENT (A)
+    uint32_t duration;      ///< Time limit for CHG_TERM_TIME (s)
+    float dvdt;             ///< Threshold for CHG_TERM_DVDT (V/min, may be negative)
+    float charge_Ah;        ///< Charge limit for CHG_TERM_AH (Ah)
+} ChargeStep;
+
+/**
+ * Charge profile consisting of a sequence of steps
+ *
+ * The profile is executed by the Charger if num_steps is greater than 0. If the last step has
+ * no termination criteria, it is held similar to float charging until the battery voltage
+ * drops below the recharge voltage.
+ */
+typedef struct
+{
+    uint8_t num_steps;
+    ChargeStep steps[CHARGE_PROFILE_MAX_STEPS];
+} ChargeProfile;
+
+/**
+ * Decode and validate charge profile from binary format
+ *
+ * Format (little-endian): 1 byte format version, 1 byte number of steps, followed by 16 bytes
+ * per step:
+ *
+ *     uint8  type
+ *     uint8  termination
+ *     uint16 voltage (mV)
+ *     uint16 current (10 mA)
+ *     uint16 cut-off current (10 mA)
+ *     uint16 duration (min)
+ *     int16  dV/dt threshold (mV/min)
+ *     uint16 charge (0.1 Ah)
+ *     uint8  pulse on-time (s)
+ *     uint8  pulse off-time (s)
+ *
+ * An empty buffer is valid and disables the profile.
+ *
+ * @param profile Profile to store the decoded data (only changed if data is valid)
+ * @param data Buffer containing the encoded profile
+ * @param len Number of bytes in the buffer
+ * @param voltage_max Maximum allowed voltage of single battery (V)
+ * @param current_max Maximum allowed charge current (A)
+ *
+ * @returns true if the data was valid and the profile was updated
+ */
+bool charge_profile_decode(ChargeProfile *profile, const uint8_t *data, size_t len,
+                           float voltage_max, float current_max);
+
+/**
+ * Encode charge profile into binary format (see charge_profile_decode)
+ *
+ * @param profile Profile to be encoded
+ * @param buf Buffer to store the encoded data
+ * @param size Size of the buffer
+ *
+ * @returns Number of bytes written or 0 if the buffer was too small or the profile is empty
+ */
+size_t charge_profile_encode(const ChargeProfile *profile, uint8_t *buf, size_t size);
+
+/**
+ * Lock access to the active charge profile
+ *
+ * The profile is updated via ThingSet from a different thread than the charger state machine,
+ * so both have to hold the lock while accessing the profile.
+ */
+void charge_profile_lock();
+
+/**
+ * Unlock access to the active charge profile
+ */
+void charge_profile_unlock();
+
+#endif /* CHARGE_PROFILE_H */
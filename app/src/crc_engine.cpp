@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "crc_engine.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+/*
+ * Little-endian word as fed to the CRC unit by the legacy CRC (bytes >= len are set to 0)
+ */
+static inline uint32_t legacy_word(const uint8_t *bytes, size_t remaining)
+{
+    uint32_t word = 0;
+    for (size_t i = 0; i < 4 && i < remaining; i++) {
+        word |= (uint32_t)bytes[i] << (i * 8);
+    }
+    return word;
+}
+
+#ifdef CONFIG_SOC_FAMILY_STM32
+
+#include <soc.h>
+#include <stm32_ll_bus.h>
+#include <stm32_ll_crc.h>
+#include <stm32_ll_dma.h>
+
+// DMA channel not used by the ADC (channel 1) or any other peripheral
+#define CRC_DMA DMA1
+#define CRC_DMA_CHANNEL LL_DMA_CHANNEL_5
+
+// maximum number of words per DMA transfer (16-bit length register)
+#define CRC_DMA_MAX_WORDS 0xFFFF
+
+// time after which a transfer is aborted and the remaining words are fed by the CPU (ms)
+#define CRC_DMA_TIMEOUT_MS 10
+
+K_MUTEX_DEFINE(crc_lock);
+
+static bool crc_initialized;
+
+static void crc_init()
+{
+    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+
+#if defined(CONFIG_SOC_SERIES_STM32G4X)
+    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMAMUX1);
+    LL_DMA_SetPeriphRequest(CRC_DMA, CRC_DMA_CHANNEL, LL_DMAMUX_REQ_MEM2MEM);
+#endif
+
+    // memory-to-memory transfer with the CRC data register as fixed destination
+    LL_DMA_ConfigTransfer(CRC_DMA, CRC_DMA_CHANNEL,
+                          LL_DMA_DIRECTION_MEMORY_TO_MEMORY | LL_DMA_MODE_NORMAL
+                              | LL_DMA_PERIPH_INCREMENT | LL_DMA_MEMORY_NOINCREMENT
+                              | LL_DMA_PDATAALIGN_WORD | LL_DMA_MDATAALIGN_WORD
+                              | LL_DMA_PRIORITY_LOW);
+
+    crc_initialized = true;
+}
+
+// reflected input and output with standard polynomial 0x04C11DB7 for CRC-32 (IEEE 802.3)
+static void crc_configure()
+{
+    // enabled on every call, so the unit can't be left without clock
+    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_CRC);
+
+    LL_CRC_SetInitialData(CRC, 0xFFFFFFFFU);
+    LL_CRC_SetOutputDataReverseMode(CRC, LL_CRC_OUTDATA_REVERSE_BIT);
+    LL_CRC_ResetCRCCalculationUnit(CRC);
+}
+
+static void crc_feed_bytes(const uint8_t *data, size_t len)
+{
+    LL_CRC_SetInputDataReverseMode(CRC, LL_CRC_INDATA_REVERSE_BYTE);
+    for (size_t i = 0; i < len; i++) {
+        LL_CRC_FeedData8(CRC, data[i]);
+    }
+}
+
+static void crc_feed_words(const uint32_t *data, size_t num_words)
+{
+    LL_CRC_SetInputDataReverseMode(CRC, LL_CRC_INDATA_REVERSE_WORD);
+
+    if (num_words * 4 < CRC_ENGINE_DMA_THRESHOLD) {
+        for (size_t i = 0; i < num_words; i++) {
+            LL_CRC_FeedData32(CRC, data[i]);
+        }
+        return;
+    }
+
+    while (num_words > 0) {
+        uint32_t chunk = MIN(num_words, CRC_DMA_MAX_WORDS);
+
+        LL_DMA_ConfigAddresses(CRC_DMA, CRC_DMA_CHANNEL, (uint32_t)data, (uint32_t)&CRC->DR,
+                               LL_DMA_DIRECTION_MEMORY_TO_MEMORY);
+        LL_DMA_SetDataLength(CRC_DMA, CRC_DMA_CHANNEL, chunk);
+        LL_DMA_ClearFlag_GI5(CRC_DMA);
+        LL_DMA_EnableChannel(CRC_DMA, CRC_DMA_CHANNEL);
+
+        /*
+         * The calling thread can be suspended, as the DMA doesn't need the CPU. Completion is
+         * detected via the length register instead of the TC flag, so that the wait can't get
+         * stuck if the flag is cleared by another driver.
+         */
+        int64_t start = k_uptime_get();
+        while (LL_DMA_GetDataLength(CRC_DMA, CRC_DMA_CHANNEL) > 0
+               && !LL_DMA_IsActiveFlag_TE5(CRC_DMA)
+               && k_uptime_get() - start < CRC_DMA_TIMEOUT_MS)
+        {
+            k_yield();
+        }
+
+        LL_DMA_DisableChannel(CRC_DMA, CRC_DMA_CHANNEL);
+        LL_DMA_ClearFlag_GI5(CRC_DMA);
+
+        // words not transferred in case of an error or timeout are fed by the CPU
+        uint32_t remaining = LL_DMA_GetDataLength(CRC_DMA, CRC_DMA_CHANNEL);
+        for (uint32_t i = chunk - remaining; i < chunk; i++) {
+            LL_CRC_FeedData32(CRC, data[i]);
+        }
+
+        data += chunk;
+        num_words -= chunk;
+    }
+}
+
+uint32_t crc_engine_crc32(const void *data, size_t len)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    k_mutex_lock(&crc_lock, K_FOREVER);
+
+    if (!crc_initialized) {
+        crc_init();
+    }
+
+    crc_configure();
+
+    // DMA and 32-bit access to the CRC peripheral require word-aligned data
+    size_t head = MIN(len, (4 - ((uintptr_t)bytes & 3)) & 3);
+    crc_feed_bytes(bytes, head);
+    bytes += head;
+    len -= head;
+
+    crc_feed_words((const uint32_t *)bytes, len / 4);
+    crc_feed_bytes(bytes + (len & ~3U), len & 3);
+
+    uint32_t crc = ~LL_CRC_ReadData32(CRC);
+
+    k_mutex_unlock(&crc_lock);
+
+    return crc;
+}
+
+uint32_t crc_engine_crc32_legacy(const void *data, size_t len)
+{
+    k_mutex_lock(&crc_lock, K_FOREVER);
+
+    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_CRC);
+
+    // default configuration of the CRC unit without any reversal
+    LL_CRC_SetInitialData(CRC, 0xFFFFFFFFU);
+    LL_CRC_SetInputDataReverseMode(CRC, LL_CRC_INDATA_REVERSE_NONE);
+    LL_CRC_SetOutputDataReverseMode(CRC, LL_CRC_OUTDATA_REVERSE_NONE);
+    LL_CRC_ResetCRCCalculationUnit(CRC);
+
+    for (size_t i = 0; i < len; i += 4) {
+        LL_CRC_FeedData32(CRC, legacy_word((const uint8_t *)data + i, len - i));
+    }
+
+    uint32_t crc = LL_CRC_ReadData32(CRC);
+
+    // restore configuration for crc_engine_crc32
+    LL_CRC_SetOutputDataReverseMode(CRC, LL_CRC_OUTDATA_REVERSE_BIT);
+
+    k_mutex_unlock(&crc_lock);
+
+    return crc;
+}
+
+#else
+
+// lookup tables for slice-by-4 calculation of CRC-32 with reflected polynomial
+static uint32_t crc_table[4][256];
+
+static bool crc_initialized;
+
+static void crc_init()
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320U & -(crc & 1));
+        }
+        crc_table[0][i] = crc;
+    }
+
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 4; k++) {
+            crc_table[k][i] = (crc_table[k - 1][i] >> 8) ^ crc_table[0][crc_table[k - 1][i] & 0xFF];
+        }
+    }
+
+    crc_initialized = true;
+}
+
+uint32_t crc_engine_crc32(const void *data, size_t len)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t crc = 0xFFFFFFFFU;
+
+    if (!crc_initialized) {
+        crc_init();
+    }
+
+    // process 4 bytes per iteration (independent of alignment and endianness)
+    while (len >= 4) {
+        crc ^= bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+        crc = crc_table[3][crc & 0xFF] ^ crc_table[2][(crc >> 8) & 0xFF]
+              ^ crc_table[1][(crc >> 16) & 0xFF] ^ crc_table[0][crc >> 24];
+        bytes += 4;
+        len -= 4;
+    }
+
+    while (len > 0) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *bytes) & 0xFF];
+        bytes++;
+        len--;
+    }
+
+    return ~crc;
+}
+
+uint32_t crc_engine_crc32_legacy(const void *data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFFU;
+
+    // MSB first without reflection and final XOR, as calculated by the STM32 CRC unit
+    for (size_t i = 0; i < len; i += 4) {
+        crc ^= legacy_word((const uint8_t *)data + i, len - i);
+        for (int bit = 0; bit < 32; bit++) {
+            crc = (crc << 1) ^ (0x04C11DB7U & -(crc >> 31));
+        }
+    }
+
+    return crc;
+}
+
+#endif /* CONFIG_SOC_FAMILY_STM32 */
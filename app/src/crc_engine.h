@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef CRC_ENGINE_H
+#define CRC_ENGINE_H
+
+/** @file
+ *
+ * @brief CRC calculation for stored data and the firmware image
+ *
+ * On STM32 the CRC peripheral is used. Larger buffers are transferred to the peripheral via DMA,
+ * so that the calling thread can yield the CPU in the meantime. On other platforms (e.g. for
+ * unit tests) a table-driven software implementation (slice-by-4) is used.
+ *
+ * The result is the standard CRC-32 (IEEE 802.3), i.e. identical to crc32_ieee() from Zephyr.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Minimum number of bytes to use DMA for the transfer to the CRC peripheral
+ *
+ * Feeding smaller buffers directly from the CPU is faster than setting up the DMA channel.
+ */
+#define CRC_ENGINE_DMA_THRESHOLD 256
+
+/**
+ * Calculate the CRC-32 of a buffer
+ *
+ * Must not be called from an ISR, as the access to the CRC peripheral is protected by a mutex.
+ *
+ * @param data Pointer to the data (no alignment required)
+ * @param len Number of bytes
+ *
+ * @returns CRC-32 (IEEE 802.3)
+ */
+uint32_t crc_engine_crc32(const void *data, size_t len);
+
+/**
+ * Calculate the CRC used by previous firmware versions for the EEPROM data
+ *
+ * The data is processed as little-endian words (last word padded with zeros) using the default
+ * configuration of the STM32 CRC unit (polynomial 0x04C11DB7, no reflection, no final XOR).
+ * Only needed to read data stored by these firmware versions.
+ *
+ * @param data Pointer to the data (no alignment required)
+ * @param len Number of bytes
+ *
+ * @returns Legacy CRC
+ */
+uint32_t crc_engine_crc32_legacy(const void *data, size_t len);
+
+#endif /* CRC_ENGINE_H */
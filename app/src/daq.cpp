@@ -14,6 +14,8 @@ LOG_MODULE_REGISTER(daq, CONFIG_DAQ_LOG_LEVEL);
 #include <assert.h>
 #include <math.h> // log for thermistor calculation
 
+#include "data_storage.h"
+#include "half_bridge.h"
 #include "mcu.h"
 #include "setup.h"
 
@@ -27,6 +29,9 @@ LOG_MODULE_REGISTER(daq, CONFIG_DAQ_LOG_LEVEL);
 #define LV_TERMINAL_CURRENT_FILTER_CONST 0.0099F
 #define PWM_CURRENT_FILTER_CONST         0.0625F // 1.5 seconds
 
+// relative hysteresis of the battery voltage for recovery from power-fail state
+#define POWER_FAIL_VOLTAGE_HYSTERESIS 0.05F
+
 #if BOARD_HAS_DCDC
 static uint16_t dcdc_current_offset_raw;
 #endif
@@ -35,6 +40,8 @@ static uint16_t pwm_current_offset_raw;
 #endif
 #if BOARD_HAS_LOAD_OUTPUT
 static uint16_t load_current_offset_raw;
+static uint16_t load_current_limit_raw; // 2x max. load current, used to clamp thermal model input
+static uint32_t load_current_sq_scale;  // scales squared raw current to thermal model format
 #endif
 
 // 16-bit ADC raw readings (actually left-aligned 12-bit, i.e. left-shifted by 4 bits)
@@ -43,6 +50,8 @@ volatile uint16_t adc_readings[NUM_ADC_CH] = {};
 // filtered raw readings left-shifted by additional adc_filter_const[channel] bits
 volatile uint32_t adc_filtered[NUM_ADC_CH] = {};
 
+volatile bool adc_sample_synchronized = false;
+
 static volatile AdcAlert adc_alerts_upper[NUM_ADC_CH] = {};
 static volatile AdcAlert adc_alerts_lower[NUM_ADC_CH] = {};
 
@@ -104,14 +113,24 @@ void calibrate_current_sensors()
 #endif
 #if BOARD_HAS_LOAD_OUTPUT
     load_current_offset_raw = adc_raw_filtered(ADC_POS(i_load));
+
+    // raw ADC reading (without offset) at max. continuous load current
+    float i_max_raw = LOAD_CURRENT_MAX * (((4096 << 4) * 1000) / ADC_GAIN(i_load)) / (float)VREF;
+    float i_limit_raw = 2 * i_max_raw;
+    load_current_limit_raw = i_limit_raw < UINT16_MAX ? i_limit_raw : UINT16_MAX;
+
+    // (i_raw^2 * load_current_sq_scale) >> 32 gives i^2 / i_max^2 in Q format for thermal model
+    float scale = (float)(1ULL << (32 + LOAD_THERMAL_Q)) / (i_max_raw * i_max_raw);
+    load_current_sq_scale = scale < UINT32_MAX ? scale : UINT32_MAX;
 #endif
 }
 
 void adc_update_value(unsigned int pos)
 {
 #if BOARD_HAS_PWM_PORT
-    // only read input voltage and current when switch is on or permanently off
-    if ((pos != ADC_POS(v_pwm) && pos != ADC_POS(i_pwm)) || pwm_switch.signal_high()
+    // only read input voltage and current once per PWM period in the middle of the on-time or
+    // if the switch is permanently off
+    if ((pos != ADC_POS(v_pwm) && pos != ADC_POS(i_pwm)) || adc_sample_synchronized
         || pwm_switch.active() == false)
 #endif
     {
@@ -134,6 +153,21 @@ void adc_update_value(unsigned int pos)
                             - (adc_filtered[pos] >> adc_filter_const[pos]);
     }
 
+#if BOARD_HAS_LOAD_OUTPUT
+    // additional conversions synchronized to the PWM switch would increase the model rate
+    if (pos == ADC_POS(i_load) && !adc_sample_synchronized) {
+        // thermal model needs the unfiltered current to detect overloads quickly
+        int32_t i_raw = (int32_t)adc_readings[pos] - load_current_offset_raw;
+        if (i_raw < 0) {
+            i_raw = 0;
+        }
+        else if (i_raw > load_current_limit_raw) {
+            i_raw = load_current_limit_raw;
+        }
+        load.thermal_model_update(((uint64_t)i_raw * i_raw * load_current_sq_scale) >> 32);
+    }
+#endif
+
     // check upper alerts
     adc_alerts_upper[pos].debounce_ms++;
     if (adc_alerts_upper[pos].callback != NULL && adc_readings[pos] >= adc_alerts_upper[pos].limit)
@@ -225,6 +259,9 @@ void daq_update()
 
     lv_terminal_current += dcdc.inductor_current;
 
+    // buck mode current flows towards the low voltage bus
+    dcdc.lvs_port.current = -dcdc.inductor_current;
+
     hv_terminal.current =
         -dcdc.inductor_current * lv_terminal.bus->voltage / hv_terminal.bus->voltage;
 
@@ -252,8 +289,7 @@ void daq_update()
         charger.ext_temp_sensor = true;
     }
     else {
-        // no external sensor: assume typical room temperature
-        charger.bat_temperature = 25;
+        // no external sensor: temperature is estimated by charger (see estimate_temperature)
         charger.ext_temp_sensor = false;
     }
 #endif
@@ -296,17 +332,66 @@ void lv_overvoltage_alert()
             adc_alerts_upper[ADC_POS(v_low)].limit);
 }
 
+/*
+ * Prepare for failure of the battery, which supplies the charge controller (e.g. disconnected
+ * battery), by switching off the power stages and storing the most important data
+ */
+static void bat_power_fail()
+{
+#if BOARD_HAS_DCDC
+    dcdc.stop();
+#endif
+#if BOARD_HAS_LOAD_OUTPUT
+    load.stop(ERR_LOAD_VOLTAGE_DIP);
+#endif
+
+    data_storage_power_fail();
+}
+
 void lv_undervoltage_alert()
 {
+#if CONFIG_LV_TERMINAL_BATTERY && BOARD_HAS_DCDC
+    // Only the PWM is disabled from the ISR. The DC/DC restarts in the next control cycle after
+    // a short dip, a persistent failure is handled by daq_check_power_fail.
+    half_bridge_stop();
+#endif
+
 #if BOARD_HAS_LOAD_OUTPUT
     // the battery undervoltage must have been caused by a load current peak
     load.stop(ERR_LOAD_VOLTAGE_DIP);
 #endif
 
+#if CONFIG_LV_TERMINAL_BATTERY
+    // the dip might also have been caused by a failing battery connection
+    data_storage_power_fail();
+#endif
+
     LOG_ERR("Low-side undervoltage alert, ADC reading: %d limit: %d\n",
             adc_readings[ADC_POS(v_low)], adc_alerts_lower[ADC_POS(v_low)].limit);
 }
 
+void daq_check_power_fail()
+{
+    // start in failed state, so that no data is stored if the supply is not yet available
+    static bool power_failed = true;
+
+    // threshold relative to the configured battery type and number of batteries in series
+    float threshold = bat_terminal.bus->series_voltage(
+        bat_conf.absolute_min_voltage * CONFIG_POWER_FAIL_VOLTAGE_PERCENT / 100.0F);
+
+    if (bat_terminal.bus->voltage < threshold) {
+        if (!power_failed) {
+            power_failed = true;
+            bat_power_fail();
+            LOG_ERR("Battery supply failure, voltage: %d mV",
+                    (int)(bat_terminal.bus->voltage * 1000));
+        }
+    }
+    else if (bat_terminal.bus->voltage > threshold * (1.0F + POWER_FAIL_VOLTAGE_HYSTERESIS)) {
+        power_failed = false;
+    }
+}
+
 #if BOARD_HAS_DCDC
 void hv_overvoltage_alert()
 {
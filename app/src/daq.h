@@ -26,6 +26,7 @@ extern "C" {
 
 #include <zephyr/kernel.h>
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #define ADC_SCALE_FLOAT 65536.0F // 16-bit full scale
@@ -126,6 +127,22 @@ void daq_setup(void);
  */
 void adc_update_value(unsigned int pos);
 
+/**
+ * Trigger an ADC conversion synchronized to the on-state of the PWM switch
+ *
+ * Should be called once per PWM period from the timer ISR. If a conversion is already ongoing,
+ * the synchronized conversion is started directly after it finished.
+ */
+void adc_trigger_synchronized(void);
+
+/**
+ * Flag to indicate that the latest ADC readings were triggered by adc_trigger_synchronized()
+ *
+ * Readings of the PWM switch voltage and current are only valid for synchronized conversions
+ * while the PWM switch is active.
+ */
+extern volatile bool adc_sample_synchronized;
+
 /**
  * Set lv side (battery) voltage limits where an alert should be triggered
  *
@@ -134,6 +151,19 @@ void adc_update_value(unsigned int pos);
  */
 void daq_set_lv_limits(float lv_overvoltage, float lv_undervoltage);
 
+/**
+ * Check if the battery voltage dropped below the power-fail threshold
+ *
+ * The threshold is CONFIG_POWER_FAIL_VOLTAGE_PERCENT of the absolute minimum battery voltage,
+ * considering the number of batteries in series.
+ *
+ * Below the threshold the supply of the charge controller is about to fail, so the DC/DC
+ * converter and the load are switched off and energy counters and SOC are stored. The
+ * undervoltage alert at the lv terminal (if the battery is connected to it) only disables the PWM
+ * and stores the data, as it is called from the ADC ISR.
+ */
+void daq_check_power_fail(void);
+
 /**
  * Set hv side (grid/solar) voltage limit where an alert should be triggered
  *
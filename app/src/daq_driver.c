@@ -101,6 +101,9 @@ static const uint32_t table_seq_len[] = {
 // for ADC and DMA
 extern uint16_t adc_readings[];
 
+// synchronized conversion requested while another conversion was ongoing
+static volatile bool adc_sync_pending;
+
 void adc_update_value(unsigned int pos);
 
 static void vref_setup()
@@ -233,8 +236,10 @@ static void adc_setup()
 #endif
 }
 
-static inline void adc_trigger_conversion(struct k_timer *timer_id)
+static inline void adc_start_conversion(bool synchronized)
 {
+    adc_sample_synchronized = synchronized;
+
     LL_ADC_REG_StartConversion(ADC1);
 
 #if defined(CONFIG_SOC_SERIES_STM32G4X)
@@ -242,6 +247,41 @@ static inline void adc_trigger_conversion(struct k_timer *timer_id)
 #endif
 }
 
+static inline bool adc_conversion_ongoing()
+{
+#if defined(CONFIG_SOC_SERIES_STM32G4X)
+    return LL_ADC_REG_IsConversionOngoing(ADC1) || LL_ADC_REG_IsConversionOngoing(ADC2);
+#else
+    return LL_ADC_REG_IsConversionOngoing(ADC1);
+#endif
+}
+
+static inline void adc_trigger_conversion(struct k_timer *timer_id)
+{
+    if (!adc_conversion_ongoing() && !adc_sync_pending) {
+        adc_start_conversion(false);
+    }
+}
+
+void adc_trigger_synchronized(void)
+{
+    if (adc_conversion_ongoing()) {
+        // start in DMA ISR as soon as current conversion is finished
+        adc_sync_pending = true;
+    }
+    else {
+        adc_start_conversion(true);
+    }
+}
+
+static inline void adc_start_pending_conversion()
+{
+    if (adc_sync_pending && !adc_conversion_ongoing()) {
+        adc_sync_pending = false;
+        adc_start_conversion(true);
+    }
+}
+
 static void DMA1_Channel1_IRQHandler(void *args)
 {
     ARG_UNUSED(args);
@@ -251,8 +291,10 @@ static void DMA1_Channel1_IRQHandler(void *args)
         for (unsigned int i = 0; i < num_adc1_ch; i++) {
             adc_update_value(i);
         }
+        adc_start_pending_conversion();
     }
-    DMA1->IFCR |= 0x0FFFFFFF; // clear all interrupt registers
+    // clear only the flags of channel 1, as other channels are used e.g. by the CRC engine
+    DMA1->IFCR = DMA_IFCR_CGIF1;
 }
 
 #if defined(CONFIG_SOC_SERIES_STM32G4X)
@@ -262,8 +304,9 @@ static void DMA2_Channel1_IRQHandler(void *args)
         for (unsigned int i = num_adc1_ch; i < num_adc1_ch + num_adc2_ch; i++) {
             adc_update_value(i);
         }
+        adc_start_pending_conversion();
     }
-    DMA2->IFCR |= 0x0FFFFFFF; // clear all interrupt registers
+    DMA2->IFCR = DMA_IFCR_CGIF1; // clear only the flags of channel 1
 
 #ifdef CONFIG_CUSTOM_DCDC_CONTROLLER
     // Implement this function e.g. for cycle-by-cylce current limitation.
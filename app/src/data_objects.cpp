@@ -10,6 +10,7 @@
 #include <zephyr/kernel.h>
 
 #include <zephyr/drivers/hwinfo.h>
+#include <zephyr/linker/linker-defined-symbols.h>
 #include <zephyr/sys/crc.h>
 
 #ifdef CONFIG_SOC_FAMILY_STM32
@@ -19,8 +20,11 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "crc_engine.h"
 #include "data_storage.h"
 #include "dcdc.h"
+#include "energy_log.h"
+#include "event_log.h"
 #include "hardware.h"
 #include "helper.h"
 #include "setup.h"
@@ -40,6 +44,9 @@ const char hardware_version[] = DT_PROP(DT_PATH(pcb), version_str);
 const char firmware_version[] = FIRMWARE_VERSION_ID;
 char device_id[9];
 
+// CRC-32 of the firmware image in flash (same as CRC-32 of the zephyr.bin file)
+uint32_t firmware_crc;
+
 #ifdef CONFIG_SOC_FAMILY_STM32
 uint32_t flash_size = LL_GetFlashSize();
 uint32_t flash_page_size = FLASH_PAGE_SIZE;
@@ -50,6 +57,62 @@ uint32_t flash_page_size = 0x800;
 
 static char auth_password[11];
 
+// bitmask of battery configuration rules which failed during last check (see enum BatConfRule)
+static uint32_t bat_conf_check_errors;
+
+// encoded custom charge profile as uploaded by the user (see charge_profile_decode)
+static uint8_t charge_profile_buf[CHARGE_PROFILE_SIZE_MAX];
+static ThingSetBytesBuffer charge_profile_bytes = { charge_profile_buf, 0 };
+
+#if CONFIG_ENERGY_LOG
+// parameters and result of the energy log chunk request (see energy_log_read_chunk)
+#define ENERGY_LOG_CHUNK_RECORDS 8
+static uint16_t energy_log_type;
+static uint32_t energy_log_start_seq;
+static uint32_t energy_log_chunk_seq;
+static EnergyLogRecord energy_log_chunk_buf[ENERGY_LOG_CHUNK_RECORDS];
+static ThingSetBytesBuffer energy_log_chunk = { (uint8_t *)energy_log_chunk_buf, 0 };
+
+static void energy_log_read_chunk();
+#endif
+
+// parameters and result of the event log request (see event_log_read_chunk)
+#define EVENT_LOG_CHUNK_ENTRIES 8
+static uint32_t event_log_start_seq;
+static uint32_t event_log_chunk_seq;
+static EventLogEntry event_log_chunk_buf[EVENT_LOG_CHUNK_ENTRIES];
+static ThingSetBytesBuffer event_log_chunk = { (uint8_t *)event_log_chunk_buf, 0 };
+
+static void event_log_read_chunk();
+
+// battery histograms exported as raw arrays of uint32_t counters
+static ThingSetBytesBuffer bat_hist_voltage = { (uint8_t *)dev_stat.bat_hist.voltage,
+                                                sizeof(dev_stat.bat_hist.voltage) };
+static ThingSetBytesBuffer bat_hist_soc = { (uint8_t *)dev_stat.bat_hist.soc,
+                                            sizeof(dev_stat.bat_hist.soc) };
+static ThingSetBytesBuffer bat_hist_temp = { (uint8_t *)dev_stat.bat_hist.temp,
+                                             sizeof(dev_stat.bat_hist.temp) };
+static ThingSetBytesBuffer bat_hist_c_rate = { (uint8_t *)dev_stat.bat_hist.c_rate,
+                                               sizeof(dev_stat.bat_hist.c_rate) };
+
+static void temp_time_constant_update()
+{
+    // last valid value, restored if an invalid value was written
+    static uint32_t temp_time_constant_valid = CONFIG_BAT_TEMP_TIME_CONSTANT;
+
+    if (charger.temp_time_constant >= BAT_TEMP_TIME_CONSTANT_MIN
+        && charger.temp_time_constant <= BAT_TEMP_TIME_CONSTANT_MAX)
+    {
+        temp_time_constant_valid = charger.temp_time_constant;
+    }
+    else {
+        LOG_ERR("Requested thermal time constant not valid and rejected.");
+        charger.temp_time_constant = temp_time_constant_valid;
+    }
+}
+
+static void reset_histograms();
+
 #if CONFIG_LV_TERMINAL_BATTERY
 #define bat_bus lv_bus
 #elif CONFIG_HV_TERMINAL_BATTERY
@@ -73,7 +136,7 @@ uint16_t can_node_addr = CONFIG_THINGSET_CAN_DEFAULT_NODE_ID;
  * Thing Set Data Objects (see thingset.io for specification)
  */
 /* clang-format off */
-static ThingSetDataObject data_objects[] = {
+ThingSetDataObject data_objects[] = {
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -135,13 +198,22 @@ static ThingSetDataObject data_objects[] = {
     TS_ITEM_STRING(0x23, "cFirmwareVersion", firmware_version, 0,
         ID_DEVICE, TS_ANY_R, 0),
 
+    /*{
+        "title": {
+            "en": "Firmware Image CRC-32",
+            "de": "CRC-32 des Firmware-Images"
+        }
+    }*/
+    TS_ITEM_UINT32(0x24, "cFirmwareCRC", &firmware_crc,
+        ID_DEVICE, TS_ANY_R, 0),
+
     /*{
         "title": {
             "en": "Time since last reset",
             "de": "Zeit seit Systemstart"
         }
     }*/
-    TS_ITEM_UINT32(0x30, "rUptime_s", &timestamp,
+    TS_ITEM_UINT32(0x30, "rUptime_s", &uptime_s,
         ID_DEVICE, TS_ANY_R, SUBSET_SER),
 
     /*{
@@ -162,6 +234,69 @@ static ThingSetDataObject data_objects[] = {
     TS_ITEM_FLOAT(0x36, "rIntTemp_degC", &dev_stat.internal_temp, 1,
         ID_DEVICE, TS_ANY_R, 0),
 
+    /*{
+        "title": {
+            "en": "Data Storage Write Pending",
+            "de": "Speichern ausstehend"
+        }
+    }*/
+    TS_ITEM_BOOL(0x42, "rStoragePending", &data_storage_pending,
+        ID_DEVICE, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Completed Data Storage Writes",
+            "de": "Abgeschlossene Speichervorgänge"
+        }
+    }*/
+    TS_ITEM_UINT32(0x43, "rStorageWrites", &data_storage_writes,
+        ID_DEVICE, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Data Storage Error Code",
+            "de": "Fehlercode Datenspeicher"
+        }
+    }*/
+    TS_ITEM_INT32(0x44, "rStorageError", &data_storage_error,
+        ID_DEVICE, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Next Event Sequence Number",
+            "de": "Nächste Ereignis-Sequenznummer"
+        }
+    }*/
+    TS_ITEM_UINT32(0x45, "rEventNextSeq", &event_log_next_seq,
+        ID_DEVICE, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Dropped Events",
+            "de": "Verworfene Ereignisse"
+        }
+    }*/
+    TS_ITEM_UINT32(0x46, "rEventsDropped", &event_log_dropped,
+        ID_DEVICE, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Sequence Number of First Event in Chunk",
+            "de": "Sequenznummer des ersten Ereignisses im Block"
+        }
+    }*/
+    TS_ITEM_UINT32(0x47, "rEventsSeq", &event_log_chunk_seq,
+        ID_DEVICE, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Event Log Chunk",
+            "de": "Block von Ereignissen"
+        }
+    }*/
+    TS_ITEM_BYTES(0x48, "rEvents", &event_log_chunk, sizeof(event_log_chunk_buf),
+        ID_DEVICE, TS_ANY_R, 0),
+
     /*{
         "title": {
             "en": "Peak Internal Temperature (all-time)",
@@ -180,6 +315,78 @@ static ThingSetDataObject data_objects[] = {
     TS_ITEM_UINT32(0x71, "pDayCount", &dev_stat.day_counter,
         ID_DEVICE, TS_ANY_R | TS_MKR_W, SUBSET_NVM),
 
+    /*{
+        "title": {
+            "en": "Current Time (Unix Timestamp)",
+            "de": "Aktuelle Zeit (Unix-Zeitstempel)"
+        }
+    }*/
+    TS_ITEM_UINT32(0x4D, "wTimestamp_s", &timestamp,
+        ID_DEVICE, TS_ANY_R | TS_ANY_W, 0),
+
+    /*{
+        "title": {
+            "en": "Time Zone Offset to UTC",
+            "de": "Zeitzonen-Abweichung von UTC"
+        }
+    }*/
+    TS_ITEM_INT16(0x4E, "sTimeZoneOffset_min", &dev_stat.day_detector.tz_offset,
+        ID_DEVICE, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
+    /*{
+        "title": {
+            "en": "Expected Sunrise (minute of day)",
+            "de": "Erwarteter Sonnenaufgang (Minute des Tages)"
+        }
+    }*/
+    TS_ITEM_UINT16(0x4F, "rSunrise_min", &dev_stat.day_detector.sunrise_min,
+        ID_DEVICE, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Expected Sunset (minute of day)",
+            "de": "Erwarteter Sonnenuntergang (Minute des Tages)"
+        }
+    }*/
+    TS_ITEM_UINT16(0x5B, "rSunset_min", &dev_stat.day_detector.sunset_min,
+        ID_DEVICE, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Time at Battery Voltage (histogram)",
+            "de": "Zeit je Batteriespannung (Histogramm)"
+        }
+    }*/
+    TS_ITEM_BYTES(0x49, "pBatVoltageHist", &bat_hist_voltage, sizeof(dev_stat.bat_hist.voltage),
+        ID_DEVICE, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Time at State of Charge (histogram)",
+            "de": "Zeit je Ladezustand (Histogramm)"
+        }
+    }*/
+    TS_ITEM_BYTES(0x4A, "pSOCHist", &bat_hist_soc, sizeof(dev_stat.bat_hist.soc),
+        ID_DEVICE, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Time at Battery Temperature (histogram)",
+            "de": "Zeit je Batterietemperatur (Histogramm)"
+        }
+    }*/
+    TS_ITEM_BYTES(0x4B, "pBatTempHist", &bat_hist_temp, sizeof(dev_stat.bat_hist.temp),
+        ID_DEVICE, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Time at Battery C-Rate (histogram)",
+            "de": "Zeit je Batterie-C-Rate (Histogramm)"
+        }
+    }*/
+    TS_ITEM_BYTES(0x4C, "pBatCRateHist", &bat_hist_c_rate, sizeof(dev_stat.bat_hist.c_rate),
+        ID_DEVICE, TS_ANY_R, 0),
+
 #if CONFIG_THINGSET_CAN
     /*{
         "title": {
@@ -207,7 +414,24 @@ static ThingSetDataObject data_objects[] = {
             "de": "Daten ins EEPROM schreiben"
         }
     }*/
-    TS_FN_VOID(0xE1, "xStoreData", &data_storage_write, ID_DEVICE, TS_ANY_RW),
+    TS_FN_VOID(0xE1, "xStoreData", &data_storage_request_write, ID_DEVICE, TS_ANY_RW),
+
+    /*{
+        "title": {
+            "en": "Read Events",
+            "de": "Ereignisse lesen"
+        }
+    }*/
+    TS_FN_VOID(0xE3, "xReadEvents", &event_log_read_chunk, ID_DEVICE, TS_ANY_RW),
+    TS_ITEM_UINT32(0xE4, "StartSeq", &event_log_start_seq, 0xE3, TS_ANY_RW, 0),
+
+    /*{
+        "title": {
+            "en": "Reset Battery Histograms",
+            "de": "Batterie-Histogramme zurücksetzen"
+        }
+    }*/
+    TS_FN_VOID(0xE5, "xResetHistograms", &reset_histograms, ID_DEVICE, TS_MKR_RW),
 
     /*{
         "title": {
@@ -249,7 +473,6 @@ static ThingSetDataObject data_objects[] = {
     TS_ITEM_FLOAT(0x33, "rPower_W", &bat_terminal.power, 2,
         ID_BATTERY, TS_ANY_R, 0),
 
-#if BOARD_HAS_TEMP_BAT
     /*{
         "title": {
             "en": "Battery Temperature",
@@ -259,6 +482,16 @@ static ThingSetDataObject data_objects[] = {
     TS_ITEM_FLOAT(0x34, "rTemperature_degC", &charger.bat_temperature, 1,
         ID_BATTERY, TS_ANY_R, 0),
 
+    /*{
+        "title": {
+            "en": "Battery Temperature Estimated",
+            "de": "Batterie-Temperatur geschätzt"
+        }
+    }*/
+    TS_ITEM_BOOL(0x41, "rTempEstimated", &charger.bat_temp_estimated,
+        ID_BATTERY, TS_ANY_R, 0),
+
+#if BOARD_HAS_TEMP_BAT
     /*{
         "title": {
             "en": "External Temperature Sensor",
@@ -287,6 +520,15 @@ static ThingSetDataObject data_objects[] = {
     TS_ITEM_INT16(0x53, "rNumBatteries", &lv_bus.series_multiplier,
         ID_BATTERY, TS_ANY_R, 0),
 
+    /*{
+        "title": {
+            "en": "Number of Batteries Detection Confidence",
+            "de": "Sicherheit Erkennung Anzahl Batterien"
+        }
+    }*/
+    TS_ITEM_UINT16(0x59, "rNumBatConfidence_pct", &charger.num_batteries_confidence,
+        ID_BATTERY, TS_ANY_R, 0),
+
     /*{
         "title": {
             "en": "Estimated Usable Battery Capacity",
@@ -415,6 +657,15 @@ static ThingSetDataObject data_objects[] = {
     TS_ITEM_FLOAT(0xB2, "sWireResistance_Ohm", &bat_conf_user.wire_resistance, 3,
         ID_BATTERY, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
 
+    /*{
+        "title": {
+            "en": "Battery Thermal Time Constant",
+            "de": "Thermische Zeitkonstante Batterie"
+        }
+    }*/
+    TS_ITEM_UINT32(0xC0, "sTempTimeConstant_s", &charger.temp_time_constant,
+        ID_BATTERY, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
     TS_GROUP(ID_CHARGER, "Charger", TS_NO_CALLBACK, ID_ROOT),
@@ -446,6 +697,15 @@ static ThingSetDataObject data_objects[] = {
     TS_ITEM_FLOAT(0x52, "rControlTargetCurrent_A", &bat_terminal.pos_current_limit, 2,
         ID_CHARGER, TS_ANY_R, 0),
 
+    /*{
+        "title": {
+            "en": "Failed Battery Config Checks",
+            "de": "Fehlgeschlagene Prüfungen Batterie-Konfiguration"
+        }
+    }*/
+    TS_ITEM_UINT32(0x57, "rConfCheckErrors", &bat_conf_check_errors,
+        ID_CHARGER, TS_ANY_R, 0),
+
 #if BOARD_HAS_DCDC
     /*{
         "title": {
@@ -678,6 +938,24 @@ static ThingSetDataObject data_objects[] = {
     TS_ITEM_FLOAT(0xB4, "sChgMinTemp_degC", &bat_conf_user.charge_temp_min, 1,
         ID_CHARGER, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
 
+    /*{
+        "title": {
+            "en": "Custom Charge Profile",
+            "de": "Benutzerdefiniertes Ladeprofil"
+        }
+    }*/
+    TS_ITEM_BYTES(0xBF, "sChgProfile", &charge_profile_bytes, sizeof(charge_profile_buf),
+        ID_CHARGER, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
+    /*{
+        "title": {
+            "en": "Active Charge Profile Step",
+            "de": "Aktiver Ladeprofil-Schritt"
+        }
+    }*/
+    TS_ITEM_UINT16(0x58, "rChgProfileStep", &charger.profile_step,
+        ID_CHARGER, TS_ANY_R, 0),
+
 #if BOARD_HAS_DCDC
     /*{
         "title": {
@@ -926,6 +1204,96 @@ static ThingSetDataObject data_objects[] = {
     TS_ITEM_UINT32(0xBB, "sUndervoltageRecoveryDelay_s", &load.lvd_recovery_delay,
         ID_LOAD, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
 
+    /*{
+        "title": {
+            "en": "Load Shedding Priority",
+            "de": "Last Priorität Lastabwurf"
+        }
+    }*/
+    TS_ITEM_UINT16(0xC1, "sShedPriority", &load.priority,
+        ID_LOAD, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
+    /*{
+        "title": {
+            "en": "Load Shedding SOC Forecast",
+            "de": "Last Lastabwurf bei SOC-Prognose"
+        }
+    }*/
+    TS_ITEM_UINT16(0xC2, "sShedSOC_pct", &load.shedding_soc,
+        ID_LOAD, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
+    /*{
+        "title": {
+            "en": "Load Reconnect SOC Forecast",
+            "de": "Last Wiedereinschalten bei SOC-Prognose"
+        }
+    }*/
+    TS_ITEM_UINT16(0xC3, "sReconnectSOC_pct", &load.reconnect_soc,
+        ID_LOAD, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
+    /*{
+        "title": {
+            "en": "Load Soft-Start Duration",
+            "de": "Last Sanftanlauf-Dauer"
+        }
+    }*/
+    TS_ITEM_UINT32(0xC7, "sSoftStartDuration_ms", &load.soft_start_duration,
+        ID_LOAD, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
+    /*{
+        "title": {
+            "en": "Enable Load Schedule",
+            "de": "Zeitplan für Last aktivieren"
+        }
+    }*/
+    TS_ITEM_BOOL(0xC8, "sScheduleEnable", &load.schedule_enable,
+        ID_LOAD, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
+    /*{
+        "title": {
+            "en": "Load On after Dusk",
+            "de": "Last an nach Sonnenuntergang"
+        }
+    }*/
+    TS_ITEM_UINT16(0xC9, "sScheduleDusk_min", &load.schedule_dusk_min,
+        ID_LOAD, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
+    /*{
+        "title": {
+            "en": "Load On before Dawn",
+            "de": "Last an vor Sonnenaufgang"
+        }
+    }*/
+    TS_ITEM_UINT16(0xCA, "sScheduleDawn_min", &load.schedule_dawn_min,
+        ID_LOAD, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
+    /*{
+        "title": {
+            "en": "Load On Time of Day",
+            "de": "Last Einschaltzeit"
+        }
+    }*/
+    TS_ITEM_UINT16(0xCB, "sScheduleClockOn_min", &load.schedule_clock_on,
+        ID_LOAD, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
+    /*{
+        "title": {
+            "en": "Load Off Time of Day",
+            "de": "Last Ausschaltzeit"
+        }
+    }*/
+    TS_ITEM_UINT16(0xCC, "sScheduleClockOff_min", &load.schedule_clock_off,
+        ID_LOAD, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
+    /*{
+        "title": {
+            "en": "State of Charge Forecast",
+            "de": "Prognose Batterie-Ladezustand"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x5A, "rSOCForecast_pct", &load_manager.soc_forecast, 0,
+        ID_LOAD, TS_ANY_R, 0),
+
     /*{
         "title": {
             "en": "Maximum Discharge Temperature",
@@ -988,6 +1356,33 @@ static ThingSetDataObject data_objects[] = {
     TS_ITEM_UINT32(0xBD, "sUndervoltageRecoveryDelay_s", &usb_pwr.lvd_recovery_delay,
         ID_USB, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
 
+    /*{
+        "title": {
+            "en": "USB Shedding Priority",
+            "de": "USB Priorität Lastabwurf"
+        }
+    }*/
+    TS_ITEM_UINT16(0xC4, "sShedPriority", &usb_pwr.priority,
+        ID_USB, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
+    /*{
+        "title": {
+            "en": "USB Shedding SOC Forecast",
+            "de": "USB Lastabwurf bei SOC-Prognose"
+        }
+    }*/
+    TS_ITEM_UINT16(0xC5, "sShedSOC_pct", &usb_pwr.shedding_soc,
+        ID_USB, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
+    /*{
+        "title": {
+            "en": "USB Reconnect SOC Forecast",
+            "de": "USB Wiedereinschalten bei SOC-Prognose"
+        }
+    }*/
+    TS_ITEM_UINT16(0xC6, "sReconnectSOC_pct", &usb_pwr.reconnect_soc,
+        ID_USB, TS_ANY_R | TS_ANY_W, SUBSET_NVM),
+
 #endif /* BOARD_HAS_USB_OUTPUT */
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -1063,38 +1458,562 @@ static ThingSetDataObject data_objects[] = {
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
-    TS_GROUP(ID_DFU, "DFU", TS_NO_CALLBACK, ID_ROOT),
+    TS_GROUP(ID_STATS, "Stats", TS_NO_CALLBACK, ID_ROOT),
+
+    TS_GROUP(0x200, "Last1s", TS_NO_CALLBACK, ID_STATS),
 
     /*{
         "title": {
-            "en": "Start the Bootloader",
-            "de": "Bootloader starten"
+            "en": "Battery Voltage Minimum (1 s)",
+            "de": "Batterie-Spannung Minimum (1 s)"
         }
     }*/
-    TS_FN_VOID(0xF0, "xBootloaderSTM", &start_stm32_bootloader, ID_DFU, TS_ANY_RW),
+    TS_ITEM_FLOAT(0x201, "rBatVoltageMin_V", &bat_bus.voltage_stats.sec_1.min, 2,
+        0x200, TS_ANY_R, 0),
 
     /*{
         "title": {
-            "en": "Flash Memory Size",
-            "de": "Flash-Speicher Gesamtgröße"
+            "en": "Battery Voltage Average (1 s)",
+            "de": "Batterie-Spannung Mittelwert (1 s)"
         }
     }*/
-    TS_ITEM_UINT32(0xF1, "rFlashSize_KiB", &flash_size, ID_DFU, TS_ANY_R, 0),
+    TS_ITEM_FLOAT(0x202, "rBatVoltageAvg_V", &bat_bus.voltage_stats.sec_1.avg, 2,
+        0x200, TS_ANY_R, 0),
 
     /*{
         "title": {
-            "en": "Flash Memory Page Size",
-            "de": "Flash-Speicher Seitengröße"
+            "en": "Battery Voltage Maximum (1 s)",
+            "de": "Batterie-Spannung Maximum (1 s)"
         }
     }*/
-    TS_ITEM_UINT32(0xF2, "rFlashPageSize_B", &flash_page_size, ID_DFU, TS_ANY_R, 0),
+    TS_ITEM_FLOAT(0x203, "rBatVoltageMax_V", &bat_bus.voltage_stats.sec_1.max, 2,
+        0x200, TS_ANY_R, 0),
 
-    ///////////////////////////////////////////////////////////////////////////////////////////////
+    /*{
+        "title": {
+            "en": "Battery Voltage RMS (1 s)",
+            "de": "Batterie-Spannung Effektivwert (1 s)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x204, "rBatVoltageRMS_V", &bat_bus.voltage_stats.sec_1.rms, 2,
+        0x200, TS_ANY_R, 0),
 
-    TS_SUBSET(0x0A, "mSerial", SUBSET_SER, ID_ROOT, TS_ANY_RW),
-#if CONFIG_THINGSET_CAN
-    TS_SUBSET(0x0B, "mCAN", SUBSET_CAN, ID_ROOT, TS_ANY_RW),
-#endif
+    /*{
+        "title": {
+            "en": "Battery Current Minimum (1 s)",
+            "de": "Batterie-Strom Minimum (1 s)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x205, "rBatCurrentMin_A", &bat_terminal.current_stats.sec_1.min, 2,
+        0x200, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Current Average (1 s)",
+            "de": "Batterie-Strom Mittelwert (1 s)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x206, "rBatCurrentAvg_A", &bat_terminal.current_stats.sec_1.avg, 2,
+        0x200, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Current Maximum (1 s)",
+            "de": "Batterie-Strom Maximum (1 s)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x207, "rBatCurrentMax_A", &bat_terminal.current_stats.sec_1.max, 2,
+        0x200, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Current RMS (1 s)",
+            "de": "Batterie-Strom Effektivwert (1 s)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x208, "rBatCurrentRMS_A", &bat_terminal.current_stats.sec_1.rms, 2,
+        0x200, TS_ANY_R, 0),
+
+#if CONFIG_HV_TERMINAL_SOLAR || CONFIG_LV_TERMINAL_SOLAR || CONFIG_PWM_TERMINAL_SOLAR
+    /*{
+        "title": {
+            "en": "Solar Power Minimum (1 s)",
+            "de": "Solar-Leistung Minimum (1 s)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x209, "rSolarPowerMin_W", &solar_terminal.power_stats.sec_1.min, 2,
+        0x200, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Solar Power Average (1 s)",
+            "de": "Solar-Leistung Mittelwert (1 s)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x20A, "rSolarPowerAvg_W", &solar_terminal.power_stats.sec_1.avg, 2,
+        0x200, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Solar Power Maximum (1 s)",
+            "de": "Solar-Leistung Maximum (1 s)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x20B, "rSolarPowerMax_W", &solar_terminal.power_stats.sec_1.max, 2,
+        0x200, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Solar Power RMS (1 s)",
+            "de": "Solar-Leistung Effektivwert (1 s)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x20C, "rSolarPowerRMS_W", &solar_terminal.power_stats.sec_1.rms, 2,
+        0x200, TS_ANY_R, 0),
+#endif
+
+#if BOARD_HAS_LOAD_OUTPUT
+    /*{
+        "title": {
+            "en": "Load Output Power Minimum (1 s)",
+            "de": "Lastausgangs-Leistung Minimum (1 s)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x20D, "rLoadPowerMin_W", &load.power_stats.sec_1.min, 2,
+        0x200, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Load Output Power Average (1 s)",
+            "de": "Lastausgangs-Leistung Mittelwert (1 s)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x20E, "rLoadPowerAvg_W", &load.power_stats.sec_1.avg, 2,
+        0x200, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Load Output Power Maximum (1 s)",
+            "de": "Lastausgangs-Leistung Maximum (1 s)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x20F, "rLoadPowerMax_W", &load.power_stats.sec_1.max, 2,
+        0x200, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Load Output Power RMS (1 s)",
+            "de": "Lastausgangs-Leistung Effektivwert (1 s)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x210, "rLoadPowerRMS_W", &load.power_stats.sec_1.rms, 2,
+        0x200, TS_ANY_R, 0),
+#endif
+
+    TS_GROUP(0x220, "Last1min", TS_NO_CALLBACK, ID_STATS),
+
+    /*{
+        "title": {
+            "en": "Battery Voltage Minimum (1 min)",
+            "de": "Batterie-Spannung Minimum (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x221, "rBatVoltageMin_V", &bat_bus.voltage_stats.min_1.min, 2,
+        0x220, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Voltage Average (1 min)",
+            "de": "Batterie-Spannung Mittelwert (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x222, "rBatVoltageAvg_V", &bat_bus.voltage_stats.min_1.avg, 2,
+        0x220, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Voltage Maximum (1 min)",
+            "de": "Batterie-Spannung Maximum (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x223, "rBatVoltageMax_V", &bat_bus.voltage_stats.min_1.max, 2,
+        0x220, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Voltage RMS (1 min)",
+            "de": "Batterie-Spannung Effektivwert (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x224, "rBatVoltageRMS_V", &bat_bus.voltage_stats.min_1.rms, 2,
+        0x220, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Current Minimum (1 min)",
+            "de": "Batterie-Strom Minimum (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x225, "rBatCurrentMin_A", &bat_terminal.current_stats.min_1.min, 2,
+        0x220, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Current Average (1 min)",
+            "de": "Batterie-Strom Mittelwert (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x226, "rBatCurrentAvg_A", &bat_terminal.current_stats.min_1.avg, 2,
+        0x220, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Current Maximum (1 min)",
+            "de": "Batterie-Strom Maximum (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x227, "rBatCurrentMax_A", &bat_terminal.current_stats.min_1.max, 2,
+        0x220, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Current RMS (1 min)",
+            "de": "Batterie-Strom Effektivwert (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x228, "rBatCurrentRMS_A", &bat_terminal.current_stats.min_1.rms, 2,
+        0x220, TS_ANY_R, 0),
+
+#if CONFIG_HV_TERMINAL_SOLAR || CONFIG_LV_TERMINAL_SOLAR || CONFIG_PWM_TERMINAL_SOLAR
+    /*{
+        "title": {
+            "en": "Solar Power Minimum (1 min)",
+            "de": "Solar-Leistung Minimum (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x229, "rSolarPowerMin_W", &solar_terminal.power_stats.min_1.min, 2,
+        0x220, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Solar Power Average (1 min)",
+            "de": "Solar-Leistung Mittelwert (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x22A, "rSolarPowerAvg_W", &solar_terminal.power_stats.min_1.avg, 2,
+        0x220, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Solar Power Maximum (1 min)",
+            "de": "Solar-Leistung Maximum (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x22B, "rSolarPowerMax_W", &solar_terminal.power_stats.min_1.max, 2,
+        0x220, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Solar Power RMS (1 min)",
+            "de": "Solar-Leistung Effektivwert (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x22C, "rSolarPowerRMS_W", &solar_terminal.power_stats.min_1.rms, 2,
+        0x220, TS_ANY_R, 0),
+#endif
+
+#if BOARD_HAS_LOAD_OUTPUT
+    /*{
+        "title": {
+            "en": "Load Output Power Minimum (1 min)",
+            "de": "Lastausgangs-Leistung Minimum (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x22D, "rLoadPowerMin_W", &load.power_stats.min_1.min, 2,
+        0x220, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Load Output Power Average (1 min)",
+            "de": "Lastausgangs-Leistung Mittelwert (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x22E, "rLoadPowerAvg_W", &load.power_stats.min_1.avg, 2,
+        0x220, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Load Output Power Maximum (1 min)",
+            "de": "Lastausgangs-Leistung Maximum (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x22F, "rLoadPowerMax_W", &load.power_stats.min_1.max, 2,
+        0x220, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Load Output Power RMS (1 min)",
+            "de": "Lastausgangs-Leistung Effektivwert (1 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x230, "rLoadPowerRMS_W", &load.power_stats.min_1.rms, 2,
+        0x220, TS_ANY_R, 0),
+#endif
+
+    TS_GROUP(0x240, "Last15min", TS_NO_CALLBACK, ID_STATS),
+
+    /*{
+        "title": {
+            "en": "Battery Voltage Minimum (15 min)",
+            "de": "Batterie-Spannung Minimum (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x241, "rBatVoltageMin_V", &bat_bus.voltage_stats.min_15.min, 2,
+        0x240, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Voltage Average (15 min)",
+            "de": "Batterie-Spannung Mittelwert (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x242, "rBatVoltageAvg_V", &bat_bus.voltage_stats.min_15.avg, 2,
+        0x240, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Voltage Maximum (15 min)",
+            "de": "Batterie-Spannung Maximum (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x243, "rBatVoltageMax_V", &bat_bus.voltage_stats.min_15.max, 2,
+        0x240, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Voltage RMS (15 min)",
+            "de": "Batterie-Spannung Effektivwert (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x244, "rBatVoltageRMS_V", &bat_bus.voltage_stats.min_15.rms, 2,
+        0x240, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Current Minimum (15 min)",
+            "de": "Batterie-Strom Minimum (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x245, "rBatCurrentMin_A", &bat_terminal.current_stats.min_15.min, 2,
+        0x240, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Current Average (15 min)",
+            "de": "Batterie-Strom Mittelwert (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x246, "rBatCurrentAvg_A", &bat_terminal.current_stats.min_15.avg, 2,
+        0x240, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Current Maximum (15 min)",
+            "de": "Batterie-Strom Maximum (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x247, "rBatCurrentMax_A", &bat_terminal.current_stats.min_15.max, 2,
+        0x240, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Battery Current RMS (15 min)",
+            "de": "Batterie-Strom Effektivwert (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x248, "rBatCurrentRMS_A", &bat_terminal.current_stats.min_15.rms, 2,
+        0x240, TS_ANY_R, 0),
+
+#if CONFIG_HV_TERMINAL_SOLAR || CONFIG_LV_TERMINAL_SOLAR || CONFIG_PWM_TERMINAL_SOLAR
+    /*{
+        "title": {
+            "en": "Solar Power Minimum (15 min)",
+            "de": "Solar-Leistung Minimum (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x249, "rSolarPowerMin_W", &solar_terminal.power_stats.min_15.min, 2,
+        0x240, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Solar Power Average (15 min)",
+            "de": "Solar-Leistung Mittelwert (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x24A, "rSolarPowerAvg_W", &solar_terminal.power_stats.min_15.avg, 2,
+        0x240, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Solar Power Maximum (15 min)",
+            "de": "Solar-Leistung Maximum (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x24B, "rSolarPowerMax_W", &solar_terminal.power_stats.min_15.max, 2,
+        0x240, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Solar Power RMS (15 min)",
+            "de": "Solar-Leistung Effektivwert (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x24C, "rSolarPowerRMS_W", &solar_terminal.power_stats.min_15.rms, 2,
+        0x240, TS_ANY_R, 0),
+#endif
+
+#if BOARD_HAS_LOAD_OUTPUT
+    /*{
+        "title": {
+            "en": "Load Output Power Minimum (15 min)",
+            "de": "Lastausgangs-Leistung Minimum (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x24D, "rLoadPowerMin_W", &load.power_stats.min_15.min, 2,
+        0x240, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Load Output Power Average (15 min)",
+            "de": "Lastausgangs-Leistung Mittelwert (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x24E, "rLoadPowerAvg_W", &load.power_stats.min_15.avg, 2,
+        0x240, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Load Output Power Maximum (15 min)",
+            "de": "Lastausgangs-Leistung Maximum (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x24F, "rLoadPowerMax_W", &load.power_stats.min_15.max, 2,
+        0x240, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Load Output Power RMS (15 min)",
+            "de": "Lastausgangs-Leistung Effektivwert (15 min)"
+        }
+    }*/
+    TS_ITEM_FLOAT(0x250, "rLoadPowerRMS_W", &load.power_stats.min_15.rms, 2,
+        0x240, TS_ANY_R, 0),
+#endif
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+#if CONFIG_ENERGY_LOG
+    TS_GROUP(ID_LOG, "Log", TS_NO_CALLBACK, ID_ROOT),
+
+    /*{
+        "title": {
+            "en": "Oldest Hourly Log Record",
+            "de": "Ältester stündlicher Log-Eintrag"
+        }
+    }*/
+    TS_ITEM_UINT32(0x260, "rHourlyFirstSeq", &energy_log_first_seq[ENERGY_LOG_HOURLY],
+        ID_LOG, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Next Hourly Log Record",
+            "de": "Nächster stündlicher Log-Eintrag"
+        }
+    }*/
+    TS_ITEM_UINT32(0x261, "rHourlyNextSeq", &energy_log_next_seq[ENERGY_LOG_HOURLY],
+        ID_LOG, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Oldest Daily Log Record",
+            "de": "Ältester täglicher Log-Eintrag"
+        }
+    }*/
+    TS_ITEM_UINT32(0x262, "rDailyFirstSeq", &energy_log_first_seq[ENERGY_LOG_DAILY],
+        ID_LOG, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Next Daily Log Record",
+            "de": "Nächster täglicher Log-Eintrag"
+        }
+    }*/
+    TS_ITEM_UINT32(0x263, "rDailyNextSeq", &energy_log_next_seq[ENERGY_LOG_DAILY],
+        ID_LOG, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Read Log Records",
+            "de": "Log-Einträge lesen"
+        }
+    }*/
+    TS_FN_VOID(0x264, "xReadChunk", &energy_log_read_chunk, ID_LOG, TS_ANY_RW),
+    TS_ITEM_UINT16(0x265, "Type", &energy_log_type, 0x264, TS_ANY_RW, 0),
+    TS_ITEM_UINT32(0x266, "StartSeq", &energy_log_start_seq, 0x264, TS_ANY_RW, 0),
+
+    /*{
+        "title": {
+            "en": "Sequence Number of First Record in Chunk",
+            "de": "Sequenznummer des ersten Eintrags im Block"
+        }
+    }*/
+    TS_ITEM_UINT32(0x267, "rChunkSeq", &energy_log_chunk_seq,
+        ID_LOG, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Log Records Chunk",
+            "de": "Block von Log-Einträgen"
+        }
+    }*/
+    TS_ITEM_BYTES(0x268, "rChunk", &energy_log_chunk, sizeof(energy_log_chunk_buf),
+        ID_LOG, TS_ANY_R, 0),
+#endif
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+    TS_GROUP(ID_DFU, "DFU", TS_NO_CALLBACK, ID_ROOT),
+
+    /*{
+        "title": {
+            "en": "Start the Bootloader",
+            "de": "Bootloader starten"
+        }
+    }*/
+    TS_FN_VOID(0xF0, "xBootloaderSTM", &start_stm32_bootloader, ID_DFU, TS_ANY_RW),
+
+    /*{
+        "title": {
+            "en": "Flash Memory Size",
+            "de": "Flash-Speicher Gesamtgröße"
+        }
+    }*/
+    TS_ITEM_UINT32(0xF1, "rFlashSize_KiB", &flash_size, ID_DFU, TS_ANY_R, 0),
+
+    /*{
+        "title": {
+            "en": "Flash Memory Page Size",
+            "de": "Flash-Speicher Seitengröße"
+        }
+    }*/
+    TS_ITEM_UINT32(0xF2, "rFlashPageSize_B", &flash_page_size, ID_DFU, TS_ANY_R, 0),
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+    TS_SUBSET(0x0A, "mSerial", SUBSET_SER, ID_ROOT, TS_ANY_RW),
+#if CONFIG_THINGSET_CAN
+    TS_SUBSET(0x0B, "mCAN", SUBSET_CAN, ID_ROOT, TS_ANY_RW),
+#endif
 
     TS_GROUP(ID_PUB, "_Pub", TS_NO_CALLBACK, ID_ROOT),
 
@@ -1140,32 +2059,82 @@ static ThingSetDataObject data_objects[] = {
 };
 /* clang-format on */
 
-ThingSet ts(data_objects, sizeof(data_objects) / sizeof(ThingSetDataObject));
+const size_t num_data_objects = sizeof(data_objects) / sizeof(ThingSetDataObject);
+
+ThingSet ts(data_objects, num_data_objects);
+
+static void charge_profile_update()
+{
+    uint8_t active_buf[CHARGE_PROFILE_SIZE_MAX];
+    size_t active_len = charge_profile_encode(&charge_profile, active_buf, sizeof(active_buf));
+
+    // called for every change of SUBSET_NVM, so most likely the profile is unchanged
+    if (active_len == charge_profile_bytes.num_bytes
+        && memcmp(active_buf, charge_profile_buf, active_len) == 0)
+    {
+        return;
+    }
+
+    charge_profile_lock();
+
+    if (charge_profile_decode(&charge_profile, charge_profile_bytes.bytes,
+                              charge_profile_bytes.num_bytes, bat_conf.absolute_max_voltage,
+                              bat_conf.charge_current_max))
+    {
+        charger.restart_profile();
+    }
+    else {
+        LOG_ERR("Requested charge profile not valid and rejected.");
+        // restore encoded data of the profile which is still active
+        charge_profile_bytes.num_bytes =
+            charge_profile_encode(&charge_profile, charge_profile_buf, sizeof(charge_profile_buf));
+    }
+
+    charge_profile_unlock();
+}
+
+static void reset_histograms()
+{
+    dev_stat.reset_histograms();
+    data_storage_request_write();
+}
+
+static void event_log_read_chunk()
+{
+    int num = event_log_read(event_log_start_seq, event_log_chunk_buf, EVENT_LOG_CHUNK_ENTRIES,
+                             &event_log_chunk_seq);
+    event_log_chunk.num_bytes = num * sizeof(EventLogEntry);
+}
+
+#if CONFIG_ENERGY_LOG
+static void energy_log_read_chunk()
+{
+    int num = energy_log_read(energy_log_type, energy_log_start_seq, energy_log_chunk_buf,
+                              ENERGY_LOG_CHUNK_RECORDS, &energy_log_chunk_seq);
+    energy_log_chunk.num_bytes = num * sizeof(EnergyLogRecord);
+}
+#endif
 
 void data_objects_update_conf()
 {
-    bool changed;
-    if (battery_conf_check(&bat_conf_user)) {
+    if (battery_conf_check(&bat_conf_user, &bat_conf_check_errors)) {
         LOG_INF("New config valid and activated.");
         battery_conf_overwrite(&bat_conf_user, &bat_conf, &charger);
 #if BOARD_HAS_LOAD_OUTPUT
         load.set_voltage_limits(bat_conf.load_disconnect_voltage, bat_conf.load_reconnect_voltage,
                                 bat_conf.absolute_max_voltage);
 #endif
-        changed = true;
     }
     else {
         LOG_ERR("Requested config change not valid and rejected.");
         battery_conf_overwrite(&bat_conf, &bat_conf_user);
-        changed = false;
     }
 
-    // TODO: check also for changes in Load/USB EnDefault
-    changed = true; // temporary hack
+    charge_profile_update();
+    temp_time_constant_update();
 
-    if (changed) {
-        data_storage_write();
-    }
+    // only objects that were actually changed (e.g. also Load/USB EnDefault) are written
+    data_storage_request_write();
 }
 
 void data_objects_init()
@@ -1178,16 +2147,22 @@ void data_objects_init()
     id64 += ((uint64_t)CONFIG_LIBRE_SOLAR_TYPE_ID) << 32;
 
     uint64_to_base32(id64, device_id, sizeof(device_id), alphabet_crockford);
+
+    // allows to verify that the flashed image matches the released binary
+    firmware_crc = crc_engine_crc32(__rom_region_start, (size_t)_flash_used);
 #endif
 
     data_storage_read();
-    if (battery_conf_check(&bat_conf_user)) {
+    if (battery_conf_check(&bat_conf_user, &bat_conf_check_errors)) {
         battery_conf_overwrite(&bat_conf_user, &bat_conf, &charger);
     }
     else {
         battery_conf_overwrite(&bat_conf, &bat_conf_user);
     }
 
+    charge_profile_update();
+    temp_time_constant_update();
+
     ts.set_update_callback(SUBSET_NVM, data_objects_update_conf);
 }
 
@@ -26,6 +26,8 @@
 #define ID_LOAD     0x05
 #define ID_USB      0x06
 #define ID_NANOGRID 0x07
+#define ID_STATS    0x08
+#define ID_LOG      0x09
 #define ID_DFU      0x0F
 #define ID_PUB      0x100
 #define ID_CTRL     0x8000
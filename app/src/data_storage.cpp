@@ -8,152 +8,365 @@
 
 #include <zephyr/kernel.h>
 
+#include "crc_engine.h"
 #include "data_objects.h"
+#include "energy_log.h"
+#include "event_log.h"
 #include "helper.h"
 #include "mcu.h"
+#include "setup.h"
 #include "thingset.h"
 
+#include <stddef.h>
 #include <stdio.h>
 
+/*
+ * Increment the version number each time the layout of the HotRecord is changed
+ */
+#define HOT_RECORD_VERSION 1
+
+/*
+ * Minimum time between two power-fail writes of the hot record (s)
+ */
+#define HOT_RECORD_REARM_TIME 60
+
+/*
+ * Record of frequently changing data that is written in case of a power failure
+ *
+ * The record is small enough to be written with a single EEPROM page write or flash write.
+ */
+struct HotRecord
+{
+    uint16_t version;
+    uint16_t soc;
+    uint32_t bat_chg_total_Wh;
+    uint32_t bat_dis_total_Wh;
+    uint32_t solar_in_total_Wh;
+    uint32_t load_out_total_Wh;
+    float discharged_Ah;
+    uint32_t crc; // CRC32 of all previous bytes
+};
+
+/*
+ * Increment the version number each time the layout of the HistRecord is changed
+ */
+#define HIST_RECORD_VERSION 1
+
+/*
+ * Number of copies of the HistRecord, which are written alternately, so that a torn write never
+ * destroys the histograms stored before
+ */
+#define HIST_RECORD_COPIES 2
+
+/*
+ * Record of the battery histograms, stored separately because of its size
+ */
+struct HistRecord
+{
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t seq; // incremented for each write
+    BatteryHistograms hist;
+    uint32_t crc; // CRC32 of all previous bytes
+};
+
+static int hot_record_write(const HotRecord *rec);
+static int hot_record_read(HotRecord *rec);
+static void hot_record_erase();
+
+static int hist_record_write(int copy, const HistRecord *rec);
+static int hist_record_read(int copy, HistRecord *rec);
+
 #ifdef CONFIG_SOC_FAMILY_STM32
 
-#include <stm32_ll_bus.h>
 #include <zephyr/device.h>
 
 LOG_MODULE_REGISTER(nvs, CONFIG_DATA_STORAGE_LOG_LEVEL);
 
 K_MUTEX_DEFINE(data_buf_lock);
 
-// Buffer used by store and restore functions (must be word-aligned for hardware CRC calculation)
+// Buffer used by store and restore functions (word-aligned for DMA transfers to the CRC unit)
 static uint8_t buf[512] __aligned(sizeof(uint32_t));
 
 extern ThingSet ts;
 
-uint32_t _calc_crc(const uint8_t *buf, size_t len)
-{
-    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_CRC);
+#endif /* UNIT_TEST */
 
-    // we keep standard polynomial 0x04C11DB7 (same for STM32L0 and STM32F0)
-    // and we don't care for endianness here
-    CRC->CR |= CRC_CR_RESET;
-    for (size_t i = 0; i < len; i += 4) {
-        // printf("CRC buf: %.8x, CRC->DR: %.8x\n", *((uint32_t*)&buf[i]), CRC->DR);
-        size_t remaining_bytes = len - i;
-        if (remaining_bytes >= 4) {
-            CRC->DR = *((uint32_t *)&buf[i]);
-        }
-        else {
-            // ignore bytes >= len if len is not a multiple of 4
-            CRC->DR = *((uint32_t *)&buf[i]) & (0xFFFFFFFFU >> (32 - remaining_bytes * 8));
-        }
-    }
+#ifdef CONFIG_EEPROM
 
-    LL_AHB1_GRP1_DisableClock(LL_AHB1_GRP1_PERIPH_CRC);
+#include <zephyr/drivers/eeprom.h>
 
-    return CRC->DR;
-}
+/*
+ * EEPROM layout:
+ * - Hot record (see HotRecord) in the first page
+ * - Journal with fixed-size slots
+ * - Copies of the histogram record (see HistRecord)
+ * - Event log slots at the end of the EEPROM
+ *
+ * Each record is written to the slot following the newest record, so the writes are distributed
+ * over the entire EEPROM. A torn write only invalidates the record being written and the
+ * previous record is used instead.
+ *
+ * Journal record header bytes:
+ * - 0-3: CRC32 of all following header and data bytes
+ * - 4-5: Data objects version number
+ * - 6-7: Number of data bytes
+ * - 8-11: Sequence number (incremented for each record)
+ *
+ * Data starts from byte 12
+ */
+#define EEPROM_HEADER_SIZE 12
 
-#endif /* UNIT_TEST */
+#define EEPROM_HOT_RECORD_OFFSET 0
 
-#ifdef CONFIG_EEPROM
+#define EEPROM_JOURNAL_OFFSET 32
 
-#include <zephyr/drivers/eeprom.h>
+#define EEPROM_SLOT_SIZE sizeof(buf)
+
+/*
+ * The size is determined at runtime, as not all EEPROM devicetree bindings (e.g. the internal
+ * EEPROM of STM32L0) provide a size property.
+ */
+#define EEPROM_EVENTS_OFFSET                                                                      \
+    (eeprom_get_size(eeprom_dev) - DATA_STORAGE_EVENT_SLOTS * DATA_STORAGE_EVENT_SIZE)
+
+#define EEPROM_HIST_SLOT_SIZE 256
+
+#define EEPROM_HIST_OFFSET (EEPROM_EVENTS_OFFSET - HIST_RECORD_COPIES * EEPROM_HIST_SLOT_SIZE)
+
+#define EEPROM_NUM_SLOTS ((int)((EEPROM_HIST_OFFSET - EEPROM_JOURNAL_OFFSET) / EEPROM_SLOT_SIZE))
+
+// minimum EEPROM size for at least 2 journal slots
+#define EEPROM_SIZE_MIN                                                                           \
+    (EEPROM_JOURNAL_OFFSET + 2 * EEPROM_SLOT_SIZE + HIST_RECORD_COPIES * EEPROM_HIST_SLOT_SIZE    \
+     + DATA_STORAGE_EVENT_SLOTS * DATA_STORAGE_EVENT_SIZE)
+
+static_assert(sizeof(HistRecord) <= EEPROM_HIST_SLOT_SIZE, "HistRecord too large");
 
 /*
- * EEPROM header bytes:
+ * Previous layout with a single record at address 0 and the following header bytes (only read
+ * for migration):
  * - 0-1: Data objects version number
  * - 2-3: Number of data bytes
  * - 4-7: CRC32
  *
  * Data starts from byte 8
  */
-#define EEPROM_HEADER_SIZE 8
+#define EEPROM_LEGACY_HEADER_SIZE 8
 
 static const struct device *eeprom_dev = DEVICE_DT_GET(DT_NODELABEL(eeprom));
 
-void data_storage_read()
-{
-    int err;
+// CRC of the data in the newest journal record (0 if unknown)
+static uint32_t stored_crc;
 
+// slot and sequence number of the newest journal record (-1 if no record found)
+static int journal_slot = -1;
+static uint32_t journal_seq = 0;
+
+static bool eeprom_ready()
+{
     if (!device_is_ready(eeprom_dev)) {
         LOG_ERR("EEPROM device not ready");
-        return;
+        return false;
     }
 
-    uint8_t buf_header[EEPROM_HEADER_SIZE] = {};
-    err = eeprom_read(eeprom_dev, 0, buf_header, EEPROM_HEADER_SIZE);
-    if (err != 0) {
-        LOG_ERR("EEPROM read error %d", err);
-        return;
+    if (eeprom_get_size(eeprom_dev) < EEPROM_SIZE_MIN) {
+        LOG_ERR("EEPROM too small for data layout");
+        return false;
     }
-    uint16_t version = *((uint16_t *)&buf_header[0]);
-    uint16_t len = *((uint16_t *)&buf_header[2]);
-    uint32_t crc = *((uint32_t *)&buf_header[4]);
 
-    LOG_DBG("EEPROM header restore: ver %d, len %d, CRC %.8x", version, len, (unsigned int)crc);
-    LOG_DBG("Header: %.2x %.2x %.2x %.2x %.2x %.2x %.2x %.2x", buf_header[0], buf_header[1],
-            buf_header[2], buf_header[3], buf_header[4], buf_header[5], buf_header[6],
-            buf_header[7]);
+    return true;
+}
 
-    if (version == DATA_OBJECTS_VERSION && len <= sizeof(buf)) {
-        k_mutex_lock(&data_buf_lock, K_FOREVER);
-        err = eeprom_read(eeprom_dev, EEPROM_HEADER_SIZE, buf, len);
+static inline int slot_offset(int slot)
+{
+    return EEPROM_JOURNAL_OFFSET + slot * EEPROM_SLOT_SIZE;
+}
 
-        // printf("Data (len=%d): ", len);
-        // for (int i = 0; i < len; i++) printf("%.2x ", buf[i]);
+static void eeprom_migrate()
+{
+    int err = eeprom_read(eeprom_dev, 0, buf, EEPROM_LEGACY_HEADER_SIZE);
+    uint16_t version = *((uint16_t *)&buf[0]);
+    uint16_t len = *((uint16_t *)&buf[2]);
+    uint32_t crc = *((uint32_t *)&buf[4]);
 
-        if (_calc_crc(buf, len) == crc) {
-            int status = ts.bin_import(buf, sizeof(buf), TS_WRITE_MASK, SUBSET_NVM);
-            LOG_INF("EEPROM read and data objects updated, ThingSet result: 0x%x", status);
-        }
-        else {
-            LOG_ERR("EEPROM data CRC invalid, expected 0x%x (data_len = %d)", (unsigned int)crc,
-                    len);
+    if (err == 0 && version == DATA_OBJECTS_VERSION && len <= sizeof(buf)) {
+        err = eeprom_read(eeprom_dev, EEPROM_LEGACY_HEADER_SIZE, buf, len);
+        if (err == 0 && crc_engine_crc32_legacy(buf, len) == crc) {
+            int status = ts.bin_import(buf, len, TS_WRITE_MASK, SUBSET_NVM);
+            LOG_INF("EEPROM data migrated from single record, ThingSet result: 0x%x", status);
+
+            // legacy record is overwritten by the hot record, so store it in the journal ASAP
+            data_storage_request_write();
         }
-        k_mutex_unlock(&data_buf_lock);
-    }
-    else {
-        LOG_INF("EEPROM empty or data layout version changed");
     }
 }
 
-void data_storage_write()
+static void storage_read()
 {
     int err;
 
-    if (!device_is_ready(eeprom_dev)) {
-        LOG_ERR("EEPROM device not ready");
+    if (!eeprom_ready()) {
         return;
     }
 
     k_mutex_lock(&data_buf_lock, K_FOREVER);
 
-    int len = ts.bin_export(buf + EEPROM_HEADER_SIZE, sizeof(buf) - EEPROM_HEADER_SIZE, SUBSET_NVM);
-    uint32_t crc = _calc_crc(buf + EEPROM_HEADER_SIZE, len);
+    // records with a sequence number >= this limit were already found to be invalid
+    uint32_t seq_limit = UINT32_MAX;
+
+    while (true) {
+        int newest_slot = -1;
+        uint32_t newest_seq = 0;
+
+        for (int slot = 0; slot < EEPROM_NUM_SLOTS; slot++) {
+            err = eeprom_read(eeprom_dev, slot_offset(slot), buf, EEPROM_HEADER_SIZE);
+            uint16_t version = *((uint16_t *)&buf[4]);
+            uint16_t len = *((uint16_t *)&buf[6]);
+            uint32_t seq = *((uint32_t *)&buf[8]);
 
-    *((uint16_t *)&buf[0]) = (uint16_t)DATA_OBJECTS_VERSION;
-    *((uint16_t *)&buf[2]) = (uint16_t)(len);
-    *((uint32_t *)&buf[4]) = crc;
+            if (err != 0 || version != DATA_OBJECTS_VERSION
+                || len > EEPROM_SLOT_SIZE - EEPROM_HEADER_SIZE)
+            {
+                continue;
+            }
 
-    // printf("Data (len=%d): ", len);
-    // for (int i = 0; i < len; i++) printf("%.2x ", buf[i + EEPROM_HEADER_SIZE]);
+            if (seq > journal_seq) {
+                // continue writing after the newest record, even if it is invalid
+                journal_seq = seq;
+                journal_slot = slot;
+            }
 
-    LOG_DBG("Header: %.2x %.2x %.2x %.2x %.2x %.2x %.2x %.2x", buf[0], buf[1], buf[2], buf[3],
-            buf[4], buf[5], buf[6], buf[7]);
+            if (seq < seq_limit && seq > newest_seq) {
+                newest_slot = slot;
+                newest_seq = seq;
+            }
+        }
+
+        if (newest_slot < 0) {
+            LOG_INF("EEPROM empty or data layout version changed");
+            eeprom_migrate();
+            break;
+        }
+
+        err = eeprom_read(eeprom_dev, slot_offset(newest_slot), buf, EEPROM_SLOT_SIZE);
+        uint16_t len = *((uint16_t *)&buf[6]);
+        uint32_t crc = *((uint32_t *)&buf[0]);
+
+        LOG_DBG("EEPROM record restore: slot %d, seq %u, len %d, CRC %.8x", newest_slot,
+                (unsigned int)newest_seq, len, (unsigned int)crc);
+
+        if (err == 0 && crc_engine_crc32(buf + 4, EEPROM_HEADER_SIZE - 4 + len) == crc) {
+            int status = ts.bin_import(buf + EEPROM_HEADER_SIZE, len, TS_WRITE_MASK, SUBSET_NVM);
+            LOG_INF("EEPROM read and data objects updated, ThingSet result: 0x%x", status);
+            stored_crc = crc_engine_crc32(buf + EEPROM_HEADER_SIZE, len);
+            break;
+        }
+
+        LOG_WRN("EEPROM record %u invalid, trying previous record", (unsigned int)newest_seq);
+        seq_limit = newest_seq;
+    }
+
+    k_mutex_unlock(&data_buf_lock);
+}
+
+static int storage_write()
+{
+    int err = 0;
+
+    if (!eeprom_ready()) {
+        return -ENODEV;
+    }
+
+    k_mutex_lock(&data_buf_lock, K_FOREVER);
+
+    int len = ts.bin_export(buf + EEPROM_HEADER_SIZE, sizeof(buf) - EEPROM_HEADER_SIZE, SUBSET_NVM);
+    uint32_t data_crc = crc_engine_crc32(buf + EEPROM_HEADER_SIZE, len);
 
     if (len == 0) {
         LOG_ERR("EEPROM data could not be stored. ThingSet error (len = %d)", len);
+        err = -ENOMEM;
+    }
+    else if (data_crc == stored_crc) {
+        LOG_DBG("EEPROM data unchanged");
     }
     else {
-        err = eeprom_write(eeprom_dev, 0, buf, len + EEPROM_HEADER_SIZE);
+        int slot = (journal_slot + 1) % EEPROM_NUM_SLOTS;
+
+        *((uint16_t *)&buf[4]) = (uint16_t)DATA_OBJECTS_VERSION;
+        *((uint16_t *)&buf[6]) = (uint16_t)(len);
+        *((uint32_t *)&buf[8]) = journal_seq + 1;
+        *((uint32_t *)&buf[0]) = crc_engine_crc32(buf + 4, EEPROM_HEADER_SIZE - 4 + len);
+
+        err = eeprom_write(eeprom_dev, slot_offset(slot), buf, len + EEPROM_HEADER_SIZE);
         if (err == 0) {
-            LOG_INF("EEPROM data successfully stored");
+            LOG_INF("EEPROM data successfully stored (slot %d)", slot);
+            journal_slot = slot;
+            journal_seq++;
+            stored_crc = data_crc;
         }
         else {
             LOG_ERR("EEPROM write error %d", err);
         }
     }
     k_mutex_unlock(&data_buf_lock);
+
+    return err;
+}
+
+static int hot_record_write(const HotRecord *rec)
+{
+    return eeprom_write(eeprom_dev, EEPROM_HOT_RECORD_OFFSET, rec, sizeof(HotRecord));
+}
+
+static int hot_record_read(HotRecord *rec)
+{
+    if (!device_is_ready(eeprom_dev)) {
+        return -ENODEV;
+    }
+    return eeprom_read(eeprom_dev, EEPROM_HOT_RECORD_OFFSET, rec, sizeof(HotRecord));
+}
+
+static void hot_record_erase()
+{
+    HotRecord rec = {};
+    eeprom_write(eeprom_dev, EEPROM_HOT_RECORD_OFFSET, &rec, sizeof(HotRecord));
+}
+
+static int hist_record_write(int copy, const HistRecord *rec)
+{
+    return eeprom_write(eeprom_dev, EEPROM_HIST_OFFSET + copy * EEPROM_HIST_SLOT_SIZE, rec,
+                        sizeof(HistRecord));
+}
+
+static int hist_record_read(int copy, HistRecord *rec)
+{
+    if (!device_is_ready(eeprom_dev)) {
+        return -ENODEV;
+    }
+    return eeprom_read(eeprom_dev, EEPROM_HIST_OFFSET + copy * EEPROM_HIST_SLOT_SIZE, rec,
+                       sizeof(HistRecord));
+}
+
+int data_storage_event_write(uint32_t slot, const void *data, size_t len)
+{
+    if (slot >= DATA_STORAGE_EVENT_SLOTS || len > DATA_STORAGE_EVENT_SIZE) {
+        return -EINVAL;
+    }
+    return eeprom_write(eeprom_dev, EEPROM_EVENTS_OFFSET + slot * DATA_STORAGE_EVENT_SIZE, data,
+                        len);
+}
+
+int data_storage_event_read(uint32_t slot, void *data, size_t len)
+{
+    if (!device_is_ready(eeprom_dev)) {
+        return -ENODEV;
+    }
+    if (slot >= DATA_STORAGE_EVENT_SLOTS || len > DATA_STORAGE_EVENT_SIZE) {
+        return -EINVAL;
+    }
+    return eeprom_read(eeprom_dev, EEPROM_EVENTS_OFFSET + slot * DATA_STORAGE_EVENT_SIZE, data,
+                       len);
 }
 
 #elif defined(CONFIG_NVS)
@@ -162,21 +375,150 @@ void data_storage_write()
 #include <zephyr/fs/nvs.h>
 #include <zephyr/storage/flash_map.h>
 
+#include <string.h>
+
 /*
- * NVS header bytes:
+ * Each data object of SUBSET_NVM is stored in a separate NVS record with the data object ID used
+ * as the NVS ID, so that only objects which were changed have to be written.
+ *
+ * NVS ID 0 (the root object, which is never stored) holds the data objects version number. It is
+ * written after all objects were stored successfully.
+ */
+#define NVS_VERSION_ID 0
+
+/*
+ * Previous layout with all objects exported into a single record with the following header bytes:
  * - 0-1: Data objects version number
  *
- * Data starts from byte 2
+ * Data starts from byte 2. The record is only read for migration and deleted afterwards.
  */
 #define NVS_HEADER_SIZE 2
 
+#define THINGSET_DATA_ID 1
+
+/*
+ * NVS ID of the hot record (outside of the range of data object IDs)
+ */
+#define NVS_HOT_RECORD_ID 0xFFFE
+
+/*
+ * NVS IDs of the HIST_RECORD_COPIES copies of the histogram record
+ */
+#define NVS_HIST_RECORD_ID_BASE 0xFFF0
+
+/*
+ * First of DATA_STORAGE_EVENT_SLOTS consecutive NVS IDs used for event log entries
+ */
+#define NVS_EVENT_ID_BASE 0xFF00
+
 #define NVS_PARTITION storage_partition
 
-#define THINGSET_DATA_ID 1
+/*
+ * Maximum number of data objects in SUBSET_NVM
+ */
+#define NVS_MAX_OBJECTS 96
+
+extern ThingSetDataObject data_objects[];
+extern const size_t num_data_objects;
 
 static struct nvs_fs fs;
 static bool nvs_initialized = false;
 
+// true if the version record matches the actual data objects version
+static bool version_stored = false;
+
+// CRC of the value of each object in SUBSET_NVM (in order of data_objects) when it was stored
+static uint32_t stored_crc[NVS_MAX_OBJECTS];
+
+static void nvs_restore();
+static int storage_write();
+
+#if DT_NODE_EXISTS(DT_NODELABEL(log_partition))
+
+#define LOG_PARTITION log_partition
+
+/*
+ * Previous firmware versions used a larger NVS partition, which also covered the space of the log
+ * partition directly following the storage partition. As NVS moves through all sectors over time,
+ * the data may be located anywhere in this area and has to be moved explicitly.
+ *
+ * The marker at the start of the log partition (first sector is not used by the energy log)
+ * indicates that the data was already moved to the smaller partition.
+ */
+BUILD_ASSERT(FIXED_PARTITION_OFFSET(LOG_PARTITION)
+                 == FIXED_PARTITION_OFFSET(NVS_PARTITION) + FIXED_PARTITION_SIZE(NVS_PARTITION),
+             "Log partition must directly follow the storage partition");
+
+#define NVS_LEGACY_PARTITION_SIZE                                                                  \
+    (FIXED_PARTITION_SIZE(NVS_PARTITION) + FIXED_PARTITION_SIZE(LOG_PARTITION))
+
+#define NVS_LAYOUT_MARKER 0x314C564EU // "NVL1" in little-endian byte order
+
+static bool nvs_layout_migrated()
+{
+    uint32_t marker = 0;
+    int err = flash_read(fs.flash_device, FIXED_PARTITION_OFFSET(LOG_PARTITION), &marker,
+                         sizeof(marker));
+    return err == 0 && marker == NVS_LAYOUT_MARKER;
+}
+
+/*
+ * Read the data with the previous layout, move it to the storage partition and set the marker
+ *
+ * The marker is written last, so an interrupted migration is repeated after the next reset.
+ */
+static int nvs_layout_migrate()
+{
+    int err;
+
+    fs.sector_count = NVS_LEGACY_PARTITION_SIZE / fs.sector_size;
+    err = nvs_mount(&fs);
+    if (err == 0) {
+        nvs_initialized = true;
+        nvs_restore();
+        nvs_initialized = false;
+    }
+    else {
+        LOG_WRN("NVS with previous layout could not be mounted: %d", err);
+    }
+
+    // also erases the sector containing the marker
+    err = flash_erase(fs.flash_device, fs.offset,
+                      FIXED_PARTITION_SIZE(NVS_PARTITION) + fs.sector_size);
+    if (err) {
+        LOG_ERR("Flash erase failed: %d", err);
+        return err;
+    }
+
+    fs.sector_count = FIXED_PARTITION_SIZE(NVS_PARTITION) / fs.sector_size;
+    err = nvs_mount(&fs);
+    if (err) {
+        LOG_ERR("NVS mount failed: %d", err);
+        return err;
+    }
+    nvs_initialized = true;
+
+    // all restored objects have to be written again
+    version_stored = false;
+    err = storage_write();
+    if (err) {
+        return err;
+    }
+
+    uint32_t marker = NVS_LAYOUT_MARKER;
+    err = flash_write(fs.flash_device, FIXED_PARTITION_OFFSET(LOG_PARTITION), &marker,
+                      sizeof(marker));
+    if (err) {
+        LOG_ERR("Flash write failed: %d", err);
+        return err;
+    }
+
+    LOG_INF("NVS data moved to storage partition with new layout");
+    return 0;
+}
+
+#endif /* log_partition */
+
 static int data_storage_init()
 {
     int err;
@@ -194,6 +536,13 @@ static int data_storage_init()
         return err;
     }
     fs.sector_size = page_info.size;
+
+#ifdef LOG_PARTITION
+    if (!nvs_layout_migrated()) {
+        return nvs_layout_migrate();
+    }
+#endif
+
     fs.sector_count = FIXED_PARTITION_SIZE(NVS_PARTITION) / page_info.size;
 
     err = nvs_mount(&fs);
@@ -206,39 +555,149 @@ static int data_storage_init()
     return 0;
 }
 
-void data_storage_read()
+/*
+ * Make sure that the hot record can be written in the current sector
+ *
+ * If the current sector runs out of space, a write triggers a garbage collection of the next
+ * sector (copying its valid entries and erasing it), which takes too long in case of a power
+ * failure. Switch to the next sector in advance instead, so that the write of the hot record by
+ * the power fail thread never needs more than a single flash write.
+ *
+ * Must be called after each write of other data.
+ */
+static void nvs_reserve_hot_record()
 {
-    if (!nvs_initialized) {
-        int err = data_storage_init();
+    ssize_t free_space = nvs_sector_max_data_size(&fs);
+    if (free_space >= 0 && free_space < (ssize_t)sizeof(HotRecord)) {
+        int err = nvs_sector_use_next(&fs);
         if (err) {
-            return;
+            LOG_ERR("NVS sector change failed: %d", err);
         }
     }
+}
 
-    int num_bytes = nvs_read(&fs, THINGSET_DATA_ID, &buf, sizeof(buf));
+/*
+ * Get raw value of a data object
+ *
+ * @returns Length of the value or -ENOTSUP if the type cannot be stored
+ */
+static int object_value(const ThingSetDataObject *obj, uint8_t **value)
+{
+    *value = (uint8_t *)obj->data;
 
-    if (num_bytes < 0) {
-        LOG_INF("NVS empty (read error %d)", num_bytes);
-        return;
+    switch (obj->type) {
+        case TS_T_BOOL:
+            return sizeof(bool);
+        case TS_T_UINT64:
+        case TS_T_INT64:
+            return sizeof(uint64_t);
+        case TS_T_UINT32:
+        case TS_T_INT32:
+        case TS_T_FLOAT32:
+            return sizeof(uint32_t);
+        case TS_T_UINT16:
+        case TS_T_INT16:
+            return sizeof(uint16_t);
+        case TS_T_STRING:
+            return strnlen((char *)obj->data, obj->detail);
+        case TS_T_BYTES: {
+            ThingSetBytesBuffer *bytes = (ThingSetBytesBuffer *)obj->data;
+            *value = bytes->bytes;
+            return bytes->num_bytes;
+        }
+        default:
+            return -ENOTSUP;
     }
+}
 
-    uint16_t version = *((uint16_t *)&buf[0]);
+/*
+ * Restore raw value of a data object read from NVS
+ */
+static void object_restore(const ThingSetDataObject *obj, const uint8_t *value, int len)
+{
+    switch (obj->type) {
+        case TS_T_STRING:
+            if (len < obj->detail) {
+                memcpy(obj->data, value, len);
+                ((char *)obj->data)[len] = '\0';
+            }
+            break;
+        case TS_T_BYTES:
+            if (len <= obj->detail) {
+                ThingSetBytesBuffer *bytes = (ThingSetBytesBuffer *)obj->data;
+                memcpy(bytes->bytes, value, len);
+                bytes->num_bytes = len;
+            }
+            break;
+        default: {
+            uint8_t *data;
+            if (len == object_value(obj, &data)) {
+                memcpy(data, value, len);
+            }
+            break;
+        }
+    }
+}
 
-    if (version == DATA_OBJECTS_VERSION) {
-        k_mutex_lock(&data_buf_lock, K_FOREVER);
+static void data_storage_migrate()
+{
+    int num_bytes = nvs_read(&fs, THINGSET_DATA_ID, &buf, sizeof(buf));
 
+    if (num_bytes > NVS_HEADER_SIZE && *((uint16_t *)&buf[0]) == DATA_OBJECTS_VERSION) {
         int status = ts.bin_import(buf + NVS_HEADER_SIZE, num_bytes - NVS_HEADER_SIZE,
                                    TS_WRITE_MASK, SUBSET_NVM);
-        LOG_INF("NVS read and data objects updated, ThingSet result: 0x%x", status);
+        LOG_INF("NVS data migrated from single record, ThingSet result: 0x%x", status);
+    }
+}
 
-        k_mutex_unlock(&data_buf_lock);
+/*
+ * Restore data objects from the mounted NVS
+ */
+static void nvs_restore()
+{
+    uint16_t version = 0;
+    int ret = nvs_read(&fs, NVS_VERSION_ID, &version, sizeof(version));
+
+    k_mutex_lock(&data_buf_lock, K_FOREVER);
+
+    if (ret != sizeof(version)) {
+        LOG_INF("NVS empty (read error %d)", ret);
+        data_storage_migrate();
     }
-    else {
+    else if (version != DATA_OBJECTS_VERSION) {
         LOG_INF("NVS data layout version changed");
     }
+    else {
+        int num_restored = 0;
+        int n = 0;
+        for (size_t i = 0; i < num_data_objects && n < NVS_MAX_OBJECTS; i++) {
+            const ThingSetDataObject *obj = &data_objects[i];
+            if ((obj->subsets & SUBSET_NVM) == 0) {
+                continue;
+            }
+
+            int len = nvs_read(&fs, obj->id, &buf, sizeof(buf));
+            if (len >= 0 && len <= (int)sizeof(buf)) {
+                object_restore(obj, buf, len);
+                num_restored++;
+
+                // restored values don't have to be written again
+                uint8_t *value;
+                len = object_value(obj, &value);
+                if (len >= 0) {
+                    stored_crc[n] = crc_engine_crc32(value, len);
+                }
+            }
+            n++;
+        }
+        version_stored = true;
+        LOG_INF("NVS read and %d data objects restored", num_restored);
+    }
+
+    k_mutex_unlock(&data_buf_lock);
 }
 
-void data_storage_write()
+static void storage_read()
 {
     if (!nvs_initialized) {
         int err = data_storage_init();
@@ -247,43 +706,367 @@ void data_storage_write()
         }
     }
 
-    k_mutex_lock(&data_buf_lock, K_FOREVER);
+    nvs_restore();
+}
+
+static int storage_write()
+{
+    if (!nvs_initialized) {
+        int err = data_storage_init();
+        if (err) {
+            return err;
+        }
+    }
 
-    *((uint16_t *)&buf[0]) = (uint16_t)DATA_OBJECTS_VERSION;
+    int num_written = 0;
+    int num_errors = 0;
+    int n = 0;
 
-    int len = ts.bin_export(buf + NVS_HEADER_SIZE, sizeof(buf) - NVS_HEADER_SIZE, SUBSET_NVM);
+    for (size_t i = 0; i < num_data_objects; i++) {
+        const ThingSetDataObject *obj = &data_objects[i];
+        if ((obj->subsets & SUBSET_NVM) == 0) {
+            continue;
+        }
+        if (n >= NVS_MAX_OBJECTS) {
+            LOG_ERR("Too many data objects in NVM subset");
+            num_errors++;
+            break;
+        }
 
-    if (len == 0) {
-        LOG_ERR("NVS data could not be stored. ThingSet error (len = %d)", len);
-    }
-    else {
-        int ret = nvs_write(&fs, THINGSET_DATA_ID, &buf, len + NVS_HEADER_SIZE);
-        if (ret == len + NVS_HEADER_SIZE) {
-            LOG_DBG("NVS data successfully stored");
+        k_mutex_lock(&data_buf_lock, K_FOREVER);
+
+        uint8_t *value;
+        int len = object_value(obj, &value);
+        uint32_t crc = (len >= 0) ? crc_engine_crc32(value, len) : 0;
+
+        // writing zero length deletes the record, so empty values fall back to defaults
+        if (len >= 0 && (crc != stored_crc[n] || !version_stored)) {
+            int ret = nvs_write(&fs, obj->id, value, len);
+            if (ret >= 0) {
+                stored_crc[n] = crc;
+                num_written++;
+            }
+            else {
+                LOG_ERR("NVS write error %d for object 0x%x", ret, obj->id);
+                num_errors++;
+            }
         }
-        else if (ret == 0) {
-            LOG_DBG("NVS data unchanged");
+
+        k_mutex_unlock(&data_buf_lock);
+        n++;
+    }
+
+    if (!version_stored && num_errors == 0) {
+        uint16_t version = DATA_OBJECTS_VERSION;
+        int ret = nvs_write(&fs, NVS_VERSION_ID, &version, sizeof(version));
+        if (ret >= 0) {
+            version_stored = true;
+            nvs_delete(&fs, THINGSET_DATA_ID);
         }
         else {
             LOG_ERR("NVS write error %d", ret);
         }
     }
 
-    k_mutex_unlock(&data_buf_lock);
+    nvs_reserve_hot_record();
+
+    if (num_written > 0) {
+        LOG_DBG("NVS data successfully stored (%d objects changed)", num_written);
+    }
+    else {
+        LOG_DBG("NVS data unchanged");
+    }
+
+    return (num_errors == 0 && version_stored) ? 0 : -EIO;
+}
+
+static int hot_record_write(const HotRecord *rec)
+{
+    if (!nvs_initialized) {
+        return -ENODEV;
+    }
+    int ret = nvs_write(&fs, NVS_HOT_RECORD_ID, rec, sizeof(HotRecord));
+    return ret < 0 ? ret : 0;
+}
+
+static int hot_record_read(HotRecord *rec)
+{
+    if (!nvs_initialized) {
+        return -ENODEV;
+    }
+    int ret = nvs_read(&fs, NVS_HOT_RECORD_ID, rec, sizeof(HotRecord));
+    return ret == sizeof(HotRecord) ? 0 : -ENOENT;
+}
+
+static void hot_record_erase()
+{
+    nvs_delete(&fs, NVS_HOT_RECORD_ID);
+}
+
+static int hist_record_write(int copy, const HistRecord *rec)
+{
+    if (!nvs_initialized) {
+        return -ENODEV;
+    }
+    int ret = nvs_write(&fs, NVS_HIST_RECORD_ID_BASE + copy, rec, sizeof(HistRecord));
+    nvs_reserve_hot_record();
+    return ret < 0 ? ret : 0;
+}
+
+static int hist_record_read(int copy, HistRecord *rec)
+{
+    if (!nvs_initialized) {
+        return -ENODEV;
+    }
+    int ret = nvs_read(&fs, NVS_HIST_RECORD_ID_BASE + copy, rec, sizeof(HistRecord));
+    return ret == sizeof(HistRecord) ? 0 : -ENOENT;
+}
+
+int data_storage_event_write(uint32_t slot, const void *data, size_t len)
+{
+    if (!nvs_initialized) {
+        return -ENODEV;
+    }
+    if (slot >= DATA_STORAGE_EVENT_SLOTS || len > DATA_STORAGE_EVENT_SIZE) {
+        return -EINVAL;
+    }
+    int ret = nvs_write(&fs, NVS_EVENT_ID_BASE + slot, data, len);
+    nvs_reserve_hot_record();
+    return ret < 0 ? ret : 0;
+}
+
+int data_storage_event_read(uint32_t slot, void *data, size_t len)
+{
+    if (!nvs_initialized) {
+        return -ENODEV;
+    }
+    if (slot >= DATA_STORAGE_EVENT_SLOTS || len > DATA_STORAGE_EVENT_SIZE) {
+        return -EINVAL;
+    }
+    int ret = nvs_read(&fs, NVS_EVENT_ID_BASE + slot, data, len);
+    return ret == (int)len ? 0 : -ENOENT;
 }
 
 #else
 
-void data_storage_write()
+static int storage_write()
+{
+    return 0;
+}
+static void storage_read()
 {}
-void data_storage_read()
+static int hot_record_write(const HotRecord *rec)
+{
+    return -ENOTSUP;
+}
+static int hot_record_read(HotRecord *rec)
+{
+    return -ENOTSUP;
+}
+static void hot_record_erase()
 {}
+static int hist_record_write(int copy, const HistRecord *rec)
+{
+    return -ENOTSUP;
+}
+static int hist_record_read(int copy, HistRecord *rec)
+{
+    return -ENOTSUP;
+}
+int data_storage_event_write(uint32_t slot, const void *data, size_t len)
+{
+    return -ENOTSUP;
+}
+int data_storage_event_read(uint32_t slot, void *data, size_t len)
+{
+    return -ENOTSUP;
+}
 
 #endif
 
+bool data_storage_pending = false;
+uint32_t data_storage_writes = 0;
+int32_t data_storage_error = 0;
+
+// limit of 1 coalesces all requests that arrive before the storage thread starts writing (also
+// used to wake up the thread for pending log records)
+K_SEM_DEFINE(write_request, 0, 1);
+
+K_SEM_DEFINE(power_fail_request, 0, 1);
+
+// double buffer, so that the power-fail thread never writes a partially updated record
+static HotRecord hot_records[2];
+static HotRecord *volatile hot_record = NULL;
+
+static volatile bool power_fail_armed = false;
+static int32_t power_fail_timestamp = -HOT_RECORD_REARM_TIME;
+
+// sequence number of the newest stored histogram record
+static uint32_t hist_seq = 0;
+
+static inline uint32_t hot_record_crc(const HotRecord *rec)
+{
+    return crc_engine_crc32(rec, offsetof(HotRecord, crc));
+}
+
+static inline uint32_t hist_record_crc(const HistRecord *rec)
+{
+    return crc_engine_crc32(rec, offsetof(HistRecord, crc));
+}
+
+static void hot_record_restore()
+{
+    HotRecord rec;
+    if (hot_record_read(&rec) == 0 && rec.version == HOT_RECORD_VERSION
+        && rec.crc == hot_record_crc(&rec))
+    {
+        // the hot record is always newer than the regular data
+        charger.soc = rec.soc;
+        charger.discharged_Ah = rec.discharged_Ah;
+        dev_stat.bat_chg_total_Wh = rec.bat_chg_total_Wh;
+        dev_stat.bat_dis_total_Wh = rec.bat_dis_total_Wh;
+        dev_stat.solar_in_total_Wh = rec.solar_in_total_Wh;
+        dev_stat.load_out_total_Wh = rec.load_out_total_Wh;
+
+        // move restored data to regular storage, as the hot record may become outdated
+        hot_record_erase();
+        data_storage_request_write();
+    }
+}
+
+static void hist_record_restore()
+{
+    HistRecord rec;
+    bool found = false;
+
+    for (int copy = 0; copy < HIST_RECORD_COPIES; copy++) {
+        if (hist_record_read(copy, &rec) == 0 && rec.version == HIST_RECORD_VERSION
+            && rec.crc == hist_record_crc(&rec) && (!found || rec.seq > hist_seq))
+        {
+            dev_stat.bat_hist = rec.hist;
+            hist_seq = rec.seq;
+            found = true;
+        }
+    }
+}
+
+static int hist_record_store()
+{
+    HistRecord rec = {};
+
+    rec.version = HIST_RECORD_VERSION;
+    rec.seq = hist_seq + 1;
+    rec.hist = dev_stat.bat_hist;
+    rec.crc = hist_record_crc(&rec);
+
+    int err = hist_record_write(rec.seq % HIST_RECORD_COPIES, &rec);
+    if (err == 0) {
+        hist_seq = rec.seq;
+    }
+    return err == -ENOTSUP ? 0 : err;
+}
+
+void data_storage_read()
+{
+    storage_read();
+    hot_record_restore();
+    hist_record_restore();
+}
+
+void data_storage_write()
+{
+    data_storage_error = storage_write();
+    if (data_storage_error == 0) {
+        data_storage_error = hist_record_store();
+    }
+    if (data_storage_error == 0) {
+        data_storage_writes++;
+    }
+}
+
+void data_storage_request_write()
+{
+    data_storage_pending = true;
+    k_sem_give(&write_request);
+}
+
+void data_storage_notify()
+{
+    k_sem_give(&write_request);
+}
+
+void data_storage_hot_update()
+{
+    HotRecord *rec = (hot_record == &hot_records[0]) ? &hot_records[1] : &hot_records[0];
+
+    rec->version = HOT_RECORD_VERSION;
+    rec->soc = charger.soc;
+    rec->bat_chg_total_Wh = dev_stat.bat_chg_total_Wh;
+    rec->bat_dis_total_Wh = dev_stat.bat_dis_total_Wh;
+    rec->solar_in_total_Wh = dev_stat.solar_in_total_Wh;
+    rec->load_out_total_Wh = dev_stat.load_out_total_Wh;
+    rec->discharged_Ah = charger.discharged_Ah;
+    rec->crc = hot_record_crc(rec);
+
+    hot_record = rec;
+
+    if ((int32_t)uptime() - power_fail_timestamp >= HOT_RECORD_REARM_TIME) {
+        power_fail_armed = true;
+    }
+}
+
+void data_storage_power_fail()
+{
+    if (power_fail_armed) {
+        power_fail_armed = false;
+        power_fail_timestamp = uptime();
+        k_sem_give(&power_fail_request);
+    }
+}
+
 void data_storage_update()
 {
     if (uptime() % DATA_UPDATE_INTERVAL == 0 && uptime() > 0) {
-        data_storage_write();
+        data_storage_request_write();
     }
 }
+
+#ifndef UNIT_TEST
+
+static void data_storage_thread()
+{
+    while (true) {
+        k_sem_take(&write_request, K_FOREVER);
+
+        // log records are only kept in RAM until stored, so they are written first
+        energy_log_flush();
+        event_log_flush();
+
+        if (data_storage_pending) {
+            // requests received while writing will trigger another write
+            data_storage_pending = false;
+            data_storage_write();
+        }
+    }
+}
+
+K_THREAD_DEFINE(data_storage_thread_id, 1024, data_storage_thread, NULL, NULL, NULL, 7, 0, 1000);
+
+static void power_fail_thread()
+{
+    while (true) {
+        k_sem_take(&power_fail_request, K_FOREVER);
+
+        // record was pre-serialized, so only a single write is necessary (for NVS, space in the
+        // current sector was reserved after the last regular write to avoid garbage collection)
+        HotRecord *rec = hot_record;
+        if (rec != NULL) {
+            data_storage_error = hot_record_write(rec);
+        }
+    }
+}
+
+// cooperative priority higher than the control thread
+K_THREAD_DEFINE(power_fail_thread_id, 512, power_fail_thread, NULL, NULL, NULL, -2, 0, 0);
+
+#endif
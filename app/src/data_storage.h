@@ -7,27 +7,120 @@
 #ifndef DATA_STORAGE_H_
 #define DATA_STORAGE_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #define DATA_UPDATE_INTERVAL (6 * 60 * 60) // update every 6 hours
 
+/**
+ * Number of slots for event log entries (see event_log.h)
+ */
+#define DATA_STORAGE_EVENT_SLOTS 32
+
+/**
+ * Maximum size of a single event log entry (bytes)
+ */
+#define DATA_STORAGE_EVENT_SIZE 32
+
 /**
  * @file
  *
  * @brief Handling of internal or external EEPROM to store device configuration
  */
 
+/**
+ * True if a write was requested but not yet started by the storage thread
+ */
+extern bool data_storage_pending;
+
+/**
+ * Number of successfully completed writes since startup
+ */
+extern uint32_t data_storage_writes;
+
+/**
+ * Result of the last write (0 if successful, negative error code otherwise)
+ */
+extern int32_t data_storage_error;
+
 /**
  * Store current charge controller data to EEPROM
+ *
+ * The data is written synchronously, so this function may block for a longer time. It should
+ * only be used if the data must be stored immediately, e.g. before a reset.
  */
 void data_storage_write();
 
+/**
+ * Request to store current charge controller data to EEPROM
+ *
+ * The data is written by a low-priority storage thread and this function returns immediately.
+ * Multiple requests before the write is started are coalesced into a single write.
+ */
+void data_storage_request_write();
+
+/**
+ * Wake up the storage thread to store pending log records (see energy_log_flush and
+ * event_log_flush)
+ *
+ * Returns immediately and can be called from an ISR.
+ */
+void data_storage_notify();
+
 /**
  * Restore charge controller data from EEPROM and write to variables in RAM
  */
 void data_storage_read();
 
 /**
- * Stores data to EEPROM every 6 hours (can be called regularly)
+ * Update the pre-serialized record with energy counters and SOC written in case of power failure
+ *
+ * Must be called regularly (e.g. once per second), as only the data of the last call is stored.
+ */
+void data_storage_hot_update();
+
+/**
+ * Store the record prepared by data_storage_hot_update immediately
+ *
+ * The record is written with a single write from a high-priority thread, so this function can
+ * be called from an ISR. Further calls are ignored until the record was updated again at least
+ * 60 seconds later.
+ *
+ * With NVS, enough space for the record is kept free in the current flash sector, so that the
+ * write never triggers a garbage collection. Worst case are two flash writes (the record and its
+ * allocation table entry). If another write to NVS is in progress when the power fails, the
+ * record is written after it (blocking on the NVS mutex).
+ */
+void data_storage_power_fail();
+
+/**
+ * Requests to store data to EEPROM every 6 hours (can be called regularly)
  */
 void data_storage_update();
 
+/**
+ * Store an event log entry
+ *
+ * The entry is written synchronously and independent of the other data.
+ *
+ * @param slot Slot number (0 to DATA_STORAGE_EVENT_SLOTS - 1)
+ * @param data Pointer to the entry
+ * @param len Length of the entry (max. DATA_STORAGE_EVENT_SIZE)
+ *
+ * @returns 0 on success, negative error code otherwise (-ENOTSUP if no storage is available)
+ */
+int data_storage_event_write(uint32_t slot, const void *data, size_t len);
+
+/**
+ * Read an event log entry
+ *
+ * @param slot Slot number (0 to DATA_STORAGE_EVENT_SLOTS - 1)
+ * @param data Pointer to store the entry
+ * @param len Length of the entry (max. DATA_STORAGE_EVENT_SIZE)
+ *
+ * @returns 0 on success, negative error code otherwise
+ */
+int data_storage_event_read(uint32_t slot, void *data, size_t len);
+
 #endif /* DATA_STORAGE_H_ */
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "day_detector.h"
+
+// difference between two times of day in the range of -12 h to +12 h
+static inline int32_t tod_diff(uint32_t a, uint32_t b)
+{
+    int32_t diff = (int32_t)a - (int32_t)b;
+    if (diff >= DAY_LENGTH / 2) {
+        diff -= DAY_LENGTH;
+    }
+    else if (diff < -DAY_LENGTH / 2) {
+        diff += DAY_LENGTH;
+    }
+    return diff;
+}
+
+static inline uint32_t tod_add(uint32_t tod, int32_t offset)
+{
+    return ((int32_t)tod + offset % DAY_LENGTH + DAY_LENGTH) % DAY_LENGTH;
+}
+
+static void history_add(DayHistory *hist, uint32_t tod)
+{
+    hist->tod[hist->pos] = tod;
+    hist->pos = (hist->pos + 1) % DAY_HISTORY_SIZE;
+    if (hist->count < DAY_HISTORY_SIZE) {
+        hist->count++;
+    }
+}
+
+uint32_t DayDetector::time_of_day(uint32_t time)
+{
+    if (clock_valid) {
+        return tod_add(time % DAY_LENGTH, tz_offset * 60);
+    }
+    else {
+        return seconds % DAY_LENGTH;
+    }
+}
+
+int32_t DayDetector::expected(const DayHistory *hist, uint32_t default_tod)
+{
+    if (hist->count >= DAY_HISTORY_MIN) {
+        // mean of the deviations from the first entry avoids issues around midnight
+        int32_t sum = 0;
+        for (int i = 1; i < hist->count; i++) {
+            sum += tod_diff(hist->tod[i], hist->tod[0]);
+        }
+        return tod_add(hist->tod[0], sum / hist->count);
+    }
+    else if (clock_valid) {
+        return default_tod;
+    }
+    else {
+        return -1;
+    }
+}
+
+void DayDetector::update_expected()
+{
+    sunrise_tod = expected(&sunrises, DAY_DEFAULT_SUNRISE);
+    int32_t sunset_tod = expected(&sunsets, DAY_DEFAULT_SUNSET);
+
+    sunrise_min = (sunrise_tod >= 0) ? sunrise_tod / 60 : UINT16_MAX;
+    sunset_min = (sunset_tod >= 0) ? sunset_tod / 60 : UINT16_MAX;
+}
+
+void DayDetector::reset_history()
+{
+    sunrises.count = 0;
+    sunrises.pos = 0;
+    sunsets.count = 0;
+    sunsets.pos = 0;
+    update_expected();
+}
+
+bool DayDetector::is_sunrise(uint32_t tod)
+{
+    if (day_start_valid && seconds - day_start < DAY_LENGTH - DAY_SUNRISE_TOLERANCE) {
+        // current day started only recently (e.g. sun after a storm in the afternoon)
+        return false;
+    }
+
+    if (sunrises.count >= DAY_HISTORY_MIN) {
+        return seconds_dark >= DAY_DARK_MIN
+               && tod_diff(tod, sunrise_tod) >= -DAY_SUNRISE_TOLERANCE
+               && tod_diff(tod, sunrise_tod) <= DAY_SUNRISE_TOLERANCE;
+    }
+    else {
+        return seconds_dark > NIGHT_TIME_MIN;
+    }
+}
+
+bool DayDetector::is_overdue(uint32_t tod)
+{
+    if (sunrise_tod < 0
+        || (day_start_valid && seconds - day_start < DAY_LENGTH - DAY_SUNRISE_TOLERANCE))
+    {
+        return false;
+    }
+
+    return tod_diff(tod, sunrise_tod) == DAY_SUNRISE_TOLERANCE
+           || (day_start_valid && seconds - day_start >= DAY_LENGTH + DAY_SUNRISE_TOLERANCE);
+}
+
+bool DayDetector::update(bool solar_available, uint32_t time)
+{
+    bool new_day = false;
+
+    seconds++;
+
+    bool clock = time >= DAY_TIMESTAMP_VALID;
+    if (clock != clock_valid || tz_offset != tz_offset_prev) {
+        // reference for the time of day changed: previous statistics are not valid anymore
+        clock_valid = clock;
+        tz_offset_prev = tz_offset;
+        reset_history();
+    }
+
+    uint32_t tod = time_of_day(time);
+
+    if (solar_available) {
+        if (seconds_dark > 0 && is_sunrise(tod)) {
+            history_add(&sunrises, tod);
+            if (dusk_valid) {
+                history_add(&sunsets, dusk_tod);
+            }
+            update_expected();
+            missed_days = 0;
+            new_day = true;
+        }
+        seconds_dark = 0;
+    }
+    else {
+        if (seconds_dark == 0) {
+            dusk_tod = tod;
+            dusk_valid = seconds > 1;
+        }
+        seconds_dark++;
+    }
+
+    if (!new_day && is_overdue(tod)) {
+        new_day = true;
+        missed_days++;
+        if (missed_days > DAY_HISTORY_SIZE && sunrises.count > 0) {
+            // no sunrise at the expected time for several days: statistics may be wrong
+            reset_history();
+        }
+    }
+
+    if (new_day) {
+        day_start = seconds;
+        day_start_valid = true;
+    }
+
+    return new_day;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef DAY_DETECTOR_H
+#define DAY_DETECTOR_H
+
+/** @file
+ *
+ * @brief Detection of day boundaries (sunrise) based on solar power availability
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Minimum time without solar power to detect a night (s)
+ */
+#define NIGHT_TIME_MIN (5 * 60 * 60)
+
+/**
+ * Length of a day (s)
+ */
+#define DAY_LENGTH (24 * 60 * 60)
+
+/**
+ * Number of previous days used to derive the expected sunrise and sunset times
+ */
+#define DAY_HISTORY_SIZE 4
+
+/**
+ * Minimum number of observed sunrises before the statistics are used
+ */
+#define DAY_HISTORY_MIN 2
+
+/**
+ * Maximum deviation of a sunrise from the expected time of day (s)
+ *
+ * If no sunrise was detected until the expected time plus this tolerance, a new day is started
+ * anyway.
+ */
+#define DAY_SUNRISE_TOLERANCE (2 * 60 * 60)
+
+/**
+ * Minimum time without solar power before a sunrise at the expected time of day (s)
+ */
+#define DAY_DARK_MIN (60 * 60)
+
+/**
+ * Timestamps below this value (2020-01-01) are considered as not set
+ */
+#define DAY_TIMESTAMP_VALID 1577836800
+
+/**
+ * Sunrise and sunset time of day assumed if only the clock is known (s)
+ */
+#define DAY_DEFAULT_SUNRISE (6 * 60 * 60)
+#define DAY_DEFAULT_SUNSET (18 * 60 * 60)
+
+/**
+ * Times of day of the last few days (s)
+ */
+struct DayHistory
+{
+    uint32_t tod[DAY_HISTORY_SIZE];
+    uint8_t count;
+    uint8_t pos;
+};
+
+/**
+ * Day boundary detector
+ *
+ * A new day starts at sunrise, i.e. when solar power becomes available after the night. In
+ * order to be robust against storms or snow cover during the day, the times of day of the last
+ * sunrises and sunsets are tracked.
+ *
+ * Once enough sunrises were observed, solar power after a dark period is only accepted as a
+ * sunrise if it is close to the expected time of day and the previous day started at least
+ * 22 hours ago. If no sunrise is detected (e.g. because of snow on the panel or if no solar
+ * input exists), the new day is started at the expected sunrise time plus the tolerance.
+ *
+ * Without statistics, a sunrise is detected after at least NIGHT_TIME_MIN without solar power.
+ *
+ * If the timestamp was set to a valid unix time, the local time of day (considering tz_offset)
+ * is used as a reference and sunrise is assumed at 06:00 until statistics are available.
+ * Otherwise, the time since startup is used.
+ */
+class DayDetector
+{
+public:
+    /**
+     * Process the solar power availability of the last second
+     *
+     * Must be called exactly once per second.
+     *
+     * @param solar_available True if solar power is available
+     * @param time Current unix timestamp (s)
+     *
+     * @returns true at the start of a new day
+     */
+    bool update(bool solar_available, uint32_t time);
+
+    int16_t tz_offset = 0; ///< Offset of the local time zone from UTC (min)
+
+    uint16_t sunrise_min = UINT16_MAX; ///< Expected sunrise (minute of day, UINT16_MAX = unknown)
+    uint16_t sunset_min = UINT16_MAX;  ///< Expected sunset (minute of day, UINT16_MAX = unknown)
+
+private:
+    uint32_t time_of_day(uint32_t time);
+
+    /**
+     * Circular mean of the times of day in the history
+     *
+     * @returns Time of day (s) or -1 if not enough data available and the clock is not set
+     */
+    int32_t expected(const DayHistory *hist, uint32_t default_tod);
+
+    void update_expected();
+
+    void reset_history();
+
+    bool is_sunrise(uint32_t tod);
+
+    bool is_overdue(uint32_t tod);
+
+    uint32_t seconds = 0;       ///< Time since startup (s)
+    uint32_t seconds_dark = 0;  ///< Time since solar power is not available anymore (s)
+    uint32_t dusk_tod = 0;      ///< Time of day when the current dark period started (s)
+    bool dusk_valid = false;    ///< False if it was already dark at startup
+    uint32_t day_start = 0;     ///< Value of seconds at the start of the current day
+    bool day_start_valid = false;
+
+    bool clock_valid = false;   ///< True if the history is based on the local time of day
+    int16_t tz_offset_prev = 0; ///< Time zone offset the history is based on
+
+    DayHistory sunrises = {};
+    DayHistory sunsets = {};
+
+    uint8_t missed_days = 0; ///< Days started without detected sunrise since last sunrise
+
+    int32_t sunrise_tod = -1; ///< Expected time of day of sunrise (s), -1 if unknown
+};
+
+#endif /* DAY_DETECTOR_H */
@@ -43,7 +43,7 @@ LOG_MODULE_REGISTER(dcdc, CONFIG_DCDC_LOG_LEVEL);
 
 extern DeviceStatus dev_stat;
 
-Dcdc::Dcdc(DcBus *high, DcBus *low, DcdcOperationMode op_mode)
+Dcdc::Dcdc(DcBus *high, DcBus *low, DcdcOperationMode op_mode) : lvs_port(low)
 {
     hvb = high;
     lvb = low;
@@ -73,11 +73,11 @@ void Dcdc::perturb_observe_buck()
         // switch off after 10s low power or negative power (if not in nanogrid mode)
         pwm_direction = 0;
     }
-    else if (lvb->voltage > lvb->sink_control_voltage()) {
+    else if (lvb->voltage > lvs_port.sink_control_voltage()) {
         state = DCDC_CONTROL_CV_LS;
         pwm_direction = BUCK_DUTY_POWER_DECREASE;
     }
-    else if (lvb->sink_current_margin < 0 || inductor_current > inductor_current_max) {
+    else if (lvs_port.sink_current_margin() < 0 || inductor_current > inductor_current_max) {
         state = DCDC_CONTROL_CC_LS;
         pwm_direction = BUCK_DUTY_POWER_DECREASE;
     }
@@ -94,7 +94,7 @@ void Dcdc::perturb_observe_buck()
         state = DCDC_CONTROL_DERATING;
         pwm_direction = BUCK_DUTY_POWER_DECREASE;
     }
-    else if (power < output_power_min && lvb->voltage < lvb->src_control_voltage()) {
+    else if (power < output_power_min && lvb->voltage < lvs_port.src_control_voltage()) {
         // no load condition (e.g. start-up of nanogrid) --> raise voltage
         pwm_direction = BUCK_DUTY_POWER_INCREASE;
     }
@@ -126,11 +126,11 @@ void Dcdc::perturb_observe_boost()
         state = DCDC_CONTROL_CC_HS;
         pwm_direction = BOOST_DUTY_POWER_DECREASE;
     }
-    else if (lvb->src_current_margin > 0 || -inductor_current > inductor_current_max) {
+    else if (lvs_port.src_current_margin() > 0 || -inductor_current > inductor_current_max) {
         state = DCDC_CONTROL_CC_LS;
         pwm_direction = BOOST_DUTY_POWER_DECREASE;
     }
-    else if (lvb->voltage < lvb->src_control_voltage() && -power > output_power_min) {
+    else if (lvb->voltage < lvs_port.src_control_voltage() && -power > output_power_min) {
         // input voltage below limit
         state = DCDC_CONTROL_CV_LS;
         pwm_direction = BOOST_DUTY_POWER_DECREASE;
@@ -164,7 +164,7 @@ __weak DcdcOperationMode Dcdc::check_start_conditions()
         return DCDC_MODE_OFF;
     }
 
-    if (lvb->sink_current_margin > 0 && lvb->voltage < lvb->sink_control_voltage()
+    if (lvs_port.sink_current_margin() > 0 && lvb->voltage < lvs_port.sink_control_voltage()
         && hvb->src_current_margin < 0 && hvb->voltage > hvb->src_control_voltage()
         && hvb->voltage * 0.85 > lvb->voltage)
     {
@@ -172,7 +172,7 @@ __weak DcdcOperationMode Dcdc::check_start_conditions()
     }
 
     if (hvb->sink_current_margin > 0 && hvb->voltage < hvb->sink_control_voltage()
-        && lvb->src_current_margin < 0 && lvb->voltage > lvb->src_control_voltage())
+        && lvs_port.src_current_margin() < 0 && lvb->voltage > lvs_port.src_control_voltage())
     {
         return DCDC_MODE_BOOST;
     }
@@ -290,7 +290,7 @@ __weak void Dcdc::control()
                         "LS: %.2fV (target %.2fV), %.2fA margin, "
                         "PWM: %.1f, dcdc_state: %d, pwm_direction: %d",
                         power, inductor_current, hvb->voltage, hvb->src_current_margin,
-                        lvb->voltage, lvb->sink_voltage_intercept, lvb->sink_current_margin,
+                        lvb->voltage, lvb->sink_voltage_intercept, lvs_port.sink_current_margin(),
                         half_bridge_get_duty_cycle() * 100.0, state, pwm_direction);
             }
             else {
@@ -144,6 +144,7 @@ public:
     // actual measurements
     DcBus *hvb;             ///< Pointer to DC bus at high voltage side
     DcBus *lvb;             ///< Pointer to DC bus at low voltage (inductor) side
+    PowerPort lvs_port;     ///< Port of the DC/DC at the low voltage bus (e.g. for margins)
     float inductor_current; ///< Inductor current
     float power;            ///< Low-side power
     float temp_mosfets;     ///< MOSFET temperature measurement (if existing)
@@ -10,97 +10,119 @@
 
 #include <math.h> // for fabs function
 #include <stdio.h>
+#include <string.h>
 
+#include "event_log.h"
 #include "helper.h"
 #include "setup.h"
 
+const float hist_c_rate_limits[HIST_C_RATE_BINS - 1] = {
+    -1.0, -0.5, -0.2, -0.1, -0.05, -0.02, -0.01, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0,
+};
+
+static inline void hist_count(uint32_t *bins, int num_bins, int bin)
+{
+    if (bin < 0) {
+        bin = 0;
+    }
+    else if (bin >= num_bins) {
+        bin = num_bins - 1;
+    }
+
+    if (bins[bin] < UINT32_MAX) {
+        bins[bin]++;
+    }
+}
+
+/*
+ * Histogram bin of a value scaled to bin units
+ *
+ * Clamped before the conversion to int, as converting NaN or out-of-range floats is undefined
+ * behavior. NaN (e.g. from a failed sensor reading) is counted in the first bin.
+ */
+static inline int hist_bin(float value, int num_bins)
+{
+    if (!(value >= 0)) {
+        return 0;
+    }
+    else if (value >= num_bins) {
+        return num_bins - 1;
+    }
+    return (int)value;
+}
+
 //----------------------------------------------------------------------------
 // must be called exactly once per second, otherwise energy calculation gets wrong
 void DeviceStatus::update_energy()
 {
-    // static variables so that it is not reset for each function call
-    static int seconds_zero_solar = 0;
-
-    // stores the input/output energy status of previous day and to add
-    // xxx_day_Wh only once per day and increase accuracy
-    static uint32_t solar_in_total_Wh_prev;
-    static uint32_t load_out_total_Wh_prev;
-    static uint32_t bat_chg_total_Wh_prev;
-    static uint32_t bat_dis_total_Wh_prev;
-#if CONFIG_HV_TERMINAL_NANOGRID
-    static uint32_t grid_import_total_Wh_prev;
-    static uint32_t grid_export_total_Wh_prev;
-#endif
-
-    static bool first_call = true;
-    if (first_call) {
+    if (!total_mWs_prev_valid) {
         // initialize values with values we got from EEPROM
-        solar_in_total_Wh_prev = solar_in_total_Wh;
-        load_out_total_Wh_prev = load_out_total_Wh;
-        bat_chg_total_Wh_prev = bat_chg_total_Wh;
-        bat_dis_total_Wh_prev = bat_dis_total_Wh;
+        solar_in_total_mWs_prev = solar_in_total_Wh * ENERGY_MWS_PER_WH;
+        load_out_total_mWs_prev = load_out_total_Wh * ENERGY_MWS_PER_WH;
+        bat_chg_total_mWs_prev = bat_chg_total_Wh * ENERGY_MWS_PER_WH;
+        bat_dis_total_mWs_prev = bat_dis_total_Wh * ENERGY_MWS_PER_WH;
 #if CONFIG_HV_TERMINAL_NANOGRID
-        grid_import_total_Wh_prev = grid_import_total_Wh;
-        grid_export_total_Wh_prev = grid_export_total_Wh;
+        grid_import_total_mWs_prev = grid_import_total_Wh * ENERGY_MWS_PER_WH;
+        grid_export_total_mWs_prev = grid_export_total_Wh * ENERGY_MWS_PER_WH;
 #endif
-        first_call = false;
+        total_mWs_prev_valid = true;
     }
 
+    bool solar_available = false;
 #if CONFIG_HV_TERMINAL_SOLAR || CONFIG_LV_TERMINAL_SOLAR || CONFIG_PWM_TERMINAL_SOLAR
 #if CONFIG_HV_TERMINAL_SOLAR || CONFIG_LV_TERMINAL_SOLAR
-    if (solar_terminal.bus->voltage < bat_terminal.bus->voltage) {
+    solar_available = solar_terminal.bus->voltage >= bat_terminal.bus->voltage;
 #else
-    if (pwm_switch.ext_voltage < bat_terminal.bus->voltage) {
+    solar_available = pwm_switch.ext_voltage >= bat_terminal.bus->voltage;
 #endif
-        seconds_zero_solar += 1;
-    }
-    else {
-        // solar voltage > battery voltage after 5 hours of night time means sunrise in the morning
-        // --> reset daily energy counters
-        if (seconds_zero_solar > 60 * 60 * 5) {
-            day_counter++;
-            solar_in_total_Wh_prev = solar_in_total_Wh;
-            load_out_total_Wh_prev = load_out_total_Wh;
-            bat_chg_total_Wh_prev = bat_chg_total_Wh;
-            bat_dis_total_Wh_prev = bat_dis_total_Wh;
-#if CONFIG_HV_TERMINAL_NANOGRID
-            grid_import_total_Wh_prev = grid_import_total_Wh;
-            grid_export_total_Wh_prev = grid_export_total_Wh;
+    seconds_zero_solar = solar_available ? 0 : seconds_zero_solar + 1;
+#endif
+
+    // new day (sunrise or expected sunrise time if no sun) --> reset daily energy counters
+    int64_t pos_mWs, neg_mWs;
+    if (day_detector.update(solar_available, timestamp)) {
+        day_counter++;
+        bat_terminal.reset_energy(&pos_mWs, &neg_mWs);
+        bat_chg_total_mWs_prev += pos_mWs;
+        bat_dis_total_mWs_prev += neg_mWs;
+#if CONFIG_HV_TERMINAL_SOLAR || CONFIG_LV_TERMINAL_SOLAR || CONFIG_PWM_TERMINAL_SOLAR
+        solar_terminal.reset_energy(NULL, &neg_mWs);
+        solar_in_total_mWs_prev += neg_mWs;
 #endif
-            solar_terminal.neg_energy_Wh = 0.0;
 #if BOARD_HAS_LOAD_OUTPUT
-            load.pos_energy_Wh = 0.0;
+        load.reset_energy(&pos_mWs, NULL);
+        load_out_total_mWs_prev += pos_mWs;
 #endif
-            bat_terminal.pos_energy_Wh = 0.0;
-            bat_terminal.neg_energy_Wh = 0.0;
 #if CONFIG_HV_TERMINAL_NANOGRID
-            grid_terminal.pos_energy_Wh = 0.0;
-            grid_terminal.neg_energy_Wh = 0.0;
+        grid_terminal.reset_energy(&pos_mWs, &neg_mWs);
+        grid_import_total_mWs_prev += neg_mWs;
+        grid_export_total_mWs_prev += pos_mWs;
 #endif
-        }
-        seconds_zero_solar = 0;
     }
-#endif
 
-    bat_chg_total_Wh =
-        bat_chg_total_Wh_prev + (bat_terminal.pos_energy_Wh > 0 ? bat_terminal.pos_energy_Wh : 0);
-    bat_dis_total_Wh =
-        bat_dis_total_Wh_prev + (bat_terminal.neg_energy_Wh > 0 ? bat_terminal.neg_energy_Wh : 0);
+    // counters are updated by the control thread, so only consistent copies are used
+    bat_terminal.update_energy_Wh();
+    bat_terminal.get_energy(&pos_mWs, &neg_mWs);
+    bat_chg_total_Wh = (bat_chg_total_mWs_prev + pos_mWs) / ENERGY_MWS_PER_WH;
+    bat_dis_total_Wh = (bat_dis_total_mWs_prev + neg_mWs) / ENERGY_MWS_PER_WH;
 
 #if CONFIG_HV_TERMINAL_SOLAR || CONFIG_LV_TERMINAL_SOLAR || CONFIG_PWM_TERMINAL_SOLAR
-    solar_in_total_Wh = solar_in_total_Wh_prev
-                        + (solar_terminal.neg_energy_Wh > 0 ? solar_terminal.neg_energy_Wh : 0);
+    solar_terminal.update_energy_Wh();
+    solar_terminal.get_energy(&pos_mWs, &neg_mWs);
+    solar_in_total_Wh = (solar_in_total_mWs_prev + neg_mWs) / ENERGY_MWS_PER_WH;
 #endif
 
 #if BOARD_HAS_LOAD_OUTPUT
-    load_out_total_Wh = load_out_total_Wh_prev + (load.pos_energy_Wh > 0 ? load.pos_energy_Wh : 0);
+    load.update_energy_Wh();
+    load.get_energy(&pos_mWs, &neg_mWs);
+    load_out_total_Wh = (load_out_total_mWs_prev + pos_mWs) / ENERGY_MWS_PER_WH;
 #endif
 
 #if CONFIG_HV_TERMINAL_NANOGRID
-    grid_import_total_Wh = grid_import_total_Wh_prev
-                           + (grid_terminal.neg_energy_Wh > 0 ? grid_terminal.neg_energy_Wh : 0);
-    grid_export_total_Wh = grid_export_total_Wh_prev
-                           + (grid_terminal.pos_energy_Wh > 0 ? grid_terminal.pos_energy_Wh : 0);
+    grid_terminal.update_energy_Wh();
+    grid_terminal.get_energy(&pos_mWs, &neg_mWs);
+    grid_import_total_Wh = (grid_import_total_mWs_prev + neg_mWs) / ENERGY_MWS_PER_WH;
+    grid_export_total_Wh = (grid_export_total_mWs_prev + pos_mWs) / ENERGY_MWS_PER_WH;
 #endif
 }
 
@@ -162,3 +184,53 @@ void DeviceStatus::update_min_max_values()
         int_temp_max = internal_temp;
     }
 }
+
+void DeviceStatus::update_histograms()
+{
+    float voltage = bat_terminal.bus->voltage / bat_terminal.bus->series_multiplier;
+    float range = bat_conf.absolute_max_voltage - bat_conf.absolute_min_voltage;
+    if (range > 0) {
+        float scaled = (voltage - bat_conf.absolute_min_voltage) / range * HIST_VOLTAGE_BINS;
+        hist_count(bat_hist.voltage, HIST_VOLTAGE_BINS, hist_bin(scaled, HIST_VOLTAGE_BINS));
+    }
+
+    hist_count(bat_hist.soc, HIST_SOC_BINS, charger.soc / 10);
+
+    hist_count(bat_hist.temp, HIST_TEMP_BINS,
+               hist_bin((charger.bat_temperature + 20) / 5, HIST_TEMP_BINS));
+
+    if (bat_conf.nominal_capacity > 0) {
+        float c_rate = bat_terminal.current / bat_conf.nominal_capacity;
+        int bin = 0;
+        // fixed number of comparisons, as the limits are not equally spaced
+        for (int i = 0; i < HIST_C_RATE_BINS - 1; i++) {
+            bin += (c_rate >= hist_c_rate_limits[i]);
+        }
+        hist_count(bat_hist.c_rate, HIST_C_RATE_BINS, bin);
+    }
+}
+
+void DeviceStatus::reset_histograms()
+{
+    memset(&bat_hist, 0, sizeof(bat_hist));
+}
+
+void DeviceStatus::set_error(uint32_t e)
+{
+    uint32_t new_errors = e & ~error_flags;
+    error_flags |= e;
+
+    if (new_errors) {
+        event_log_record(EVENT_SOURCE_DEVICE, new_errors, true, bat_terminal.current);
+    }
+}
+
+void DeviceStatus::clear_error(uint32_t e)
+{
+    uint32_t cleared_errors = e & error_flags;
+    error_flags &= ~e;
+
+    if (cleared_errors) {
+        event_log_record(EVENT_SOURCE_DEVICE, cleared_errors, false, bat_terminal.current);
+    }
+}
@@ -14,12 +14,57 @@
  */
 
 #include "bat_charger.h"
+#include "day_detector.h"
 #include "dcdc.h"
 #include "load.h"
 #include "power_port.h"
 #include <stdbool.h>
 #include <stdint.h>
 
+/**
+ * Number of bins of the battery voltage histogram
+ *
+ * The bins divide the range between absolute min and max voltage of the battery configuration
+ * into equal parts. Voltages outside this range are counted in the first or last bin.
+ */
+#define HIST_VOLTAGE_BINS 16
+
+/**
+ * Number of bins of the SOC histogram (10% per bin)
+ */
+#define HIST_SOC_BINS 10
+
+/**
+ * Number of bins of the battery temperature histogram
+ *
+ * Bins have a width of 5°C starting from -20°C. The first bin includes all temperatures below
+ * -15°C and the last bin all temperatures above 55°C.
+ */
+#define HIST_TEMP_BINS 16
+
+/**
+ * Number of bins of the C-rate histogram (see hist_c_rate_limits)
+ */
+#define HIST_C_RATE_BINS 15
+
+/**
+ * Time the battery spent in different operating conditions (s)
+ *
+ * All counters saturate at UINT32_MAX.
+ */
+struct BatteryHistograms
+{
+    uint32_t voltage[HIST_VOLTAGE_BINS];
+    uint32_t soc[HIST_SOC_BINS];
+    uint32_t temp[HIST_TEMP_BINS];
+    uint32_t c_rate[HIST_C_RATE_BINS]; ///< Negative C-rates (discharging) in the first bins
+};
+
+/**
+ * Upper limits of the C-rate histogram bins except for the last bin (1/h)
+ */
+extern const float hist_c_rate_limits[HIST_C_RATE_BINS - 1];
+
 /** Error Flags
  *
  * When adding new flags, please make sure to use only up to 32 errors
@@ -101,6 +146,13 @@ enum ErrorFlag
      */
     ERR_PWM_SWITCH_OVERVOLTAGE = 1U << 16,
 
+    /** Number of series batteries could not be detected
+     *
+     * Set in Charger::detect_num_batteries() if a fallback multiplier is used after a timeout,
+     * cleared as soon as the number of batteries was detected.
+     */
+    ERR_BAT_NUM_UNKNOWN = 1U << 17,
+
     /** Mask to catch all error flags (up to 32 errors)
      */
     ERR_ANY_ERROR = UINT32_MAX,
@@ -121,6 +173,14 @@ public:
      */
     void update_min_max_values();
 
+    /** Updates the battery histograms (must be called exactly once per second)
+     */
+    void update_histograms();
+
+    /** Resets all battery histogram counters to 0
+     */
+    void reset_histograms();
+
     // total energy
     uint32_t bat_chg_total_Wh;
     uint32_t bat_dis_total_Wh;
@@ -146,27 +206,50 @@ public:
 
     uint32_t day_counter;
 
+    // total energy at the start of the current day (mWs), so that the daily energy of the ports
+    // can be added without truncation of the Wh values
+    int64_t bat_chg_total_mWs_prev;
+    int64_t bat_dis_total_mWs_prev;
+    int64_t solar_in_total_mWs_prev;
+    int64_t load_out_total_mWs_prev;
+#if CONFIG_HV_TERMINAL_NANOGRID
+    int64_t grid_import_total_mWs_prev;
+    int64_t grid_export_total_mWs_prev;
+#endif
+    bool total_mWs_prev_valid = false; ///< False until initialized from the total Wh values
+
+    DayDetector day_detector; ///< Determines the start of a new day for the daily counters
+
+    BatteryHistograms bat_hist;
+
+    /**
+     * Time since the solar voltage dropped below the battery voltage (s)
+     *
+     * Reset to 0 as soon as the sun rises again. Used to detect dusk and dawn.
+     */
+    uint32_t seconds_zero_solar = 0;
+
     // instantaneous device-level data
     uint32_t error_flags; ///< Currently detected errors
     float internal_temp;  ///< Internal temperature (measured in MCU)
 
     /**
      * @brief sets one or more error flags in device state
+     *
+     * Newly set flags are recorded in the event log. Can be called from an ISR.
+     *
      * @param e a single ErrorFlag or "bitwise ORed" ERR_XXX | ERR_YYY
      */
-    inline void set_error(uint32_t e)
-    {
-        error_flags |= e;
-    }
+    void set_error(uint32_t e);
 
     /**
      * @brief clears one or more error flags in device state
+     *
+     * Flags which were set before are recorded in the event log.
+     *
      * @param e a single ErrorFlag or "bitwise ORed" ERR_XXX | ERR_YYY
      */
-    void clear_error(uint32_t e)
-    {
-        error_flags &= ~e;
-    }
+    void clear_error(uint32_t e);
 
     /**
      * @brief queries one or more error flags in device state
@@ -0,0 +1,494 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "energy_log.h"
+
+#include <zephyr/kernel.h>
+
+#include "crc_engine.h"
+#include "data_storage.h"
+#include "setup.h"
+
+#include <string.h>
+
+// end of the hourly records is determined by the timestamp
+#define SECONDS_PER_HOUR (60 * 60)
+
+// larger changes of the timestamp between two samples are caused by setting the clock (s)
+#define CLOCK_STEP_MAX 10
+
+uint32_t energy_log_first_seq[ENERGY_LOG_NUM_TYPES];
+uint32_t energy_log_next_seq[ENERGY_LOG_NUM_TYPES];
+
+static uint16_t energy_diff(uint32_t total, uint32_t total_start)
+{
+    // totals may have been reset via ThingSet
+    if (total < total_start) {
+        return 0;
+    }
+    return (total - total_start > UINT16_MAX) ? UINT16_MAX : total - total_start;
+}
+
+static uint16_t voltage_mV(float voltage)
+{
+    if (voltage <= 0) {
+        return 0;
+    }
+    return (voltage * 1000 > UINT16_MAX) ? UINT16_MAX : voltage * 1000;
+}
+
+static int8_t temp_degC(float temp)
+{
+    if (temp > INT8_MAX) {
+        return INT8_MAX;
+    }
+    else if (temp < INT8_MIN) {
+        return INT8_MIN;
+    }
+    return temp;
+}
+
+void EnergyLog::start_record(EnergyLogType type, const EnergyLogSample &sample)
+{
+    EnergyLogRecord *rec = &running[type];
+
+    memset(rec, 0, sizeof(EnergyLogRecord));
+    rec->day = sample.day;
+    rec->bat_voltage_min_mV = voltage_mV(sample.bat_voltage);
+    rec->bat_voltage_max_mV = rec->bat_voltage_min_mV;
+    rec->soc = ENERGY_LOG_SOC_UNKNOWN;
+    rec->bat_temp_max = temp_degC(sample.bat_temp);
+    rec->int_temp_max = temp_degC(sample.int_temp);
+    rec->mosfet_temp_max = temp_degC(sample.mosfet_temp);
+
+    start[type] = sample;
+}
+
+void EnergyLog::finish_record(EnergyLogType type, const EnergyLogSample &sample)
+{
+    EnergyLogRecord *rec = &running[type];
+
+    rec->timestamp = sample.timestamp;
+    rec->solar_in_Wh = energy_diff(sample.solar_in_total_Wh, start[type].solar_in_total_Wh);
+    rec->load_out_Wh = energy_diff(sample.load_out_total_Wh, start[type].load_out_total_Wh);
+    rec->bat_chg_Wh = energy_diff(sample.bat_chg_total_Wh, start[type].bat_chg_total_Wh);
+    rec->bat_dis_Wh = energy_diff(sample.bat_dis_total_Wh, start[type].bat_dis_total_Wh);
+    if (type == ENERGY_LOG_HOURLY) {
+        rec->soc = sample.soc;
+    }
+
+    completed[type] = *rec;
+}
+
+uint32_t EnergyLog::update(const EnergyLogSample &sample)
+{
+    uint32_t completed_types = 0;
+
+    if (!initialized) {
+        start_record(ENERGY_LOG_HOURLY, sample);
+        start_record(ENERGY_LOG_DAILY, sample);
+        last_timestamp = sample.timestamp;
+        initialized = true;
+        return 0;
+    }
+
+    if (sample.timestamp - last_timestamp > CLOCK_STEP_MAX) {
+        // close the running record at the previous time, as the hours don't match anymore
+        EnergyLogSample end = sample;
+        end.timestamp = last_timestamp;
+        finish_record(ENERGY_LOG_HOURLY, end);
+        start_record(ENERGY_LOG_HOURLY, sample);
+        completed_types |= 1U << ENERGY_LOG_HOURLY;
+    }
+    last_timestamp = sample.timestamp;
+
+    uint16_t bat_voltage = voltage_mV(sample.bat_voltage);
+    int8_t bat_temp = temp_degC(sample.bat_temp);
+    int8_t int_temp = temp_degC(sample.int_temp);
+    int8_t mosfet_temp = temp_degC(sample.mosfet_temp);
+
+    for (int i = 0; i < ENERGY_LOG_NUM_TYPES; i++) {
+        EnergyLogRecord *rec = &running[i];
+        if (bat_voltage < rec->bat_voltage_min_mV) {
+            rec->bat_voltage_min_mV = bat_voltage;
+        }
+        if (bat_voltage > rec->bat_voltage_max_mV) {
+            rec->bat_voltage_max_mV = bat_voltage;
+        }
+        if (bat_temp > rec->bat_temp_max) {
+            rec->bat_temp_max = bat_temp;
+        }
+        if (int_temp > rec->int_temp_max) {
+            rec->int_temp_max = int_temp;
+        }
+        if (mosfet_temp > rec->mosfet_temp_max) {
+            rec->mosfet_temp_max = mosfet_temp;
+        }
+    }
+
+    // delay prevents detection of dusk during short clouded periods
+    if (sample.seconds_zero_solar == ENERGY_LOG_DUSK_DELAY) {
+        running[ENERGY_LOG_DAILY].soc = sample.soc;
+    }
+
+    uint32_t hour = sample.timestamp / SECONDS_PER_HOUR;
+    if (hour != start[ENERGY_LOG_HOURLY].timestamp / SECONDS_PER_HOUR) {
+        finish_record(ENERGY_LOG_HOURLY, sample);
+        start_record(ENERGY_LOG_HOURLY, sample);
+        completed_types |= 1U << ENERGY_LOG_HOURLY;
+    }
+
+    if (sample.day != start[ENERGY_LOG_DAILY].day) {
+        finish_record(ENERGY_LOG_DAILY, sample);
+        start_record(ENERGY_LOG_DAILY, sample);
+        completed_types |= 1U << ENERGY_LOG_DAILY;
+    }
+
+    return completed_types;
+}
+
+#if CONFIG_ENERGY_LOG
+
+#include <zephyr/drivers/flash.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(energy_log, CONFIG_DATA_STORAGE_LOG_LEVEL);
+
+#define LOG_PARTITION log_partition
+
+/*
+ * Minimum number of daily records kept in the flash (the remaining space is used for hourly
+ * records)
+ */
+#define DAILY_RECORDS_MIN 400
+
+/*
+ * Circular buffer of records in a part of the log partition
+ *
+ * The records are appended with increasing sequence numbers. Before a new sector is used, it is
+ * erased, so the oldest records are dropped sector-wise.
+ */
+struct LogRing
+{
+    off_t offset;              // offset of the ring inside the partition
+    uint32_t num_slots;        // total number of record slots
+    uint32_t slots_per_sector; // number of record slots per erasable sector
+    uint32_t head;             // slot for next record
+};
+
+static const struct flash_area *log_area;
+static LogRing rings[ENERGY_LOG_NUM_TYPES];
+static bool log_initialized = false;
+
+static EnergyLog energy_log;
+
+K_MUTEX_DEFINE(log_lock);
+
+/*
+ * Completed record waiting to be stored by the storage thread
+ */
+struct QueuedRecord
+{
+    uint32_t type;
+    EnergyLogRecord rec;
+};
+
+// a few records, as the storage thread may be busy with other data (e.g. NVS garbage collection)
+#define LOG_QUEUE_SIZE 4
+
+K_MSGQ_DEFINE(log_queue, sizeof(QueuedRecord), LOG_QUEUE_SIZE, 4);
+
+static int slot_read(const LogRing *ring, uint32_t slot, EnergyLogRecord *rec)
+{
+    return flash_area_read(log_area, ring->offset + slot * sizeof(EnergyLogRecord), rec,
+                           sizeof(EnergyLogRecord));
+}
+
+static bool record_valid(const EnergyLogRecord *rec)
+{
+    return rec->crc == crc_engine_crc32(rec, offsetof(EnergyLogRecord, crc));
+}
+
+static bool record_erased(const EnergyLogRecord *rec)
+{
+    const uint8_t *bytes = (const uint8_t *)rec;
+    for (size_t i = 0; i < sizeof(EnergyLogRecord); i++) {
+        if (bytes[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Finds head, oldest and newest record by reading only the first record of each sector and all
+ * records of the sector containing the newest record.
+ */
+static void ring_scan(int type)
+{
+    LogRing *ring = &rings[type];
+    EnergyLogRecord rec;
+    uint32_t num_sectors = ring->num_slots / ring->slots_per_sector;
+    uint32_t newest_sector = 0;
+    uint32_t newest_seq = 0;
+    bool found = false;
+
+    for (uint32_t sector = 0; sector < num_sectors; sector++) {
+        if (slot_read(ring, sector * ring->slots_per_sector, &rec) == 0 && record_valid(&rec)
+            && (!found || rec.seq > newest_seq))
+        {
+            newest_sector = sector;
+            newest_seq = rec.seq;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        ring->head = 0;
+        energy_log_first_seq[type] = 0;
+        energy_log_next_seq[type] = 0;
+        return;
+    }
+
+    // head is behind the last used slot, even if it contains a torn record
+    uint32_t first_slot = newest_sector * ring->slots_per_sector;
+    ring->head = first_slot + 1;
+    for (uint32_t slot = first_slot + 1; slot < first_slot + ring->slots_per_sector; slot++) {
+        if (slot_read(ring, slot, &rec) != 0 || record_erased(&rec)) {
+            continue;
+        }
+        ring->head = slot + 1;
+        if (record_valid(&rec) && rec.seq > newest_seq) {
+            newest_seq = rec.seq;
+        }
+    }
+    ring->head %= ring->num_slots;
+    energy_log_next_seq[type] = newest_seq + 1;
+
+    // oldest record is at the start of the following sector if the ring was wrapped around,
+    // otherwise at the start of the ring
+    uint32_t next_sector = (newest_sector + 1) % num_sectors;
+    if (slot_read(ring, next_sector * ring->slots_per_sector, &rec) == 0 && record_valid(&rec)) {
+        energy_log_first_seq[type] = rec.seq;
+    }
+    else if (slot_read(ring, 0, &rec) == 0 && record_valid(&rec)) {
+        energy_log_first_seq[type] = rec.seq;
+    }
+    else {
+        energy_log_first_seq[type] = newest_seq;
+    }
+}
+
+static int ring_append(int type, EnergyLogRecord *rec)
+{
+    LogRing *ring = &rings[type];
+    off_t slot_offset = ring->offset + ring->head * sizeof(EnergyLogRecord);
+    int err;
+
+    if (ring->head % ring->slots_per_sector == 0) {
+        err = flash_area_erase(log_area, slot_offset,
+                               ring->slots_per_sector * sizeof(EnergyLogRecord));
+        if (err) {
+            return err;
+        }
+
+        // erased sector may have contained the oldest records
+        EnergyLogRecord next;
+        uint32_t next_slot = (ring->head + ring->slots_per_sector) % ring->num_slots;
+        if (next_slot != ring->head && slot_read(ring, next_slot, &next) == 0
+            && record_valid(&next) && next.seq > energy_log_first_seq[type])
+        {
+            energy_log_first_seq[type] = next.seq;
+        }
+    }
+
+    rec->seq = energy_log_next_seq[type];
+    rec->crc = crc_engine_crc32(rec, offsetof(EnergyLogRecord, crc));
+
+    err = flash_area_write(log_area, slot_offset, rec, sizeof(EnergyLogRecord));
+    if (err) {
+        return err;
+    }
+
+    ring->head = (ring->head + 1) % ring->num_slots;
+    energy_log_next_seq[type]++;
+    return 0;
+}
+
+/*
+ * Returns the slot of the record with given sequence number or -1 if not found
+ */
+static int ring_find(int type, uint32_t seq)
+{
+    LogRing *ring = &rings[type];
+    EnergyLogRecord rec;
+
+    uint32_t distance = (energy_log_next_seq[type] - seq) % ring->num_slots;
+    uint32_t slot = (ring->head + ring->num_slots - distance) % ring->num_slots;
+
+    // torn records between the requested record and the head move it to an older slot
+    for (uint32_t i = 0; i < ring->slots_per_sector; i++) {
+        if (slot_read(ring, slot, &rec) == 0 && record_valid(&rec)) {
+            if (rec.seq == seq) {
+                return slot;
+            }
+            else if (rec.seq < seq) {
+                return -1;
+            }
+        }
+        slot = (slot + ring->num_slots - 1) % ring->num_slots;
+    }
+    return -1;
+}
+
+void energy_log_init()
+{
+    struct flash_pages_info page_info;
+    int err;
+
+    err = flash_area_open(FIXED_PARTITION_ID(LOG_PARTITION), &log_area);
+    if (err) {
+        LOG_ERR("Unable to open log partition: %d", err);
+        return;
+    }
+
+    err = flash_get_page_info_by_offs(flash_area_get_device(log_area), log_area->fa_off,
+                                      &page_info);
+    if (err) {
+        LOG_ERR("Unable to get flash page info");
+        return;
+    }
+
+    // first sector is reserved for the storage layout marker (see data_storage.cpp)
+    uint32_t slots_per_sector = page_info.size / sizeof(EnergyLogRecord);
+    uint32_t num_sectors = log_area->fa_size / page_info.size - 1;
+
+    // one additional sector, as a full sector is dropped when the ring wraps around
+    uint32_t daily_sectors = DIV_ROUND_UP(DAILY_RECORDS_MIN, slots_per_sector) + 1;
+    if (num_sectors < daily_sectors + 2) {
+        LOG_ERR("Log partition too small");
+        return;
+    }
+
+    rings[ENERGY_LOG_DAILY].offset = page_info.size;
+    rings[ENERGY_LOG_DAILY].num_slots = daily_sectors * slots_per_sector;
+    rings[ENERGY_LOG_HOURLY].offset = (1 + daily_sectors) * page_info.size;
+    rings[ENERGY_LOG_HOURLY].num_slots = (num_sectors - daily_sectors) * slots_per_sector;
+
+    for (int i = 0; i < ENERGY_LOG_NUM_TYPES; i++) {
+        rings[i].slots_per_sector = slots_per_sector;
+        ring_scan(i);
+        LOG_INF("Energy log %d: records %u to %u", i, energy_log_first_seq[i],
+                energy_log_next_seq[i]);
+    }
+
+    log_initialized = true;
+}
+
+void energy_log_update()
+{
+    EnergyLogSample sample = {};
+
+    sample.timestamp = timestamp;
+    sample.day = dev_stat.day_counter;
+    sample.seconds_zero_solar = dev_stat.seconds_zero_solar;
+    sample.solar_in_total_Wh = dev_stat.solar_in_total_Wh;
+    sample.load_out_total_Wh = dev_stat.load_out_total_Wh;
+    sample.bat_chg_total_Wh = dev_stat.bat_chg_total_Wh;
+    sample.bat_dis_total_Wh = dev_stat.bat_dis_total_Wh;
+    sample.bat_voltage = bat_terminal.bus->voltage;
+    sample.bat_temp = charger.bat_temperature;
+    sample.int_temp = dev_stat.internal_temp;
+#if BOARD_HAS_DCDC
+    sample.mosfet_temp = dcdc.temp_mosfets;
+#endif
+    sample.soc = charger.soc;
+
+    uint32_t completed = energy_log.update(sample);
+
+    if (!log_initialized || completed == 0) {
+        return;
+    }
+
+    for (int i = 0; i < ENERGY_LOG_NUM_TYPES; i++) {
+        if (completed & (1U << i)) {
+            QueuedRecord queued = { (uint32_t)i, energy_log.completed[i] };
+            if (k_msgq_put(&log_queue, &queued, K_NO_WAIT) != 0) {
+                LOG_ERR("Energy log queue full, record dropped");
+            }
+        }
+    }
+
+    data_storage_notify();
+}
+
+void energy_log_flush()
+{
+    QueuedRecord queued;
+
+    while (k_msgq_get(&log_queue, &queued, K_NO_WAIT) == 0) {
+        k_mutex_lock(&log_lock, K_FOREVER);
+        int err = ring_append(queued.type, &queued.rec);
+        k_mutex_unlock(&log_lock);
+        if (err) {
+            LOG_ERR("Energy log write failed: %d", err);
+        }
+    }
+}
+
+int energy_log_read(uint16_t type, uint32_t seq, EnergyLogRecord *buf, int max_records,
+                    uint32_t *first_seq)
+{
+    int num = 0;
+
+    if (!log_initialized || type >= ENERGY_LOG_NUM_TYPES) {
+        return 0;
+    }
+
+    k_mutex_lock(&log_lock, K_FOREVER);
+
+    if (seq < energy_log_first_seq[type]) {
+        seq = energy_log_first_seq[type];
+    }
+    *first_seq = seq;
+
+    int slot = (seq < energy_log_next_seq[type]) ? ring_find(type, seq) : -1;
+    if (slot >= 0) {
+        LogRing *ring = &rings[type];
+        while (num < max_records && (uint32_t)slot != ring->head) {
+            // skip torn records
+            if (slot_read(ring, slot, &buf[num]) == 0 && record_valid(&buf[num])) {
+                num++;
+            }
+            slot = (slot + 1) % ring->num_slots;
+        }
+    }
+
+    k_mutex_unlock(&log_lock);
+
+    return num;
+}
+
+#else
+
+void energy_log_init()
+{}
+
+void energy_log_update()
+{}
+
+void energy_log_flush()
+{}
+
+int energy_log_read(uint16_t type, uint32_t seq, EnergyLogRecord *buf, int max_records,
+                    uint32_t *first_seq)
+{
+    return 0;
+}
+
+#endif /* CONFIG_ENERGY_LOG */
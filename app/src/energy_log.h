@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ENERGY_LOG_H
+#define ENERGY_LOG_H
+
+/** @file
+ *
+ * @brief Historical log of energy yield and battery data with hourly and daily resolution
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Time after the solar voltage dropped below the battery voltage until dusk is detected (s)
+ */
+#define ENERGY_LOG_DUSK_DELAY (10 * 60)
+
+/**
+ * SOC value used in records without detected dusk
+ */
+#define ENERGY_LOG_SOC_UNKNOWN 0xFF
+
+/**
+ * Resolution of the log records
+ */
+enum EnergyLogType
+{
+    ENERGY_LOG_HOURLY = 0, ///< Record completed at the end of each hour or if the clock is set
+    ENERGY_LOG_DAILY,      ///< Record completed at sunrise (increase of day counter)
+    ENERGY_LOG_NUM_TYPES
+};
+
+/**
+ * Log record with the data of one hour or one day
+ *
+ * The records are stored and transferred via ThingSet in this binary format (little-endian, 32
+ * bytes), so the layout must not be changed without changing the data objects version.
+ */
+struct __attribute__((packed)) EnergyLogRecord
+{
+    uint32_t seq;                ///< Sequence number, increased by 1 for each record
+    uint32_t timestamp;          ///< Timestamp at the end of the record (s)
+    uint32_t day;                ///< Day counter at the start of the record
+    uint16_t solar_in_Wh;        ///< Solar energy input
+    uint16_t load_out_Wh;        ///< Load output energy
+    uint16_t bat_chg_Wh;         ///< Battery charging energy
+    uint16_t bat_dis_Wh;         ///< Battery discharging energy
+    uint16_t bat_voltage_min_mV; ///< Minimum battery voltage
+    uint16_t bat_voltage_max_mV; ///< Maximum battery voltage
+    uint8_t soc;                 ///< SOC at the end of the hour or at dusk of the day (%)
+    int8_t bat_temp_max;         ///< Maximum battery temperature (°C)
+    int8_t int_temp_max;         ///< Maximum internal temperature (°C)
+    int8_t mosfet_temp_max;      ///< Maximum MOSFET temperature (°C)
+    uint32_t crc;                ///< CRC32 of all previous bytes
+};
+
+/**
+ * Measurement values passed to EnergyLog::update once per second
+ */
+struct EnergyLogSample
+{
+    uint32_t timestamp;
+    uint32_t day;
+    uint32_t seconds_zero_solar;
+    uint32_t solar_in_total_Wh;
+    uint32_t load_out_total_Wh;
+    uint32_t bat_chg_total_Wh;
+    uint32_t bat_dis_total_Wh;
+    float bat_voltage;
+    float bat_temp;
+    float int_temp;
+    float mosfet_temp;
+    uint16_t soc;
+};
+
+/**
+ * Aggregation of the measurement values into hourly and daily log records
+ */
+class EnergyLog
+{
+public:
+    /**
+     * Add new sample, must be called exactly once per second
+     *
+     * @param sample Actual measurement values
+     *
+     * @returns Bitmask with the types of records completed during this call (1 << EnergyLogType)
+     */
+    uint32_t update(const EnergyLogSample &sample);
+
+    /**
+     * Last completed record of each type (sequence number and CRC are not set)
+     */
+    EnergyLogRecord completed[ENERGY_LOG_NUM_TYPES];
+
+private:
+    void start_record(EnergyLogType type, const EnergyLogSample &sample);
+
+    void finish_record(EnergyLogType type, const EnergyLogSample &sample);
+
+    /**
+     * Records currently filled with data
+     */
+    EnergyLogRecord running[ENERGY_LOG_NUM_TYPES];
+
+    /**
+     * Energy totals at the start of the running records
+     */
+    EnergyLogSample start[ENERGY_LOG_NUM_TYPES];
+
+    /**
+     * Timestamp of the previous sample to detect setting of the clock
+     */
+    uint32_t last_timestamp;
+
+    bool initialized = false;
+};
+
+/**
+ * Initialize the log storage in the flash partition and find the latest records
+ */
+void energy_log_init();
+
+/**
+ * Update the log with actual measurement values
+ *
+ * Completed records are queued and the storage thread is woken up to store them, so this
+ * function never blocks on flash erase or write operations.
+ *
+ * Must be called exactly once per second.
+ */
+void energy_log_update();
+
+/**
+ * Store the queued records in flash
+ *
+ * Called by the storage thread (see data_storage_notify).
+ */
+void energy_log_flush();
+
+/**
+ * Read a chunk of stored records
+ *
+ * @param type Resolution of the records (EnergyLogType)
+ * @param seq Sequence number of the first requested record. If the record is not available
+ *            anymore, the chunk starts with the oldest available record.
+ * @param buf Buffer to store the records
+ * @param max_records Maximum number of records to be stored in the buffer
+ * @param first_seq Pointer to store the sequence number of the first record in the buffer
+ *
+ * @returns Number of records stored in the buffer
+ */
+int energy_log_read(uint16_t type, uint32_t seq, EnergyLogRecord *buf, int max_records,
+                    uint32_t *first_seq);
+
+/**
+ * Sequence number of the oldest stored record of each type
+ */
+extern uint32_t energy_log_first_seq[ENERGY_LOG_NUM_TYPES];
+
+/**
+ * Sequence number of the next record to be stored of each type
+ */
+extern uint32_t energy_log_next_seq[ENERGY_LOG_NUM_TYPES];
+
+#endif /* ENERGY_LOG_H */
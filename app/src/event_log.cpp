@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "event_log.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include <stddef.h>
+
+#include "crc_engine.h"
+#include "data_storage.h"
+#include "setup.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(event_log, CONFIG_DATA_STORAGE_LOG_LEVEL);
+
+uint32_t event_log_next_seq = 0;
+uint32_t event_log_dropped = 0;
+
+/*
+ * RAM buffer with multiple producers (threads and ISRs) and a single consumer (main thread)
+ *
+ * Producers reserve a slot by incrementing the write index with compare-and-swap. After the
+ * entry was written, the slot is marked as ready by storing the write index + 1, so the consumer
+ * never reads a partially written entry.
+ */
+static EventLogEntry ram_entries[EVENT_LOG_RAM_SIZE];
+static atomic_t ram_ready[EVENT_LOG_RAM_SIZE];
+static atomic_t ram_write_idx;
+static atomic_t ram_dropped;
+static uint32_t ram_read_idx;
+
+static inline uint32_t entry_crc(const EventLogEntry *entry)
+{
+    return crc_engine_crc32(entry, offsetof(EventLogEntry, crc));
+}
+
+void event_log_record(uint8_t source, uint32_t flags, bool active, float current)
+{
+    while (flags) {
+        uint8_t flag = __builtin_ctz(flags);
+        flags &= ~(1U << flag);
+
+        atomic_val_t idx;
+        do {
+            idx = atomic_get(&ram_write_idx);
+            if ((uint32_t)idx - ram_read_idx >= EVENT_LOG_RAM_SIZE) {
+                atomic_inc(&ram_dropped);
+                data_storage_notify();
+                return;
+            }
+        } while (!atomic_cas(&ram_write_idx, idx, idx + 1));
+
+        EventLogEntry *entry = &ram_entries[idx & (EVENT_LOG_RAM_SIZE - 1)];
+        entry->timestamp = timestamp;
+        entry->source = source;
+        entry->flag = flag;
+        entry->active = active;
+        entry->int_temp = dev_stat.internal_temp;
+        entry->bat_voltage = bat_terminal.bus->voltage;
+        entry->current = current;
+
+        atomic_set(&ram_ready[idx & (EVENT_LOG_RAM_SIZE - 1)], idx + 1);
+    }
+
+    data_storage_notify();
+}
+
+bool event_log_get(EventLogEntry *entry)
+{
+    uint32_t pos = ram_read_idx & (EVENT_LOG_RAM_SIZE - 1);
+
+    if ((uint32_t)atomic_get(&ram_ready[pos]) != ram_read_idx + 1) {
+        return false;
+    }
+
+    *entry = ram_entries[pos];
+
+    // slot may be reserved by a producer only after the read index was incremented
+    ram_read_idx++;
+    return true;
+}
+
+void event_log_init()
+{
+    EventLogEntry entry;
+    bool found = false;
+
+    for (uint32_t slot = 0; slot < DATA_STORAGE_EVENT_SLOTS; slot++) {
+        if (data_storage_event_read(slot, &entry, sizeof(entry)) == 0
+            && entry.crc == entry_crc(&entry) && entry.seq % DATA_STORAGE_EVENT_SLOTS == slot
+            && (!found || entry.seq >= event_log_next_seq))
+        {
+            event_log_next_seq = entry.seq + 1;
+            found = true;
+        }
+    }
+}
+
+void event_log_flush()
+{
+    EventLogEntry entry;
+
+    while (event_log_get(&entry)) {
+        entry.seq = event_log_next_seq;
+        entry.crc = entry_crc(&entry);
+
+        int err = data_storage_event_write(entry.seq % DATA_STORAGE_EVENT_SLOTS, &entry,
+                                           sizeof(entry));
+        if (err != 0 && err != -ENOTSUP) {
+            LOG_ERR("Event log write failed: %d", err);
+        }
+
+        // also counted if not stored, so that the sequence numbers don't depend on the storage
+        event_log_next_seq++;
+    }
+
+    event_log_dropped = atomic_get(&ram_dropped);
+}
+
+int event_log_read(uint32_t seq, EventLogEntry *buf, int max_entries, uint32_t *first_seq)
+{
+    int num = 0;
+
+    if (event_log_next_seq > DATA_STORAGE_EVENT_SLOTS
+        && seq < event_log_next_seq - DATA_STORAGE_EVENT_SLOTS)
+    {
+        seq = event_log_next_seq - DATA_STORAGE_EVENT_SLOTS;
+    }
+    *first_seq = seq;
+
+    for (; seq < event_log_next_seq && num < max_entries; seq++) {
+        EventLogEntry *entry = &buf[num];
+        if (data_storage_event_read(seq % DATA_STORAGE_EVENT_SLOTS, entry, sizeof(*entry)) == 0
+            && entry->crc == entry_crc(entry) && entry->seq == seq)
+        {
+            if (num == 0) {
+                *first_seq = seq;
+            }
+            num++;
+        }
+    }
+
+    return num;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+/** @file
+ *
+ * @brief Log of error flag transitions with timestamp and measurement values
+ *
+ * Events are recorded in a lock-free RAM buffer, so they can be added from any context including
+ * ISRs. The storage thread is woken up to move them to non-volatile memory.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Number of events in the RAM buffer (must be a power of 2)
+ *
+ * Events recorded while the buffer is full are dropped.
+ */
+#define EVENT_LOG_RAM_SIZE 16
+
+/**
+ * Origin of the error flags of an event
+ */
+enum EventSource
+{
+    EVENT_SOURCE_DEVICE = 0, ///< DeviceStatus::error_flags (see ErrorFlag)
+    EVENT_SOURCE_LOAD,       ///< Load output error flags (see LoadErrorFlag)
+    EVENT_SOURCE_USB,        ///< USB output error flags (see LoadErrorFlag)
+};
+
+/**
+ * Single event as stored in NVM and transferred via ThingSet (little-endian, 24 bytes)
+ */
+struct __attribute__((packed)) EventLogEntry
+{
+    uint32_t seq;       ///< Sequence number, increased by 1 for each event
+    uint32_t timestamp; ///< Timestamp of the event (s)
+    uint8_t source;     ///< Origin of the flag (see EventSource)
+    uint8_t flag;       ///< Bit position of the error flag
+    uint8_t active;     ///< 1 if the flag was set, 0 if it was cleared
+    int8_t int_temp;    ///< Internal temperature (°C)
+    float bat_voltage;  ///< Battery voltage (V)
+    float current;      ///< Battery current for device events, output current otherwise (A)
+    uint32_t crc;       ///< CRC32 of all previous bytes
+};
+
+/**
+ * Record transitions of error flags
+ *
+ * Can be called from an ISR. One event is recorded for each flag and the storage thread is woken
+ * up to store it.
+ *
+ * @param source Origin of the flags (see EventSource)
+ * @param flags Bitmask of flags which were set or cleared
+ * @param active True if the flags were set, false if they were cleared
+ * @param current Current related to the source of the event (A)
+ */
+void event_log_record(uint8_t source, uint32_t flags, bool active, float current);
+
+/**
+ * Take the oldest event from the RAM buffer
+ *
+ * Must only be called from a single thread.
+ *
+ * @param entry Pointer to store the event (sequence number and CRC are not set)
+ *
+ * @returns true if an event was available
+ */
+bool event_log_get(EventLogEntry *entry);
+
+/**
+ * Find the newest event stored in NVM to continue the sequence numbers
+ *
+ * Must be called after the data storage was initialized.
+ */
+void event_log_init();
+
+/**
+ * Move recorded events from the RAM buffer to NVM
+ *
+ * Called by the storage thread (see data_storage_notify).
+ */
+void event_log_flush();
+
+/**
+ * Read stored events starting with the given sequence number
+ *
+ * @param seq Sequence number of the first requested event. If the event is not available
+ *            anymore, the oldest available event is used.
+ * @param buf Buffer to store the events
+ * @param max_entries Maximum number of events to be stored in the buffer
+ * @param first_seq Pointer to store the sequence number of the first event in the buffer
+ *
+ * @returns Number of events stored in the buffer
+ */
+int event_log_read(uint32_t seq, EventLogEntry *buf, int max_entries, uint32_t *first_seq);
+
+/**
+ * Sequence number of the next event to be stored
+ */
+extern uint32_t event_log_next_seq;
+
+/**
+ * Number of events dropped because the RAM buffer was full
+ */
+extern uint32_t event_log_dropped;
+
+#endif /* EVENT_LOG_H */
@@ -64,7 +64,7 @@ void oled_update()
         oled.drawBitmap(34, 3, bmp_arrow_right, 5, 7, 1);
     }
 
-    if (load.state == LOAD_STATE_ON) {
+    if (load.is_on()) {
         oled.drawBitmap(84, 3, bmp_arrow_right, 5, 7, 1);
     }
     else {
@@ -12,6 +12,7 @@
 #include "load.h"
 #include "mcu.h"
 #include "setup.h"
+#include "snapshot.h"
 
 #ifndef UNIT_TEST
 
@@ -70,6 +71,9 @@ void start_stm32_bootloader()
 
 void reset_device()
 {
+    // store latest state, so that the operation can be continued after the reset
+    snapshot_save();
+
     sys_reboot(SYS_REBOOT_COLD);
 }
 
@@ -15,18 +15,31 @@
 #include "helper.h"
 #include "leds.h"
 
-#define LOAD_CURRENT_MAX DT_PROP(DT_CHILD(DT_PATH(outputs), load), current_max)
 
 #define PCB_LS_VOLTAGE_MAX    DT_PROP(DT_PATH(pcb), ls_voltage_max)
 #define PCB_MOSFETS_TJ_MAX    DT_PROP(DT_PATH(pcb), mosfets_tj_max)
 #define PCB_MOSFETS_TAU_JA    DT_PROP(DT_PATH(pcb), mosfets_tau_ja)
 #define PCB_INTERNAL_TREF_MAX DT_PROP(DT_PATH(pcb), internal_tref_max)
 
+static constexpr uint32_t floor_log2(uint32_t value)
+{
+    return value <= 1 ? 0 : 1 + floor_log2(value / 2);
+}
+
+// filter constant of thermal model: multiplier = 1/(2^LOAD_THERMAL_FILTER_SHIFT), the time
+// constant is rounded down to the next power of 2 of the number of samples (conservative)
+#define LOAD_THERMAL_FILTER_SHIFT floor_log2(PCB_MOSFETS_TAU_JA * LOAD_THERMAL_MODEL_RATE)
+
+// squared current is limited to factor 2 overcurrent to prevent overflows
+#define LOAD_THERMAL_CURRENT_SQ_MAX (4U << LOAD_THERMAL_Q)
+
+static_assert(LOAD_THERMAL_FILTER_SHIFT + LOAD_THERMAL_Q + 2 < 32, "Thermal model overflow");
+
 extern DeviceStatus dev_stat;
 
 LoadOutput::LoadOutput(DcBus *dc_bus, void (*switch_fn)(bool), void (*init_fn)(),
-                       bool (*pgood_fn)())
-    : PowerPort(dc_bus), switch_set(switch_fn), pgood_check(pgood_fn)
+                       bool (*pgood_fn)(), void (*soft_start_fn)(uint32_t))
+    : PowerPort(dc_bus), switch_set(switch_fn), pgood_check(pgood_fn), soft_start(soft_start_fn)
 {
     state = LOAD_STATE_OFF;
 
@@ -34,45 +47,66 @@ LoadOutput::LoadOutput(DcBus *dc_bus, void (*switch_fn)(bool), void (*init_fn)()
     init_fn();
 
     switch_set(false);
-    junction_temperature = 25; // starting point: 25°C
 
     oc_recovery_delay = CONFIG_LOAD_OC_RECOVERY_DELAY;
     lvd_recovery_delay = CONFIG_LOAD_LVD_RECOVERY_DELAY;
+    soft_start_duration = CONFIG_LOAD_SOFT_START_DURATION;
 
     ov_hysteresis = 0.3;
 
     enable = true; // switch on in next control() call if everything is fine
 }
 
-// this function is called more often than the state machine
-void LoadOutput::control()
+void LoadOutput::thermal_model_update(uint32_t current_sq)
 {
-    if (state == LOAD_STATE_ON) {
+    if (current_sq > LOAD_THERMAL_CURRENT_SQ_MAX) {
+        current_sq = LOAD_THERMAL_CURRENT_SQ_MAX;
+    }
+
+    // same low-pass filter implementation as for ADC readings (see adc_update_value)
+    thermal_state = current_sq + thermal_state - (thermal_state >> LOAD_THERMAL_FILTER_SHIFT);
 
-        // junction temperature calculation model for overcurrent detection
-        junction_temperature = junction_temperature
-                               + (dev_stat.internal_temp - junction_temperature
-                                  + current * current / (LOAD_CURRENT_MAX * LOAD_CURRENT_MAX)
-                                        * (PCB_MOSFETS_TJ_MAX - PCB_INTERNAL_TREF_MAX))
-                                     / (PCB_MOSFETS_TAU_JA * CONFIG_CONTROL_FREQUENCY);
+    if (state != LOAD_STATE_OFF && thermal_state > thermal_limit) {
+        stop(ERR_LOAD_OVERCURRENT);
+    }
+}
 
-        if (junction_temperature > PCB_MOSFETS_TJ_MAX || current > LOAD_CURRENT_MAX * 2) {
-            flags_set(&error_flags, ERR_LOAD_OVERCURRENT);
+// this function is called more often than the state machine
+void LoadOutput::control()
+{
+    /*
+     * Steady-state junction temperature at max. continuous current is PCB_MOSFETS_TJ_MAX at an
+     * internal temperature of PCB_INTERNAL_TREF_MAX. The temperature rise is proportional to the
+     * squared current, so the remaining margin depends on the actual internal temperature.
+     */
+    float margin = (PCB_MOSFETS_TJ_MAX - dev_stat.internal_temp)
+                   / (PCB_MOSFETS_TJ_MAX - PCB_INTERNAL_TREF_MAX);
+    thermal_limit = margin > 0 ? margin * (1U << (LOAD_THERMAL_Q + LOAD_THERMAL_FILTER_SHIFT)) : 0;
+
+    if (is_on()) {
+
+        if (current > LOAD_CURRENT_MAX * 2) {
+            set_error(ERR_LOAD_OVERCURRENT);
             oc_timestamp = uptime();
         }
 
         if (pgood_check != NULL && !pgood_check()) {
-            flags_set(&error_flags, ERR_LOAD_OVERCURRENT);
+            set_error(ERR_LOAD_OVERCURRENT);
             oc_timestamp = uptime();
         }
 
         // negative margin means sourcing current from bus is allowed
-        if (bus->src_current_margin > -0.1F) {
-            flags_set(&error_flags, ERR_LOAD_BUS_SRC_CURRENT);
+        if (src_current_margin() > -0.1F) {
+            set_error(ERR_LOAD_BUS_SRC_CURRENT);
         }
 
         if (bus->voltage < bus->src_control_voltage(disconnect_voltage)) {
-            flags_set(&error_flags, ERR_LOAD_SHEDDING);
+            set_error(ERR_LOAD_SHEDDING);
+            lvd_timestamp = uptime();
+            low_voltage_disconnect = true;
+        }
+        else if (shedding_request) {
+            set_error(ERR_LOAD_SHEDDING);
             lvd_timestamp = uptime();
         }
 
@@ -82,18 +116,32 @@ void LoadOutput::control()
             ov_debounce_counter++;
             if (ov_debounce_counter > CONFIG_CONTROL_FREQUENCY) {
                 // waited 1s before setting the flag
-                flags_set(&error_flags, ERR_LOAD_OVERVOLTAGE);
+                set_error(ERR_LOAD_OVERVOLTAGE);
             }
         }
         else {
             ov_debounce_counter = 0;
         }
 
+        if (state == LOAD_STATE_SOFT_START) {
+            // duty cycle ramp is finished after soft_start_duration, then the inrush current
+            // must settle within the same time again
+            uint32_t ramp_steps = (soft_start_duration * CONFIG_CONTROL_FREQUENCY + 999) / 1000;
+            soft_start_counter++;
+            if (soft_start_counter >= ramp_steps && current <= LOAD_CURRENT_MAX) {
+                state = LOAD_STATE_ON;
+            }
+            else if (soft_start_counter >= 2 * ramp_steps) {
+                set_error(ERR_LOAD_OVERCURRENT);
+                oc_timestamp = uptime();
+            }
+        }
+
         if (error_flags) {
             stop();
         }
 
-        if (enable == false) {
+        if (enable == false || scheduled_on == false) {
             switch_set(false);
             state = LOAD_STATE_OFF;
         }
@@ -102,49 +150,86 @@ void LoadOutput::control()
         // load is off: check if errors are resolved and if load can be switched on
 
         if (flags_check(&error_flags, ERR_LOAD_SHEDDING)
+            && bus->voltage < bus->src_control_voltage(disconnect_voltage))
+        {
+            // battery discharged further by other consumers after shedding by LoadManager
+            low_voltage_disconnect = true;
+        }
+
+        if (flags_check(&error_flags, ERR_LOAD_SHEDDING) && !shedding_request
             && bus->voltage > bus->src_control_voltage(reconnect_voltage)
             && uptime() - lvd_timestamp > lvd_recovery_delay)
         {
-            flags_clear(&error_flags, ERR_LOAD_SHEDDING);
+            clear_error(ERR_LOAD_SHEDDING);
+            low_voltage_disconnect = false;
         }
 
         if (flags_check(&error_flags, ERR_LOAD_OVERCURRENT | ERR_LOAD_VOLTAGE_DIP)
             && uptime() - oc_timestamp > oc_recovery_delay)
         {
-            flags_clear(&error_flags, ERR_LOAD_OVERCURRENT | ERR_LOAD_VOLTAGE_DIP);
+            clear_error(ERR_LOAD_OVERCURRENT | ERR_LOAD_VOLTAGE_DIP);
         }
 
         if (flags_check(&error_flags, ERR_LOAD_OVERVOLTAGE)
             && bus->voltage < (bus->series_voltage(overvoltage) - ov_hysteresis)
             && bus->voltage < (PCB_LS_VOLTAGE_MAX - ov_hysteresis))
         {
-            flags_clear(&error_flags, ERR_LOAD_OVERVOLTAGE);
+            clear_error(ERR_LOAD_OVERVOLTAGE);
         }
 
-        if (flags_check(&error_flags, ERR_LOAD_BUS_SRC_CURRENT) && bus->src_current_margin < 0) {
-            flags_clear(&error_flags, ERR_LOAD_BUS_SRC_CURRENT);
+        if (flags_check(&error_flags, ERR_LOAD_BUS_SRC_CURRENT) && src_current_margin() < 0) {
+            clear_error(ERR_LOAD_BUS_SRC_CURRENT);
         }
 
         if (flags_check(&error_flags, ERR_LOAD_SHORT_CIRCUIT) && enable == false) {
             // stay here until the charge controller is reset or load is manually switched off
-            flags_clear(&error_flags, ERR_LOAD_SHORT_CIRCUIT);
+            clear_error(ERR_LOAD_SHORT_CIRCUIT);
         }
 
         // finally switch on if all errors were resolved and at least 1A src current is available
-        if (enable == true && !error_flags && bus->src_current_margin < -1.0F) {
-            switch_set(true);
-            state = LOAD_STATE_ON;
+        if (enable == true && scheduled_on == true && !error_flags
+            && src_current_margin() < -1.0F)
+        {
+            if (soft_start != NULL && soft_start_duration > 0) {
+                soft_start(soft_start_duration);
+                soft_start_counter = 0;
+                state = LOAD_STATE_SOFT_START;
+            }
+            else {
+                switch_set(true);
+                state = LOAD_STATE_ON;
+            }
         }
     }
 
     info = error_flags > 0 ? -error_flags : state;
 }
 
+void LoadOutput::set_error(uint32_t flags)
+{
+    uint32_t new_errors = flags & ~error_flags;
+    error_flags |= flags;
+
+    if (new_errors) {
+        event_log_record(event_source, new_errors, true, current);
+    }
+}
+
+void LoadOutput::clear_error(uint32_t flags)
+{
+    uint32_t cleared_errors = flags & error_flags;
+    error_flags &= ~flags;
+
+    if (cleared_errors) {
+        event_log_record(event_source, cleared_errors, false, current);
+    }
+}
+
 void LoadOutput::stop(uint32_t flag)
 {
     switch_set(false);
     state = LOAD_STATE_OFF;
-    flags_set(&error_flags, flag);
+    set_error(flag);
 
     // flicker the load LED if failure was most probably caused by the user
     if (flags_check(&error_flags,
@@ -156,6 +241,43 @@ void LoadOutput::stop(uint32_t flag)
     }
 }
 
+void LoadOutput::schedule_update(uint32_t seconds_zero_solar, uint32_t time)
+{
+    if (schedule_dark_prev > NIGHT_TIME_MIN && seconds_zero_solar < schedule_dark_prev) {
+        // dawn: store length of the night for prediction of the next dawn
+        schedule_night_length = schedule_dark_prev;
+    }
+    schedule_dark_prev = seconds_zero_solar;
+
+    if (!schedule_enable) {
+        scheduled_on = true;
+        return;
+    }
+
+    bool dark = seconds_zero_solar >= LOAD_SCHEDULE_DUSK_DELAY;
+
+    bool dusk_active = dark && seconds_zero_solar < schedule_dusk_min * 60U;
+
+    bool dawn_active = dark && schedule_dawn_min > 0 && schedule_night_length > 0
+                       && seconds_zero_solar + schedule_dawn_min * 60U >= schedule_night_length;
+
+    bool clock_active = false;
+    if (schedule_clock_on != schedule_clock_off && schedule_clock_on < 24 * 60
+        && schedule_clock_off < 24 * 60)
+    {
+        uint16_t minute_of_day = (time % (24 * 60 * 60)) / 60;
+        if (schedule_clock_on < schedule_clock_off) {
+            clock_active = minute_of_day >= schedule_clock_on && minute_of_day < schedule_clock_off;
+        }
+        else {
+            // window across midnight
+            clock_active = minute_of_day >= schedule_clock_on || minute_of_day < schedule_clock_off;
+        }
+    }
+
+    scheduled_on = dusk_active || dawn_active || clock_active;
+}
+
 void LoadOutput::set_voltage_limits(float lvd, float lvr, float ov)
 {
     disconnect_voltage = lvd;
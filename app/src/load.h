@@ -19,15 +19,42 @@
 
 #ifdef __cplusplus
 
+#include "event_log.h"
 #include "power_port.h"
 
+/**
+ * Max. continuous current of the load output (A)
+ */
+#define LOAD_CURRENT_MAX DT_PROP(DT_CHILD(DT_PATH(outputs), load), current_max)
+
+/**
+ * Rate of LoadOutput::thermal_model_update calls from the DAQ ISR (Hz)
+ *
+ * Only the conversions triggered by the 1 kHz ADC timer are used for the model, not the ones
+ * synchronized to the PWM switch.
+ */
+#define LOAD_THERMAL_MODEL_RATE 1000
+
+/**
+ * Fixed-point format of normalized squared current for the thermal model (Q14 = 1.0)
+ */
+#define LOAD_THERMAL_Q 14
+
+/**
+ * Time without solar power before dusk is detected by the load schedule (s)
+ *
+ * Prevents switching the load on during short shading or thunderstorms.
+ */
+#define LOAD_SCHEDULE_DUSK_DELAY (15 * 60)
+
 /**
  * Load/USB output states
  */
 enum LoadState
 {
-    LOAD_STATE_OFF = 0, ///< Actively disabled
-    LOAD_STATE_ON = 1,  ///< Normal state: On
+    LOAD_STATE_OFF = 0,        ///< Actively disabled
+    LOAD_STATE_ON = 1,         ///< Normal state: On
+    LOAD_STATE_SOFT_START = 2, ///< Switch driven with ramped duty cycle to limit inrush current
 };
 
 /** Load error flags
@@ -40,8 +67,8 @@ enum LoadErrorFlag
     /**
      * Available energy or power too low
      *
-     * Switching off the load can be triggered either by a low battery voltage or by low state of
-     * charge (SOC) in case of more advanced battery management.
+     * Switching off the load can be triggered either by a low battery voltage or by a low state of
+     * charge (SOC) forecast of the LoadManager.
      *
      * Set in LoadOutput::control() and cleared after reconnect delay passed and voltage is above
      * reconnect threshold again.
@@ -101,8 +128,11 @@ public:
      * @param switch_fn Pointer to function for enabling/disabling load switch
      * @param init_fn Pointer to function for load driver initialization
      * @param pgood_fn Pointer to pgood check
+     * @param soft_start_fn Pointer to function for switching on with ramped duty cycle over the
+     *                      given time in ms (optional)
      */
-    LoadOutput(DcBus *dc_bus, void (*switch_fn)(bool), void (*init_fn)(), bool (*pgood_fn)());
+    LoadOutput(DcBus *dc_bus, void (*switch_fn)(bool), void (*init_fn)(), bool (*pgood_fn)(),
+               void (*soft_start_fn)(uint32_t) = NULL);
 
     /** Main load control function, should be called by control timer
      *
@@ -127,10 +157,50 @@ public:
      */
     void set_voltage_limits(float lvd, float lvr, float ov);
 
+    /**
+     * Fixed-point thermal model of the load MOSFETs for overcurrent detection
+     *
+     * First-order low-pass filter of the squared current. The load is switched off as soon as
+     * the resulting junction temperature exceeds the MOSFET limit. Must be called at
+     * LOAD_THERMAL_MODEL_RATE, typically from the DAQ ISR.
+     *
+     * @param current_sq Squared current normalized to max. continuous load current
+     *                   (fixed-point format, see LOAD_THERMAL_Q)
+     */
+    void thermal_model_update(uint32_t current_sq);
+
+    /**
+     * Evaluate the load schedule rules and update scheduled_on accordingly
+     *
+     * The output is switched on if any of the enabled rules is active:
+     *
+     * - Dusk: For schedule_dusk_min after dusk
+     * - Dawn: For schedule_dawn_min before the predicted dawn (based on length of previous night)
+     * - Clock: Between schedule_clock_on and schedule_clock_off (time of day based on timestamp)
+     *
+     * Must be called exactly once per second.
+     *
+     * @param seconds_zero_solar Time since the solar voltage dropped below the battery voltage (s)
+     * @param time Current unix timestamp (s)
+     */
+    void schedule_update(uint32_t seconds_zero_solar, uint32_t time);
+
+    /**
+     * Check if the output switch is (at least partly) on
+     *
+     * @returns true if on or during soft-start
+     */
+    bool is_on() const
+    {
+        return state != LOAD_STATE_OFF;
+    }
+
     uint32_t state; ///< Current state of load output switch
 
     uint32_t error_flags = 0; ///< Stores error flags as bits according to LoadErrorFlag enum
 
+    uint8_t event_source = EVENT_SOURCE_LOAD; ///< Source used for events of this output
+
     int32_t info; ///< Contains either the state or negative value of error_flags
                   ///< in case of error_flags > 0. This allows to have a single
                   ///< variable for load state diagnosis.
@@ -149,13 +219,44 @@ public:
     uint32_t lvd_recovery_delay; ///< Seconds before we re-enable the load after a low voltage
                                  ///< disconnect
 
-    float junction_temperature; ///< calculated using thermal model based on current and ambient
-                                ///< temperature measurement (unit: °C)
+    uint32_t thermal_state = 0; ///< Thermal model state: normalized temperature rise above
+                                ///< ambient, left-shifted by filter constant
+    uint32_t thermal_limit = 0; ///< Thermal model state to trigger overcurrent protection,
+                                ///< depends on ambient temperature
+
+    uint32_t soft_start_duration; ///< Time to ramp up the duty cycle after switching on (ms),
+                                  ///< 0 to switch on immediately
+
+    bool schedule_enable = false;    ///< Switch output according to schedule rules
+    uint16_t schedule_dusk_min = 0;  ///< Duration to stay on after dusk (min), 0 = disabled
+    uint16_t schedule_dawn_min = 0;  ///< Duration to stay on before dawn (min), 0 = disabled
+    uint16_t schedule_clock_on = 0;  ///< Minute of day to switch on (0-1439)
+    uint16_t schedule_clock_off = 0; ///< Minute of day to switch off, equal to on = disabled
+    bool scheduled_on = true;        ///< Result of schedule evaluation (always true if disabled)
 
     float overvoltage = 0; ///< Upper voltage limit
     float ov_hysteresis;   ///< Hysteresis to switch back on after an overvoltage event
 
+    uint16_t priority = 0;      ///< Load shedding priority (lower priority is shed first)
+    uint16_t shedding_soc = 0;  ///< SOC forecast for shedding by LoadManager (%), 0 = disabled
+    uint16_t reconnect_soc = 0; ///< SOC forecast to reconnect after shedding by LoadManager (%)
+    bool shedding_request = false; ///< Shedding requested by LoadManager
+    bool low_voltage_disconnect = false; ///< ERR_LOAD_SHEDDING caused by low battery voltage
+
+    uint32_t schedule_dark_prev = 0; ///< Time without solar power at previous schedule_update (s)
+    uint32_t schedule_night_length = 0; ///< Length of the previous night (s), 0 if not yet known
+
 private:
+    /**
+     * Set error flags and record newly set flags in the event log
+     */
+    void set_error(uint32_t flags);
+
+    /**
+     * Clear error flags and record previously set flags in the event log
+     */
+    void clear_error(uint32_t flags);
+
     /**
      * Pointer to the load switch function
      */
@@ -166,6 +267,16 @@ private:
      */
     bool (*pgood_check)(void);
 
+    /**
+     * Pointer to the soft-start function
+     */
+    void (*soft_start)(uint32_t);
+
+    /**
+     * Number of control() calls since start of soft-start
+     */
+    uint32_t soft_start_counter = 0;
+
     /**
      * Used to prevent switching of because of very short voltage dip
      */
@@ -188,6 +299,15 @@ void usb_out_init();
 void load_out_set(bool);
 void usb_out_set(bool);
 
+/**
+ * Switch on the load with a duty cycle ramped from 0 to 100% (fully on) within given time
+ *
+ * The ramp is aborted by load_out_set(false).
+ *
+ * @param duration_ms Soft-start duration in milliseconds
+ */
+void load_out_soft_start(uint32_t duration_ms);
+
 void load_short_circuit_stop();
 
 bool pgood_check();
@@ -26,6 +26,23 @@
 #if BOARD_HAS_LOAD_OUTPUT
 #define LOAD_NODE DT_CHILD(DT_PATH(outputs), load)
 static const struct gpio_dt_spec load_switch = GPIO_DT_SPEC_GET(LOAD_NODE, gpios);
+
+/*
+ * Period of the software PWM during soft-start (ms), the timer resolution is 1 ms
+ *
+ * The switch is hard-switched, so the ramp limits the average current, but not the peak current
+ * at the beginning of each pulse. Only on boards with short circuit comparator (PWM 2420 LUS) the
+ * LPTIM cuts off each pulse as soon as the current exceeds the comparator threshold, which limits
+ * the peak current as well.
+ */
+#define LOAD_SOFT_START_PWM_PERIOD 10
+
+static void load_soft_start_handler(struct k_timer *timer);
+
+K_TIMER_DEFINE(load_soft_start_timer, load_soft_start_handler, NULL);
+
+static uint32_t soft_start_ms;       // time since start of the ramp
+static uint32_t soft_start_duration; // total duration of the ramp
 #endif
 
 #if BOARD_HAS_USB_OUTPUT
@@ -36,18 +53,45 @@ static const struct gpio_dt_spec usb_switch = GPIO_DT_SPEC_GET(USB_NODE, gpios);
 // short circuit detection comparator only present in PWM 2420 LUS board so far
 #ifdef CONFIG_BOARD_PWM_2420_LUS
 
+// true while the soft-start ramp is active, so that short circuit triggers only cut the pulse
+static volatile bool soft_start_active;
+
+// value of soft_start_ms when the comparator triggered last during soft-start (0 = never)
+static volatile uint32_t soft_start_trip_ms;
+
+/*
+ * Connect the load switch pin PB2 to the LPTIM output (switch on with hardware short circuit
+ * cut-off) or to the GPIO output register (switch off, as the output was configured inactive)
+ */
+static void load_pin_lptim(bool enable)
+{
+    if (enable) {
+        // alternate function mode (first bit _1 = 1, second bit _0 = 0)
+        GPIOB->MODER = (GPIOB->MODER & ~(GPIO_MODER_MODE2)) | GPIO_MODER_MODE2_1;
+    }
+    else {
+        // general purpose output mode (first bit _1 = 0, second bit _0 = 1)
+        GPIOB->MODER = (GPIOB->MODER & ~(GPIO_MODER_MODE2)) | GPIO_MODER_MODE2_0;
+    }
+}
+
+/*
+ * (Re-)arm the LPTIM, which switches off the load in hardware a few microseconds after the
+ * short circuit comparator triggered
+ */
 static void lptim_init()
 {
     LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_LPTIM1);
 
     LL_IOP_GRP1_EnableClock(LL_IOP_GRP1_PERIPH_GPIOB);
 
-    // Select alternate function mode on PB2 (first bit _1 = 1, second bit _0 = 0)
-    GPIOB->MODER = (GPIOB->MODER & ~(GPIO_MODER_MODE2)) | GPIO_MODER_MODE2_1;
-
-    // Select AF2 (LPTIM_OUT) on PB2
+    // Select AF2 (LPTIM_OUT) on PB2 (pin mode is set separately in load_pin_lptim)
     GPIOB->AFR[0] |= 0x2U << GPIO_AFRL_AFSEL2_Pos;
 
+    // Disable timer to reset the set-once output after a previous trigger (CFGR can only be
+    // changed while the timer is disabled)
+    LPTIM1->CR &= ~LPTIM_CR_ENABLE;
+
     // Set prescaler to 32 (resulting in 1 MHz timer frequency)
     LPTIM1->CFGR |= 0x5U << LPTIM_CFGR_PRESC_Pos;
 
@@ -88,7 +132,13 @@ void ADC1_COMP_IRQHandler(void *args)
     if (COMP2->CSR & COMP_CSR_COMP2VALUE) {
         // Load should be switched off by LPTIM trigger already. This interrupt
         // is mainly used to indicate the failure.
-        load_short_circuit_stop();
+        if (soft_start_active) {
+            // only the current pulse was cut off: peak current limited by the comparator
+            soft_start_trip_ms = soft_start_ms;
+        }
+        else {
+            load_short_circuit_stop();
+        }
     }
 
     // clear interrupt flag
@@ -147,6 +197,12 @@ void load_out_set(bool status)
 #endif
 
 #if BOARD_HAS_LOAD_OUTPUT
+    // abort soft-start (if active)
+    k_timer_stop(&load_soft_start_timer);
+#ifdef CONFIG_BOARD_PWM_2420_LUS
+    soft_start_active = false;
+#endif
+
     if (!device_is_ready(load_switch.port)) {
         printf("Load switch GPIO not ready\n");
         return;
@@ -155,6 +211,7 @@ void load_out_set(bool status)
     if (status == true) {
 #ifdef CONFIG_BOARD_PWM_2420_LUS
         lptim_init();
+        load_pin_lptim(true);
 #else
         gpio_pin_set_dt(&load_switch, 1);
 #endif
@@ -165,6 +222,68 @@ void load_out_set(bool status)
 #endif
 }
 
+#if BOARD_HAS_LOAD_OUTPUT
+
+static void load_soft_start_handler(struct k_timer *timer)
+{
+    soft_start_ms++;
+    if (soft_start_ms >= soft_start_duration) {
+#ifdef CONFIG_BOARD_PWM_2420_LUS
+        soft_start_active = false;
+        if (soft_start_trip_ms > 0
+            && soft_start_ms - soft_start_trip_ms <= LOAD_SOFT_START_PWM_PERIOD)
+        {
+            // current still above the comparator threshold at the end of the ramp
+            load_short_circuit_stop();
+            return;
+        }
+#endif
+        // ramp finished: switch on permanently (incl. short circuit protection if existing)
+        load_out_set(true);
+        return;
+    }
+
+    // software PWM with duty cycle increasing linearly with time
+    uint32_t on_time = soft_start_ms * LOAD_SOFT_START_PWM_PERIOD / soft_start_duration;
+    uint32_t pwm_ms = soft_start_ms % LOAD_SOFT_START_PWM_PERIOD;
+#ifdef CONFIG_BOARD_PWM_2420_LUS
+    if (pwm_ms == 0 && on_time > 0) {
+        // new pulse: re-arm the LPTIM, as it keeps the output off after a comparator trigger
+        lptim_init();
+    }
+    load_pin_lptim(pwm_ms < on_time);
+#else
+    gpio_pin_set_dt(&load_switch, pwm_ms < on_time);
+#endif
+}
+
+#endif
+
+void load_out_soft_start(uint32_t duration_ms)
+{
+#if BOARD_HAS_LOAD_OUTPUT
+    if (!device_is_ready(load_switch.port)) {
+        printf("Load switch GPIO not ready\n");
+        return;
+    }
+
+#if LED_EXISTS(load)
+    leds_set(LED_POS(load), true, LED_TIMEOUT_INFINITE);
+#endif
+
+    gpio_pin_configure_dt(&load_switch, GPIO_OUTPUT_INACTIVE);
+    soft_start_ms = 0;
+    soft_start_duration = duration_ms;
+#ifdef CONFIG_BOARD_PWM_2420_LUS
+    // short circuit cut-off is armed before the first pulse
+    soft_start_trip_ms = 0;
+    soft_start_active = true;
+    lptim_init();
+#endif
+    k_timer_start(&load_soft_start_timer, K_MSEC(1), K_MSEC(1));
+#endif
+}
+
 void usb_out_set(bool status)
 {
 #if BOARD_HAS_USB_OUTPUT
@@ -245,6 +364,9 @@ void load_out_set(bool value)
 void usb_out_set(bool value)
 {}
 
+void load_out_soft_start(uint32_t duration_ms)
+{}
+
 bool pgood_check()
 {
     return false;
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "load_manager.h"
+
+// time constant for averaging of the consumption (s)
+#define CONSUMPTION_AVG_TAU (60 * 60)
+
+// forecast horizon (h)
+#define FORECAST_HOURS 24
+
+bool LoadManager::add_output(LoadOutput *output)
+{
+    if (num_outputs >= LOAD_MANAGER_MAX_OUTPUTS) {
+        return false;
+    }
+
+    outputs[num_outputs++] = output;
+    return true;
+}
+
+void LoadManager::update(uint16_t soc, float capacity_Wh, uint32_t solar_total_Wh, uint32_t day)
+{
+    float power = 0;
+    for (int i = 0; i < num_outputs; i++) {
+        if (outputs[i]->state != LOAD_STATE_OFF) {
+            power += outputs[i]->power;
+        }
+    }
+    consumption_avg += (power - consumption_avg) / CONSUMPTION_AVG_TAU;
+
+    if (!initialized) {
+        day_prev = day;
+        initialized = true;
+    }
+    else if (day != day_prev) {
+        // the first day after startup is incomplete and can't be used
+        if (days_observed > 0) {
+            solar_yesterday_Wh = solar_total_Wh - solar_total_day_start_Wh;
+        }
+        if (days_observed < 2) {
+            days_observed++;
+        }
+        solar_total_day_start_Wh = solar_total_Wh;
+        day_prev = day;
+    }
+
+    soc_forecast = soc;
+    if (days_observed >= 2 && capacity_Wh > 0) {
+        soc_forecast += (solar_yesterday_Wh - consumption_avg * FORECAST_HOURS) / capacity_Wh * 100;
+        if (soc_forecast > 100) {
+            soc_forecast = 100;
+        }
+        else if (soc_forecast < 0) {
+            soc_forecast = 0;
+        }
+    }
+
+    // sort outputs by priority (highest first)
+    LoadOutput *sorted[LOAD_MANAGER_MAX_OUTPUTS];
+    for (int i = 0; i < num_outputs; i++) {
+        int j = i;
+        while (j > 0 && sorted[j - 1]->priority < outputs[i]->priority) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = outputs[i];
+    }
+
+    bool shed_higher = false;
+    uint16_t shed_priority = 0;
+    for (int i = 0; i < num_outputs; i++) {
+        LoadOutput *out = sorted[i];
+
+        if (out->shedding_soc == 0) {
+            // output not managed
+            out->shedding_request = false;
+            continue;
+        }
+
+        float reconnect_soc =
+            out->reconnect_soc > out->shedding_soc ? out->reconnect_soc : out->shedding_soc;
+
+        if ((shed_higher && out->priority < shed_priority) || soc_forecast < out->shedding_soc) {
+            out->shedding_request = true;
+        }
+        else if (soc_forecast >= reconnect_soc) {
+            out->shedding_request = false;
+        }
+
+        if (out->shedding_request && !shed_higher) {
+            // outputs are sorted, so this is the highest priority with shedding active
+            shed_higher = true;
+            shed_priority = out->priority;
+        }
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LOAD_MANAGER_H
+#define LOAD_MANAGER_H
+
+/** @file
+ *
+ * @brief Priority-based load shedding for multiple load outputs
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "load.h"
+
+/**
+ * Maximum number of load outputs handled by the load manager
+ */
+#define LOAD_MANAGER_MAX_OUTPUTS 4
+
+/**
+ * Load manager
+ *
+ * Decides which load outputs should be disconnected based on a forecast of the state of charge
+ * (SOC) in 24 hours. The forecast is based on the actual SOC, the solar energy yield of the
+ * previous day and the recent consumption of all managed outputs.
+ *
+ * Each LoadOutput defines its own priority and SOC thresholds for shedding and reconnection.
+ * Outputs with lower priority are always shed before outputs with higher priority.
+ *
+ * The low voltage disconnect of each LoadOutput stays active independent of the load manager.
+ */
+class LoadManager
+{
+public:
+    /**
+     * Add load output to be managed
+     *
+     * @param output Load output
+     *
+     * @returns true if successful, false if the maximum number of outputs was reached
+     */
+    bool add_output(LoadOutput *output);
+
+    /**
+     * Update consumption statistics, SOC forecast and shedding requests of all outputs
+     *
+     * Must be called exactly once per second.
+     *
+     * @param soc Actual state of charge (%)
+     * @param capacity_Wh Nominal battery capacity (Wh)
+     * @param solar_total_Wh Total solar energy yield (Wh)
+     * @param day Day counter, used to detect the start of a new day
+     */
+    void update(uint16_t soc, float capacity_Wh, uint32_t solar_total_Wh, uint32_t day);
+
+    /**
+     * Forecast of the state of charge in 24 hours (%)
+     *
+     * Same as the actual SOC until the solar energy of at least one full day is known.
+     */
+    float soc_forecast = 100;
+
+    /**
+     * Average power consumption of all managed outputs during the last hours (W)
+     */
+    float consumption_avg = 0;
+
+    /**
+     * Solar energy yield of the previous day (Wh)
+     */
+    uint32_t solar_yesterday_Wh = 0;
+
+private:
+    LoadOutput *outputs[LOAD_MANAGER_MAX_OUTPUTS];
+
+    int num_outputs = 0;
+
+    /**
+     * Day counter at previous call of update
+     */
+    uint32_t day_prev;
+
+    /**
+     * Total solar energy yield at the start of the current day (Wh)
+     */
+    uint32_t solar_total_day_start_Wh;
+
+    /**
+     * Number of day changes observed since startup (forecast requires at least 2)
+     */
+    uint8_t days_observed = 0;
+
+    bool initialized = false;
+};
+
+#endif /* LOAD_MANAGER_H */
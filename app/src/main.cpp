@@ -22,11 +22,20 @@
 #include "data_storage.h"  // non-volatile data storage (e.g. EEPROM)
 #include "dcdc.h"          // DC/DC converter control (hardware independent)
 #include "device_status.h" // log data (error memory, min/max measurements, etc.)
+#include "energy_log.h"    // historical log of energy and battery data
+#include "event_log.h"     // log of error flag transitions
 #include "half_bridge.h"   // PWM generation for DC/DC converter
 #include "hardware.h"   // hardware-related functions like load switch, LED control, watchdog, etc.
 #include "leds.h"       // LED switching using charlieplexing
 #include "load.h"       // load and USB output management
 #include "pwm_switch.h" // PWM charge controller
+#include "snapshot.h"   // runtime state retained during a warm restart
+
+#if CONFIG_HV_TERMINAL_BATTERY
+#define BAT_TERMINAL_VOLTAGE_MAX DT_PROP(DT_PATH(pcb), hs_voltage_max)
+#else
+#define BAT_TERMINAL_VOLTAGE_MAX DT_PROP(DT_PATH(pcb), ls_voltage_max)
+#endif
 
 int main(void)
 {
@@ -53,14 +62,35 @@ int main(void)
     grid_terminal.init_nanogrid();
 #endif
 
+    // default load shedding priorities (USB is kept on longer than the load output)
+#if BOARD_HAS_LOAD_OUTPUT
+    load.priority = 1;
+    load_manager.add_output(&load);
+#endif
+
+#if BOARD_HAS_USB_OUTPUT
+    usb_pwr.priority = 2;
+    usb_pwr.event_source = EVENT_SOURCE_USB;
+    load_manager.add_output(&usb_pwr);
+#endif
+
     // read custom configuration from EEPROM
     data_objects_init();
 
+    energy_log_init();
+    event_log_init();
+
+    // continue with previous state after a software or watchdog reset
+    bool restored = snapshot_restore();
+
     // Data Acquisition (DAQ) setup
     daq_setup();
 
-    charger.detect_num_batteries(&bat_conf); // check if we have 24V instead of 12V system
     charger.init_terminal(&bat_conf);
+    if (restored) {
+        charger.resume_state(&bat_conf);
+    }
+    charger.detect_num_batteries(&bat_conf, BAT_TERMINAL_VOLTAGE_MAX); // 12/24/36/48V system
 
 #if BOARD_HAS_LOAD_OUTPUT
     load.set_voltage_limits(bat_conf.load_disconnect_voltage, bat_conf.load_reconnect_voltage,
@@ -80,33 +110,31 @@ int main(void)
     while (true) {
         // loop runs exactly once per second and includes slow control tasks and energy calculation
 
+        charger.detect_num_batteries(&bat_conf, BAT_TERMINAL_VOLTAGE_MAX);
+        charger.estimate_temperature(&bat_conf, dev_stat.internal_temp);
         charger.discharge_control(&bat_conf);
+        charge_profile_lock();
         charger.charge_control(&bat_conf);
+        charge_profile_unlock();
 
-// energy + soc calculation must be called exactly once per second
-#if BOARD_HAS_DCDC
-        if (dcdc.state != DCDC_CONTROL_OFF) {
-            hv_terminal.energy_balance();
-        }
-#endif
-
-#if BOARD_HAS_PWM_PORT
-        if (pwm_switch.active() == 1) {
-            pwm_switch.energy_balance();
-        }
-#endif
-
-        lv_terminal.energy_balance();
+        // energy + soc calculation must be called exactly once per second
+        dev_stat.update_energy();
+        dev_stat.update_min_max_values();
+        dev_stat.update_histograms();
+        charger.update_soc(&bat_conf);
+        energy_log_update();
 
 #if BOARD_HAS_LOAD_OUTPUT
-        if (load.state == 1) {
-            load.energy_balance();
-        }
+        load.schedule_update(dev_stat.seconds_zero_solar, timestamp);
 #endif
 
-        dev_stat.update_energy();
-        dev_stat.update_min_max_values();
-        charger.update_soc(&bat_conf);
+#if BOARD_HAS_LOAD_OUTPUT || BOARD_HAS_USB_OUTPUT
+        float bat_capacity_Wh =
+            bat_conf.nominal_capacity
+            * bat_terminal.bus->series_voltage((bat_conf.ocv_full + bat_conf.ocv_empty) / 2);
+        load_manager.update(charger.soc, bat_capacity_Wh, dev_stat.solar_in_total_Wh,
+                            dev_stat.day_counter);
+#endif
 
 #if CONFIG_HS_MOSFET_FAIL_SAFE_PROTECTION && BOARD_HAS_DCDC
         if (dev_stat.has_error(ERR_DCDC_HS_MOSFET_SHORT)) {
@@ -122,7 +150,9 @@ int main(void)
         leds_update_soc(charger.soc, false);
 #endif
 
+        data_storage_hot_update();
         data_storage_update();
+        snapshot_save();
 
         t_start += 1000;
         k_sleep(K_TIMEOUT_ABS_MS(t_start));
@@ -133,8 +163,10 @@ void control_thread()
 {
     int wdt_channel = task_wdt_add(200, task_wdt_callback, (void *)k_current_get());
 
+    int64_t t_start = k_uptime_get();
+
     while (true) {
-        // control loop runs at approx. 10 Hz
+        // control loop runs exactly at CONFIG_CONTROL_FREQUENCY (required for the statistics)
 
         bool charging = false;
 
@@ -143,10 +175,52 @@ void control_thread()
         // convert ADC readings to meaningful measurement values
         daq_update();
 
+        // energy integration based on each new measurement
+        int64_t now = k_uptime_get();
+
+#if BOARD_HAS_DCDC
+        if (dcdc.state != DCDC_CONTROL_OFF) {
+            hv_terminal.energy_balance(now);
+        }
+#endif
+
+#if BOARD_HAS_PWM_PORT
+        if (pwm_switch.active() == 1) {
+            pwm_switch.energy_balance(now);
+        }
+#endif
+
+        lv_terminal.energy_balance(now);
+
+#if BOARD_HAS_LOAD_OUTPUT
+        if (load.is_on()) {
+            load.energy_balance(now);
+        }
+#endif
+
+        // statistics of all ports, inactive ports are considered with zero current
+        lv_bus.update_stats();
+        lv_terminal.update_stats();
+#if BOARD_HAS_DCDC
+        hv_bus.update_stats();
+        hv_terminal.update_stats();
+#endif
+#if BOARD_HAS_PWM_PORT
+        pwm_switch.update_stats();
+#endif
+#if BOARD_HAS_LOAD_OUTPUT
+        load.update_stats();
+#endif
+#if BOARD_HAS_USB_OUTPUT
+        usb_pwr.update_stats();
+#endif
+
         // alerts should trigger only for transients, so update based on actual voltage
         daq_set_lv_limits(lv_terminal.bus->voltage * 1.2F, lv_terminal.bus->voltage * 0.8F);
+        daq_check_power_fail();
 
         lv_terminal.update_bus_current_margins();
+        lv_bus.update_port_margins();
 
 #if BOARD_HAS_PWM_PORT
         pwm_switch.control();
@@ -169,7 +243,8 @@ void control_thread()
         usb_pwr.control();
 #endif
 
-        k_sleep(K_MSEC(100));
+        t_start += 1000 / CONFIG_CONTROL_FREQUENCY;
+        k_sleep(K_TIMEOUT_ABS_MS(t_start));
     }
 }
 
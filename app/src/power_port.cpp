@@ -6,6 +6,51 @@
 
 #include "power_port.h"
 
+#include <zephyr/kernel.h>
+
+bool DcBus::add_port(PowerPort *port, uint8_t priority, float droop_res)
+{
+    if (num_ports >= DC_BUS_MAX_PORTS) {
+        return false;
+    }
+
+    port->bus_priority = priority;
+    port->droop_res = droop_res;
+    port->bus_margins_allocated = true;
+
+    // insert sorted by priority (highest first)
+    int i = num_ports++;
+    while (i > 0 && ports[i - 1]->bus_priority < priority) {
+        ports[i] = ports[i - 1];
+        i--;
+    }
+    ports[i] = port;
+    return true;
+}
+
+void DcBus::update_port_margins()
+{
+    // The ports are served from lowest to highest priority: The lowest priority port gets the
+    // margin of the entire bus and each port with higher priority additionally gets the current
+    // of all ports with lower priority, which will be pushed back as soon as it is claimed.
+    float sink_margin = sink_current_margin;
+    float src_margin = src_current_margin;
+
+    for (int i = num_ports - 1; i >= 0; i--) {
+        PowerPort *port = ports[i];
+        port->allocated_sink_margin = sink_margin;
+        port->allocated_src_margin = src_margin;
+
+        if (port->current < 0) {
+            // current towards the bus
+            sink_margin -= port->current;
+        }
+        else {
+            src_margin -= port->current;
+        }
+    }
+}
+
 void PowerPort::init_solar()
 {
     neg_current_limit = -50; // derating based on max. DC/DC or PWM switch current only
@@ -26,15 +71,86 @@ void PowerPort::init_nanogrid()
     bus->sink_voltage_intercept = 28.0; // boost mode until this voltage is reached
 }
 
-void PowerPort::energy_balance()
+void PowerPort::energy_balance(int64_t timestamp_ms)
+{
+    float power_now = bus->voltage * current;
+    int64_t dt_ms = timestamp_ms - energy_timestamp_prev;
+
+    if (energy_timestamp_prev >= 0 && dt_ms > 0 && dt_ms <= ENERGY_BALANCE_MAX_GAP_MS) {
+        // energy in both directions during this interval (W * ms = mWs)
+        float pos_mWs = 0.0F;
+        float neg_mWs = 0.0F;
+
+        if (power_now >= 0.0F && energy_power_prev >= 0.0F) {
+            pos_mWs = (energy_power_prev + power_now) * 0.5F * dt_ms;
+        }
+        else if (power_now <= 0.0F && energy_power_prev <= 0.0F) {
+            neg_mWs = -(energy_power_prev + power_now) * 0.5F * dt_ms;
+        }
+        else {
+            // power changed sign: split the interval at the zero crossing into two triangles
+            float p_pos = (power_now > 0.0F) ? power_now : energy_power_prev;
+            float p_neg = (power_now < 0.0F) ? -power_now : -energy_power_prev;
+            pos_mWs = p_pos * p_pos / (p_pos + p_neg) * 0.5F * dt_ms;
+            neg_mWs = p_neg * p_neg / (p_pos + p_neg) * 0.5F * dt_ms;
+        }
+
+        // fractions of mWs are carried over, so that also very low power is counted
+        pos_mWs += pos_energy_rest_mWs;
+        neg_mWs += neg_energy_rest_mWs;
+        int64_t pos_int = static_cast<int64_t>(pos_mWs);
+        int64_t neg_int = static_cast<int64_t>(neg_mWs);
+        pos_energy_rest_mWs = pos_mWs - pos_int;
+        neg_energy_rest_mWs = neg_mWs - neg_int;
+
+        // 64-bit counters are also accessed by other threads
+        unsigned int key = irq_lock();
+        pos_energy_mWs += pos_int;
+        neg_energy_mWs += neg_int;
+        irq_unlock(key);
+    }
+
+    energy_power_prev = power_now;
+    energy_timestamp_prev = timestamp_ms;
+}
+
+void PowerPort::update_stats()
+{
+    current_stats.add_sample(current);
+    power_stats.add_sample(power);
+}
+
+void PowerPort::get_energy(int64_t *pos_mWs, int64_t *neg_mWs) const
 {
-    // remark: timespan = 1s, so no multiplication with time necessary for energy calculation
-    if (current >= 0.0F) {
-        pos_energy_Wh += bus->voltage * current / 3600.0F;
+    unsigned int key = irq_lock();
+    *pos_mWs = pos_energy_mWs;
+    *neg_mWs = neg_energy_mWs;
+    irq_unlock(key);
+}
+
+void PowerPort::update_energy_Wh()
+{
+    int64_t pos_mWs, neg_mWs;
+    get_energy(&pos_mWs, &neg_mWs);
+
+    pos_energy_Wh = static_cast<float>(pos_mWs) / ENERGY_MWS_PER_WH;
+    neg_energy_Wh = static_cast<float>(neg_mWs) / ENERGY_MWS_PER_WH;
+}
+
+void PowerPort::reset_energy(int64_t *pos_mWs, int64_t *neg_mWs)
+{
+    unsigned int key = irq_lock();
+    if (pos_mWs != NULL) {
+        *pos_mWs = pos_energy_mWs;
     }
-    else {
-        neg_energy_Wh -= bus->voltage * current / 3600.0F;
+    if (neg_mWs != NULL) {
+        *neg_mWs = neg_energy_mWs;
     }
+    pos_energy_mWs = 0;
+    neg_energy_mWs = 0;
+    irq_unlock(key);
+
+    update_energy_Wh();
 }
 
 void PowerPort::update_bus_current_margins() const
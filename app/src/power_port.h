@@ -16,8 +16,25 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "statistics.h"
+
 class PowerPort; // forward-declaration
 
+/**
+ * Maximum time between two calls of PowerPort::energy_balance that is still integrated (ms)
+ */
+#define ENERGY_BALANCE_MAX_GAP_MS 1000
+
+/**
+ * Conversion factor between internal energy counters (mWs) and Wh
+ */
+#define ENERGY_MWS_PER_WH 3600000LL
+
+/**
+ * Maximum number of ports that can be added to a DC bus for current margin allocation
+ */
+#define DC_BUS_MAX_PORTS 4
+
 /**
  * DC bus class
  *
@@ -39,6 +56,11 @@ public:
      */
     float voltage_filtered = 0;
 
+    /**
+     * Statistics of bus voltage, see update_stats
+     */
+    RollingStats voltage_stats;
+
     /**
      * Multiplier for series connection of batteries
      *
@@ -100,6 +122,30 @@ public:
      */
     float src_current_margin = 0;
 
+    /**
+     * Add port to the DC bus for allocation of the current margins
+     *
+     * The ports are served in the order of their priority. A port with higher priority may take
+     * over the current of all ports with lower priority, e.g. a DC/DC converter can push back a
+     * PWM switch connected to the same battery. Ports that are not added to the bus use the
+     * margins of the entire bus.
+     *
+     * @param port Power port connected to this bus
+     * @param priority Priority of the port (higher value = higher priority)
+     * @param droop_res Droop resistance of the port in addition to the bus droop
+     *
+     * @returns true if successful, false if the maximum number of ports was reached
+     */
+    bool add_port(PowerPort *port, uint8_t priority, float droop_res = 0);
+
+    /**
+     * Allocate the current margins of the bus to the added ports
+     *
+     * Must be called in each control cycle after the margins of the bus were updated by the port
+     * defining the bus control targets (see PowerPort::update_bus_current_margins).
+     */
+    void update_port_margins();
+
     /**
      * Calculate current-compensated src control voltage, considering droop and series multiplier
      *
@@ -134,6 +180,14 @@ public:
         }
     }
 
+    /**
+     * Add actual voltage to statistics, must be called at each new measurement
+     */
+    inline void update_stats()
+    {
+        voltage_stats.add_sample(voltage);
+    }
+
     /**
      * Calculate voltage for series connected batteries based on setpoint for single battery
      *
@@ -145,6 +199,14 @@ public:
     {
         return single_voltage * series_multiplier;
     }
+
+private:
+    /**
+     * Ports added to this bus, sorted by priority (highest first)
+     */
+    PowerPort *ports[DC_BUS_MAX_PORTS];
+
+    int num_ports = 0;
 };
 
 /**
@@ -204,6 +266,16 @@ public:
      */
     float power = 0;
 
+    /**
+     * Statistics of port current, see update_stats
+     */
+    RollingStats current_stats;
+
+    /**
+     * Statistics of port power, see update_stats
+     */
+    RollingStats power_stats;
+
     /**
      * Maximum positive current (valid values >= 0.0)
      */
@@ -214,16 +286,79 @@ public:
      */
     float neg_current_limit = 0;
 
+    /**
+     * Cumulated energy in positive current direction since last counter reset (mWs)
+     *
+     * An integer counter is used because small increments get lost in a float accumulator
+     * after a few kWh.
+     *
+     * The counter is updated by the control thread, so other threads must use get_energy or
+     * reset_energy for access, as 64-bit reads and writes are not atomic.
+     */
+    int64_t pos_energy_mWs = 0;
+
+    /**
+     * Cumulated energy in negative current direction since last counter reset (mWs)
+     */
+    int64_t neg_energy_mWs = 0;
+
     /**
      * Cumulated energy in positive current direction since last counter reset (Wh)
+     *
+     * Float view of pos_energy_mWs for communication interfaces, see update_energy_Wh
      */
     float pos_energy_Wh = 0;
 
     /**
      * Cumulated energy in negative current direction since last counter reset (Wh)
+     *
+     * Float view of neg_energy_mWs for communication interfaces, see update_energy_Wh
      */
     float neg_energy_Wh = 0;
 
+    /**
+     * Power at previous call of energy_balance (W)
+     */
+    float energy_power_prev = 0;
+
+    /**
+     * Energy below 1 mWs not yet added to pos_energy_mWs / neg_energy_mWs (mWs)
+     */
+    float pos_energy_rest_mWs = 0;
+    float neg_energy_rest_mWs = 0;
+
+    /**
+     * Timestamp of previous call of energy_balance (ms), negative if no valid sample available
+     */
+    int64_t energy_timestamp_prev = -1;
+
+    /**
+     * Priority for the allocation of the bus current margins, see DcBus::add_port
+     */
+    uint8_t bus_priority = 0;
+
+    /**
+     * Droop resistance of this port in addition to the droop of the bus
+     *
+     * Ports connected in parallel with different droop share the current in voltage control mode.
+     */
+    float droop_res = 0;
+
+    /**
+     * True if the port was added to the bus and receives its own share of the current margins
+     */
+    bool bus_margins_allocated = false;
+
+    /**
+     * Share of the bus sink current margin allocated by DcBus::update_port_margins
+     */
+    float allocated_sink_margin = 0;
+
+    /**
+     * Share of the bus src current margin allocated by DcBus::update_port_margins
+     */
+    float allocated_src_margin = 0;
+
     /**
      * Constructor assigning the port to a DC bus
      *
@@ -251,9 +386,44 @@ public:
     /**
      * Energy balance calculation for power port
      *
-     * Must be called exactly once per second, otherwise energy calculation gets wrong.
+     * The power between the previous and the current call is integrated using the trapezoidal
+     * rule and the actually elapsed time, so this function should be called after each new
+     * measurement (i.e. in the control loop). Intervals longer than ENERGY_BALANCE_MAX_GAP_MS,
+     * e.g. after the port was inactive, are not integrated.
+     *
+     * @param timestamp_ms Current system uptime (ms)
+     */
+    void energy_balance(int64_t timestamp_ms);
+
+    /**
+     * Add actual current and power to statistics, must be called at each new measurement
+     * (STATS_SAMPLES_PER_SECOND times per second)
+     */
+    void update_stats();
+
+    /**
+     * Read consistent values of both energy counters
+     *
+     * @param pos_mWs Pointer to store the energy in positive current direction
+     * @param neg_mWs Pointer to store the energy in negative current direction
+     */
+    void get_energy(int64_t *pos_mWs, int64_t *neg_mWs) const;
+
+    /**
+     * Update float views (Wh) of the internal energy counters
      */
-    void energy_balance();
+    void update_energy_Wh();
+
+    /**
+     * Reset energy counters, e.g. at the start of a new day
+     *
+     * The counters are read and reset atomically, so that no energy integrated in the meantime
+     * gets lost.
+     *
+     * @param pos_mWs Pointer to store the energy in positive direction before the reset or NULL
+     * @param neg_mWs Pointer to store the energy in negative direction before the reset or NULL
+     */
+    void reset_energy(int64_t *pos_mWs = NULL, int64_t *neg_mWs = NULL);
 
     /**
      * Sets current limits for control of the bus voltage
@@ -262,6 +432,45 @@ public:
      * the battery, the solar panel or the DC grid.
      */
     void update_bus_current_margins() const;
+
+    /**
+     * Available additional current from this port towards the DC bus
+     *
+     * @returns Margin allocated to this port or the margin of the entire bus if the port was not
+     *          added to the bus
+     */
+    inline float sink_current_margin() const
+    {
+        return bus_margins_allocated ? allocated_sink_margin : bus->sink_current_margin;
+    }
+
+    /**
+     * Available additional current from the DC bus into this port (has a negative sign)
+     *
+     * @returns Margin allocated to this port or the margin of the entire bus if the port was not
+     *          added to the bus
+     */
+    inline float src_current_margin() const
+    {
+        return bus_margins_allocated ? allocated_src_margin : bus->src_current_margin;
+    }
+
+    /**
+     * Sink control voltage of the bus, additionally compensated by the droop of this port
+     */
+    inline float sink_control_voltage() const
+    {
+        // current towards the bus has a negative sign and reduces the target voltage
+        return bus->sink_control_voltage() + droop_res * current * bus->series_multiplier;
+    }
+
+    /**
+     * Src control voltage of the bus, additionally compensated by the droop of this port
+     */
+    inline float src_control_voltage() const
+    {
+        return bus->src_control_voltage() + droop_res * current * bus->series_multiplier;
+    }
 };
 
 #endif /* POWER_PORT_H */
@@ -23,6 +23,18 @@ LOG_MODULE_REGISTER(pwm_switch, CONFIG_PWM_LOG_LEVEL);
 #define PWM_CURRENT_MAX (DT_PROP(DT_CHILD(DT_PATH(outputs), pwm_switch), current_max))
 #define PWM_PERIOD      (DT_PHA(DT_CHILD(DT_PATH(outputs), pwm_switch), pwms, period))
 
+// PI controller gains for duty cycle (1/V), applied at each control step
+#define PWM_CTRL_KP 0.2F
+#define PWM_CTRL_KI 0.05F
+
+// weight of the current margin vs. voltage error (V/A)
+#define PWM_CTRL_CURRENT_WEIGHT 0.1F
+
+// minimum duty cycle, as the gate driver switch-off time is quite high (fall time around 1ms)
+#define PWM_DUTY_MIN 0.05F
+// maximum duty cycle before switching completely on
+#define PWM_DUTY_MAX 0.95F
+
 bool PwmSwitch::active()
 {
     return pwm_active();
@@ -70,72 +82,75 @@ void PwmSwitch::control()
             off_timestamp = uptime();
             LOG_INF("PWM charger stop, current = %d mA", (int)(current * 1000.0F));
         }
-        else if (bus->voltage > bus->sink_control_voltage() + 0.3F) {
+        else if (bus->voltage > sink_control_voltage() + 0.3F) {
             pwm_signal_stop();
             off_timestamp = uptime();
             dev_stat.set_error(ERR_PWM_SWITCH_OVERVOLTAGE);
             LOG_INF("PWM charger stop, overvoltage.");
         }
-        else if (bus->voltage > bus->sink_control_voltage() // bus voltage above target
-                 || current < neg_current_limit             // port current limit exceeded
-                 || current < -PWM_CURRENT_MAX)             // PCB current limit exceeded
-        {
-            // decrease power, as limits were reached
+        else {
+            // PI controller in velocity form (the actual duty cycle is the integrator state, so
+            // no additional anti-windup is needed)
+            float error = control_error();
+            float duty = pwm_signal_get_duty_cycle() + PWM_CTRL_KP * (error - error_prev)
+                         + PWM_CTRL_KI * error;
+            error_prev = error;
 
             // the gate driver switch-off time is quite high (fall time around 1ms), so very short
             // on or off periods (duty cycle close to 0 and 1) should be avoided
-            if (pwm_signal_get_duty_cycle() > 0.95F) {
-                // prevent very short off periods
-                pwm_signal_set_duty_cycle(0.95F);
+            if (duty > PWM_DUTY_MAX) {
+                // switch completely on if more power is possible, otherwise prevent very short
+                // off periods
+                pwm_signal_set_duty_cycle(error > 0 ? 1.0F : PWM_DUTY_MAX);
             }
-            else if (pwm_signal_get_duty_cycle() < 0.05F) {
+            else if (duty < PWM_DUTY_MIN && error < 0) {
                 // prevent very short on periods and switch completely off instead
                 pwm_signal_stop();
                 off_timestamp = uptime();
-                // consider this as overvoltage in order to start again with 5% duty cycle
+                // consider this as overvoltage in order to start again with min. duty cycle
                 dev_stat.set_error(ERR_PWM_SWITCH_OVERVOLTAGE);
                 LOG_INF("PWM charger stop, no further derating possible.");
             }
             else {
-                // decrease the power with large steps to prevent long-term overvoltages if
-                // the PWM switch was started with full battery and high solar irradiation
-                pwm_signal_duty_cycle_step(-10);
-            }
-        }
-        else {
-            // increase power (if not yet at 100% duty cycle)
-
-            if (pwm_signal_get_duty_cycle() > 0.95F) {
-                // prevent very short off periods and switch completely on instead
-                pwm_signal_set_duty_cycle(1);
-            }
-            else {
-                pwm_signal_duty_cycle_step(1);
+                pwm_signal_set_duty_cycle(duty > PWM_DUTY_MIN ? duty : PWM_DUTY_MIN);
             }
         }
 
         if (dev_stat.has_error(ERR_PWM_SWITCH_OVERVOLTAGE)
-            && bus->voltage < bus->sink_control_voltage() - 0.5F)
+            && bus->voltage < sink_control_voltage() - 0.5F)
         {
             dev_stat.clear_error(ERR_PWM_SWITCH_OVERVOLTAGE);
         }
     }
     else {
-        if (bus->sink_current_margin > 0 && // charging allowed
-            bus->voltage < bus->sink_control_voltage()
+        if (sink_current_margin() > 0 && // charging allowed
+            bus->voltage < sink_control_voltage()
             && ext_voltage > bus->voltage + offset_voltage_start
             && uptime() > (off_timestamp + restart_interval) && enable == true)
         {
             // turning the PWM switch on creates a short voltage rise, so inhibit alerts by 50 ms
             adc_upper_alert_inhibit(ADC_POS(v_low), 50);
 
+            /*
+             * Feed-forward: With the switch closed, the bus voltage is pulled towards the
+             * external voltage. The duty cycle is estimated from the required fraction of the
+             * available voltage rise, so that the controller starts close to the operating point.
+             */
+            float duty = (sink_control_voltage() - bus->voltage)
+                         / (ext_voltage - bus->voltage);
+
             if (dev_stat.has_error(ERR_PWM_SWITCH_OVERVOLTAGE)) {
                 // start with minimum duty cycle in order to prevent another overvoltage event
-                pwm_signal_start(0.05F);
+                duty = PWM_DUTY_MIN;
             }
-            else {
-                pwm_signal_start(1.0F);
+            else if (duty > PWM_DUTY_MAX) {
+                duty = 1.0F;
             }
+            else if (duty < PWM_DUTY_MIN) {
+                duty = PWM_DUTY_MIN;
+            }
+            pwm_signal_start(duty);
+            error_prev = control_error();
 
             power_good_timestamp = uptime();
             LOG_INF("PWM charger start.");
@@ -143,6 +158,22 @@ void PwmSwitch::control()
     }
 }
 
+float PwmSwitch::control_error()
+{
+    // positive margin means that more current could flow into the bus
+    float current_limit = neg_current_limit > -PWM_CURRENT_MAX ? neg_current_limit
+                                                               : -PWM_CURRENT_MAX;
+    float voltage_error = sink_control_voltage() - bus->voltage;
+    float current_margin = current - current_limit;
+    if (sink_current_margin() < current_margin) {
+        // limited by other ports on the bus, e.g. the battery
+        current_margin = sink_current_margin();
+    }
+    float current_error = current_margin * PWM_CTRL_CURRENT_WEIGHT;
+
+    return voltage_error < current_error ? voltage_error : current_error;
+}
+
 void PwmSwitch::stop()
 {
     pwm_signal_stop();
@@ -106,6 +106,22 @@ public:
      * Last time the current through the switch was above minimum
      */
     time_t power_good_timestamp;
+
+private:
+    /**
+     * Control error for the duty cycle controller
+     *
+     * Minimum of the bus voltage error and the weighted margin to the port and PCB current
+     * limits, so that the more restrictive limit is regulated.
+     *
+     * @returns Control error (V), positive if power can be increased
+     */
+    float control_error();
+
+    /**
+     * Control error of the previous control step (V)
+     */
+    float error_prev = 0;
 };
 #endif
 
@@ -50,6 +50,19 @@ static TIM_TypeDef *tim = TIM3;
 #error "PWM Switch channel not defined properly!"
 #endif
 
+// unused compare channel of the same timer to trigger ADC sampling in the middle of the on-time
+#if DT_PWMS_CHANNEL(DT_CHILD(DT_PATH(outputs), pwm_switch)) == 1
+#define LL_TIM_SetCompareSample   LL_TIM_OC_SetCompareCH2
+#define LL_TIM_EnableIT_CCSample  LL_TIM_EnableIT_CC2
+#define LL_TIM_IsActiveFlagSample LL_TIM_IsActiveFlag_CC2
+#define LL_TIM_ClearFlagSample    LL_TIM_ClearFlag_CC2
+#else
+#define LL_TIM_SetCompareSample   LL_TIM_OC_SetCompareCH1
+#define LL_TIM_EnableIT_CCSample  LL_TIM_EnableIT_CC1
+#define LL_TIM_IsActiveFlagSample LL_TIM_IsActiveFlag_CC1
+#define LL_TIM_ClearFlagSample    LL_TIM_ClearFlag_CC1
+#endif
+
 // to check if PWM signal is high or low (not sure how to get pin config from devicetree...)
 #if defined(CONFIG_BOARD_PWM_2420_LUS)
 #define PWM_GPIO_PIN_HIGH (GPIOB->IDR & GPIO_IDR_ID1)
@@ -68,15 +81,32 @@ static int _pwm_resolution;
 
 static void TIM3_IRQHandler(void *args)
 {
-    LL_TIM_ClearFlag_UPDATE(tim);
+    if (LL_TIM_IsActiveFlagSample(tim)) {
+        LL_TIM_ClearFlagSample(tim);
+
+        // middle of the on-time: one sample per period with settled voltage and current
+        if (_pwm_active) {
+            adc_trigger_synchronized();
+        }
+    }
+
+    if (LL_TIM_IsActiveFlag_UPDATE(tim)) {
+        LL_TIM_ClearFlag_UPDATE(tim);
 
-    if ((int)LL_TIM_OC_GetCompare(tim) < _pwm_resolution) {
-        // turning the PWM switch on creates a short voltage rise, so inhibit alerts by 10 ms
-        // at each rising edge if switch is not continuously on
-        adc_upper_alert_inhibit(ADC_POS(v_low), 10);
+        if ((int)LL_TIM_OC_GetCompare(tim) < _pwm_resolution) {
+            // turning the PWM switch on creates a short voltage rise, so inhibit alerts by 10 ms
+            // at each rising edge if switch is not continuously on
+            adc_upper_alert_inhibit(ADC_POS(v_low), 10);
+        }
     }
 }
 
+static inline void pwm_sample_point_update(uint32_t ccr)
+{
+    // compare value 0 would never match, so sample at least one timer clock after rising edge
+    LL_TIM_SetCompareSample(tim, ccr > 2 ? ccr / 2 : 1);
+}
+
 void pwm_signal_init_registers(int freq_Hz)
 {
     pinctrl_apply_state(pincfg, PINCTRL_STATE_DEFAULT);
@@ -90,8 +120,9 @@ void pwm_signal_init_registers(int freq_Hz)
     LL_TIM_OC_EnablePreload(tim, LL_TIM_CHANNEL);
     LL_TIM_OC_SetPolarity(tim, LL_TIM_CHANNEL, LL_TIM_OCPOLARITY_HIGH);
 
-    // Interrupt on timer update
+    // Interrupt on timer update and on sampling point
     LL_TIM_EnableIT_UPDATE(tim);
+    LL_TIM_EnableIT_CCSample(tim);
 
     // Force update generation (UG = 1)
     LL_TIM_GenerateEvent_UPDATE(tim);
@@ -111,7 +142,9 @@ void pwm_signal_init_registers(int freq_Hz)
 
 void pwm_signal_set_duty_cycle(float duty)
 {
-    LL_TIM_OC_SetCompare(tim, _pwm_resolution * duty);
+    uint32_t ccr_new = _pwm_resolution * duty;
+    LL_TIM_OC_SetCompare(tim, ccr_new);
+    pwm_sample_point_update(ccr_new);
 }
 
 void pwm_signal_duty_cycle_step(int delta)
@@ -119,6 +152,7 @@ void pwm_signal_duty_cycle_step(int delta)
     uint32_t ccr_new = (int)LL_TIM_OC_GetCompare(tim) + delta;
     if (ccr_new <= _pwm_resolution && ccr_new >= 0) {
         LL_TIM_OC_SetCompare(tim, ccr_new);
+        pwm_sample_point_update(ccr_new);
     }
 }
 
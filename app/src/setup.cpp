@@ -24,6 +24,7 @@
 #include "hardware.h"   // hardware-related functions like load switch, LED control, watchdog, etc.
 #include "leds.h"       // LED switching using charlieplexing
 #include "load.h"       // load and USB output management
+#include "load_manager.h"
 #include "pwm_switch.h" // PWM charge controller
 
 DcBus lv_bus;
@@ -46,13 +47,17 @@ PwmSwitch pwm_switch(&lv_bus);
 #endif
 
 #if BOARD_HAS_LOAD_OUTPUT
-LoadOutput load(&lv_bus, &load_out_set, &load_out_init, NULL);
+LoadOutput load(&lv_bus, &load_out_set, &load_out_init, NULL, &load_out_soft_start);
 #endif
 
 #if BOARD_HAS_USB_OUTPUT
 LoadOutput usb_pwr(&lv_bus, &usb_out_set, &usb_out_init, &pgood_check);
 #endif
 
+#if BOARD_HAS_LOAD_OUTPUT || BOARD_HAS_USB_OUTPUT
+LoadManager load_manager;
+#endif
+
 #if CONFIG_HV_TERMINAL_SOLAR
 PowerPort &solar_terminal = hv_terminal;
 #elif CONFIG_LV_TERMINAL_SOLAR
@@ -71,7 +76,9 @@ PowerPort &bat_terminal = lv_terminal;
 PowerPort &bat_terminal = hv_terminal;
 #endif
 
-Charger charger(&bat_terminal);
+ChargeProfile charge_profile; // custom charge profile (disabled if no steps configured)
+
+Charger charger(&bat_terminal, &charge_profile);
 
 BatConf bat_conf;      // actual (used) battery configuration
 BatConf bat_conf_user; // temporary storage where the user can write to
@@ -82,6 +89,9 @@ DeviceStatus dev_stat;
 // uint32_t considered large enough, so we avoid 64-bit math (overflow in year 2106)
 uint32_t timestamp;
 
+// time since last reset (s), not affected by setting the timestamp
+uint32_t uptime_s;
+
 #ifndef UNIT_TEST
 
 #include <soc.h>
@@ -91,6 +101,7 @@ static inline void timestamp_inc(struct k_timer *timer_id)
 {
     ARG_UNUSED(timer_id);
     timestamp++;
+    uptime_s++;
 }
 
 void setup()
@@ -110,6 +121,21 @@ void setup()
     // disable 5k pull-down required for USB-C PD on PB4 and PB6 so that they can be used as inputs
     PWR->CR3 |= PWR_CR3_UCPD_DBDIS;
 #endif
+
+    // ports sharing the low voltage bus (MPPT has priority over PWM charging, as it is more
+    // efficient)
+#if BOARD_HAS_DCDC
+    lv_bus.add_port(&dcdc.lvs_port, 1);
+#endif
+#if BOARD_HAS_PWM_PORT
+    lv_bus.add_port(&pwm_switch, 0);
+#endif
+#if BOARD_HAS_LOAD_OUTPUT
+    lv_bus.add_port(&load, 1);
+#endif
+#if BOARD_HAS_USB_OUTPUT
+    lv_bus.add_port(&usb_pwr, 0);
+#endif
 }
 
 #endif
@@ -12,6 +12,7 @@
 #include "board.h"
 #include "device_status.h"
 #include "load.h"
+#include "load_manager.h"
 #include "power_port.h"
 #include "pwm_switch.h"
 #include "thingset.h"
@@ -35,6 +36,7 @@ extern PowerPort &grid_terminal;
 
 extern DeviceStatus dev_stat;
 extern Charger charger;
+extern ChargeProfile charge_profile;
 extern BatConf bat_conf;
 extern BatConf bat_conf_user;
 
@@ -46,10 +48,16 @@ extern LoadOutput load;
 extern LoadOutput usb_pwr;
 #endif
 
+#if BOARD_HAS_LOAD_OUTPUT || BOARD_HAS_USB_OUTPUT
+extern LoadManager load_manager;
+#endif
+
 extern ThingSet ts; // defined in data_objects.cpp
 
 extern uint32_t timestamp;
 
+extern uint32_t uptime_s;
+
 /**
  * Perform some device setup tasks (currently only used in Zephyr)
  */
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "snapshot.h"
+
+#include <zephyr/kernel.h>
+
+#include "crc_engine.h"
+#include "helper.h"
+#include "setup.h"
+
+#ifndef UNIT_TEST
+#include <zephyr/linker/section_tags.h>
+#else
+#define __noinit
+#endif
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(snapshot, CONFIG_DATA_STORAGE_LOG_LEVEL);
+
+#define SNAPSHOT_MAGIC 0x534E4150 // "SNAP"
+
+/*
+ * Increment the version number each time the layout of the RuntimeSnapshot is changed
+ */
+#define SNAPSHOT_VERSION 2
+
+struct LoadSnapshot
+{
+    uint32_t error_flags;
+    time_t oc_timestamp;
+    time_t lvd_timestamp;
+    uint32_t thermal_state;
+    uint32_t schedule_dark_prev;
+    uint32_t schedule_night_length;
+    bool low_voltage_disconnect;
+};
+
+struct RuntimeSnapshot
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint32_t uptime;        // uptime when the snapshot was taken (s)
+    uint32_t restore_count; // consecutive restores without stable operation
+    uint32_t timestamp;
+
+    // charger
+    uint32_t chg_state;
+    time_t chg_time_state_changed;
+    time_t chg_time_target_voltage_reached;
+    time_t chg_time_last_equalization;
+    time_t chg_time_profile_dvdt;
+    uint32_t chg_target_voltage_timer;
+    uint32_t chg_deep_dis_last_equalization;
+    bool chg_full;
+    bool chg_empty;
+    uint16_t chg_soc;
+    int chg_soc_filtered;
+    float chg_discharged_Ah;
+    float chg_usable_capacity;
+    uint16_t chg_num_full_charges;
+    uint16_t chg_num_deep_discharges;
+    float chg_bat_temperature;
+    uint16_t chg_num_batteries_confidence;
+    int16_t bat_series_multiplier;
+    uint16_t chg_profile_step;
+    float chg_profile_step_Ah;
+    float chg_profile_dvdt_voltage;
+
+#if BOARD_HAS_DCDC
+    int32_t dcdc_off_timestamp;
+    int32_t dcdc_power_good_timestamp;
+#endif
+
+#if BOARD_HAS_LOAD_OUTPUT
+    LoadSnapshot load;
+#endif
+#if BOARD_HAS_USB_OUTPUT
+    LoadSnapshot usb_pwr;
+#endif
+
+    // device status and daily energy of the ports
+    uint32_t error_flags;
+    uint32_t day_counter;
+    uint32_t seconds_zero_solar;
+    uint16_t solar_power_max_day;
+    uint16_t load_power_max_day;
+    int64_t bat_chg_total_mWs_prev;
+    int64_t bat_dis_total_mWs_prev;
+    int64_t solar_in_total_mWs_prev;
+    int64_t load_out_total_mWs_prev;
+    int64_t bat_pos_energy_mWs;
+    int64_t bat_neg_energy_mWs;
+#if CONFIG_HV_TERMINAL_SOLAR || CONFIG_LV_TERMINAL_SOLAR || CONFIG_PWM_TERMINAL_SOLAR
+    int64_t solar_neg_energy_mWs;
+#endif
+#if BOARD_HAS_LOAD_OUTPUT
+    int64_t load_pos_energy_mWs;
+#endif
+#if CONFIG_HV_TERMINAL_NANOGRID
+    int64_t grid_import_total_mWs_prev;
+    int64_t grid_export_total_mWs_prev;
+    int64_t grid_pos_energy_mWs;
+    int64_t grid_neg_energy_mWs;
+#endif
+    DayDetector day_detector;
+    BatteryHistograms bat_hist;
+};
+
+static __noinit RuntimeSnapshot snapshot;
+static __noinit uint32_t snapshot_crc_stored; // CRC32 of the entire snapshot incl. magic
+
+static inline uint32_t snapshot_crc()
+{
+    return crc_engine_crc32(&snapshot, sizeof(snapshot));
+}
+
+// convert a timestamp of the previous run to the current uptime
+static inline time_t shift_time(time_t t, int32_t offset)
+{
+    return (t == CHARGER_TIME_NEVER) ? t : t - offset;
+}
+
+#if BOARD_HAS_LOAD_OUTPUT || BOARD_HAS_USB_OUTPUT
+
+static void load_save(LoadSnapshot *s, const LoadOutput *out)
+{
+    s->error_flags = out->error_flags;
+    s->oc_timestamp = out->oc_timestamp;
+    s->lvd_timestamp = out->lvd_timestamp;
+    s->thermal_state = out->thermal_state;
+    s->schedule_dark_prev = out->schedule_dark_prev;
+    s->schedule_night_length = out->schedule_night_length;
+    s->low_voltage_disconnect = out->low_voltage_disconnect;
+}
+
+static void load_restore(const LoadSnapshot *s, LoadOutput *out, int32_t offset)
+{
+    out->error_flags = s->error_flags;
+    out->oc_timestamp = s->oc_timestamp - offset;
+    out->lvd_timestamp = s->lvd_timestamp - offset;
+    out->thermal_state = s->thermal_state;
+    out->schedule_dark_prev = s->schedule_dark_prev;
+    out->schedule_night_length = s->schedule_night_length;
+    out->low_voltage_disconnect = s->low_voltage_disconnect;
+}
+
+#endif
+
+void snapshot_save()
+{
+    uint32_t now = uptime();
+
+    if (snapshot.magic != SNAPSHOT_MAGIC || now >= SNAPSHOT_STABLE_TIME) {
+        snapshot.restore_count = 0;
+    }
+
+    // invalidate first, so that a reset during the update doesn't leave an inconsistent state
+    snapshot.magic = 0;
+
+    snapshot.version = SNAPSHOT_VERSION;
+    snapshot.size = sizeof(RuntimeSnapshot);
+    snapshot.uptime = now;
+    snapshot.timestamp = timestamp;
+
+    snapshot.chg_state = charger.state;
+    snapshot.chg_time_state_changed = charger.time_state_changed;
+    snapshot.chg_time_target_voltage_reached = charger.time_target_voltage_reached;
+    snapshot.chg_time_last_equalization = charger.time_last_equalization;
+    snapshot.chg_time_profile_dvdt = charger.time_profile_dvdt;
+    snapshot.chg_target_voltage_timer = charger.target_voltage_timer;
+    snapshot.chg_deep_dis_last_equalization = charger.deep_dis_last_equalization;
+    snapshot.chg_full = charger.full;
+    snapshot.chg_empty = charger.empty;
+    snapshot.chg_soc = charger.soc;
+    snapshot.chg_soc_filtered = charger.soc_filtered;
+    snapshot.chg_discharged_Ah = charger.discharged_Ah;
+    snapshot.chg_usable_capacity = charger.usable_capacity;
+    snapshot.chg_num_full_charges = charger.num_full_charges;
+    snapshot.chg_num_deep_discharges = charger.num_deep_discharges;
+    snapshot.chg_bat_temperature = charger.bat_temperature;
+    snapshot.chg_num_batteries_confidence = charger.num_batteries_confidence;
+    snapshot.bat_series_multiplier = bat_terminal.bus->series_multiplier;
+    snapshot.chg_profile_step = charger.profile_step;
+    snapshot.chg_profile_step_Ah = charger.profile_step_Ah;
+    snapshot.chg_profile_dvdt_voltage = charger.profile_dvdt_voltage;
+
+#if BOARD_HAS_DCDC
+    snapshot.dcdc_off_timestamp = dcdc.off_timestamp;
+    snapshot.dcdc_power_good_timestamp = dcdc.power_good_timestamp;
+#endif
+
+#if BOARD_HAS_LOAD_OUTPUT
+    load_save(&snapshot.load, &load);
+#endif
+#if BOARD_HAS_USB_OUTPUT
+    load_save(&snapshot.usb_pwr, &usb_pwr);
+#endif
+
+    snapshot.error_flags = dev_stat.error_flags;
+    snapshot.day_counter = dev_stat.day_counter;
+    snapshot.seconds_zero_solar = dev_stat.seconds_zero_solar;
+    snapshot.solar_power_max_day = dev_stat.solar_power_max_day;
+    snapshot.load_power_max_day = dev_stat.load_power_max_day;
+    snapshot.bat_chg_total_mWs_prev = dev_stat.bat_chg_total_mWs_prev;
+    snapshot.bat_dis_total_mWs_prev = dev_stat.bat_dis_total_mWs_prev;
+    snapshot.solar_in_total_mWs_prev = dev_stat.solar_in_total_mWs_prev;
+    snapshot.load_out_total_mWs_prev = dev_stat.load_out_total_mWs_prev;
+    bat_terminal.get_energy(&snapshot.bat_pos_energy_mWs, &snapshot.bat_neg_energy_mWs);
+#if CONFIG_HV_TERMINAL_SOLAR || CONFIG_LV_TERMINAL_SOLAR || CONFIG_PWM_TERMINAL_SOLAR
+    int64_t solar_pos_mWs;
+    solar_terminal.get_energy(&solar_pos_mWs, &snapshot.solar_neg_energy_mWs);
+#endif
+#if BOARD_HAS_LOAD_OUTPUT
+    int64_t load_neg_mWs;
+    load.get_energy(&snapshot.load_pos_energy_mWs, &load_neg_mWs);
+#endif
+#if CONFIG_HV_TERMINAL_NANOGRID
+    snapshot.grid_import_total_mWs_prev = dev_stat.grid_import_total_mWs_prev;
+    snapshot.grid_export_total_mWs_prev = dev_stat.grid_export_total_mWs_prev;
+    grid_terminal.get_energy(&snapshot.grid_pos_energy_mWs, &snapshot.grid_neg_energy_mWs);
+#endif
+    snapshot.day_detector = dev_stat.day_detector;
+    snapshot.bat_hist = dev_stat.bat_hist;
+
+    snapshot.magic = SNAPSHOT_MAGIC;
+    snapshot_crc_stored = snapshot_crc();
+}
+
+bool snapshot_restore()
+{
+    if (snapshot.magic != SNAPSHOT_MAGIC || snapshot.version != SNAPSHOT_VERSION
+        || snapshot.size != sizeof(RuntimeSnapshot) || snapshot_crc_stored != snapshot_crc())
+    {
+        LOG_INF("No valid snapshot found");
+        snapshot.magic = 0;
+        return false;
+    }
+
+    if (snapshot.restore_count >= SNAPSHOT_RESTORE_MAX) {
+        LOG_WRN("Snapshot ignored after %d restores without stable operation",
+                (int)snapshot.restore_count);
+        snapshot.magic = 0;
+        return false;
+    }
+
+    // timestamps of the previous run are converted, as the uptime started from 0 again
+    int32_t offset = (int32_t)snapshot.uptime - (int32_t)uptime();
+
+    timestamp = snapshot.timestamp;
+
+    charger.state = snapshot.chg_state;
+    charger.time_state_changed = shift_time(snapshot.chg_time_state_changed, offset);
+    charger.time_target_voltage_reached =
+        shift_time(snapshot.chg_time_target_voltage_reached, offset);
+    charger.time_last_equalization = shift_time(snapshot.chg_time_last_equalization, offset);
+    charger.time_profile_dvdt = shift_time(snapshot.chg_time_profile_dvdt, offset);
+    charger.target_voltage_timer = snapshot.chg_target_voltage_timer;
+    charger.deep_dis_last_equalization = snapshot.chg_deep_dis_last_equalization;
+    charger.full = snapshot.chg_full;
+    charger.empty = snapshot.chg_empty;
+    charger.soc = snapshot.chg_soc;
+    charger.soc_filtered = snapshot.chg_soc_filtered;
+    charger.discharged_Ah = snapshot.chg_discharged_Ah;
+    charger.usable_capacity = snapshot.chg_usable_capacity;
+    charger.num_full_charges = snapshot.chg_num_full_charges;
+    charger.num_deep_discharges = snapshot.chg_num_deep_discharges;
+    charger.bat_temperature = snapshot.chg_bat_temperature;
+    charger.num_batteries_confidence = snapshot.chg_num_batteries_confidence;
+    bat_terminal.bus->series_multiplier = snapshot.bat_series_multiplier;
+    // the profile might have been changed before the restart
+    charger.profile_step =
+        (snapshot.chg_profile_step < charge_profile.num_steps) ? snapshot.chg_profile_step : 0;
+    charger.profile_step_Ah = snapshot.chg_profile_step_Ah;
+    charger.profile_dvdt_voltage = snapshot.chg_profile_dvdt_voltage;
+
+#if BOARD_HAS_DCDC
+    dcdc.off_timestamp = snapshot.dcdc_off_timestamp - offset;
+    dcdc.power_good_timestamp = snapshot.dcdc_power_good_timestamp - offset;
+#endif
+
+#if BOARD_HAS_LOAD_OUTPUT
+    load_restore(&snapshot.load, &load, offset);
+#endif
+#if BOARD_HAS_USB_OUTPUT
+    load_restore(&snapshot.usb_pwr, &usb_pwr, offset);
+#endif
+
+    // flags are restored directly, as they were already recorded in the event log
+    dev_stat.error_flags = snapshot.error_flags;
+    dev_stat.day_counter = snapshot.day_counter;
+    dev_stat.seconds_zero_solar = snapshot.seconds_zero_solar;
+    dev_stat.solar_power_max_day = snapshot.solar_power_max_day;
+    dev_stat.load_power_max_day = snapshot.load_power_max_day;
+    dev_stat.bat_chg_total_mWs_prev = snapshot.bat_chg_total_mWs_prev;
+    dev_stat.bat_dis_total_mWs_prev = snapshot.bat_dis_total_mWs_prev;
+    dev_stat.solar_in_total_mWs_prev = snapshot.solar_in_total_mWs_prev;
+    dev_stat.load_out_total_mWs_prev = snapshot.load_out_total_mWs_prev;
+    bat_terminal.pos_energy_mWs = snapshot.bat_pos_energy_mWs;
+    bat_terminal.neg_energy_mWs = snapshot.bat_neg_energy_mWs;
+#if CONFIG_HV_TERMINAL_SOLAR || CONFIG_LV_TERMINAL_SOLAR || CONFIG_PWM_TERMINAL_SOLAR
+    solar_terminal.neg_energy_mWs = snapshot.solar_neg_energy_mWs;
+#endif
+#if BOARD_HAS_LOAD_OUTPUT
+    load.pos_energy_mWs = snapshot.load_pos_energy_mWs;
+#endif
+#if CONFIG_HV_TERMINAL_NANOGRID
+    dev_stat.grid_import_total_mWs_prev = snapshot.grid_import_total_mWs_prev;
+    dev_stat.grid_export_total_mWs_prev = snapshot.grid_export_total_mWs_prev;
+    grid_terminal.pos_energy_mWs = snapshot.grid_pos_energy_mWs;
+    grid_terminal.neg_energy_mWs = snapshot.grid_neg_energy_mWs;
+#endif
+    dev_stat.total_mWs_prev_valid = true;
+    dev_stat.day_detector = snapshot.day_detector;
+    dev_stat.bat_hist = snapshot.bat_hist;
+
+    // counted until the next snapshot after stable operation
+    snapshot.restore_count++;
+    snapshot_crc_stored = snapshot_crc();
+
+    LOG_INF("Runtime state restored (restore count %d)", (int)snapshot.restore_count);
+    return true;
+}
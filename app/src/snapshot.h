@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/** @file
+ *
+ * @brief Snapshot of the runtime state in RAM that is retained during a warm restart
+ *
+ * The snapshot is stored in a section that is not initialized at startup, so it survives a
+ * software or watchdog reset, but not a power loss. It is protected by a magic number and CRC.
+ */
+
+#include <stdbool.h>
+
+/**
+ * Maximum number of consecutive restores without stable operation in between
+ *
+ * Prevents a reset loop if the restored state itself causes the reset.
+ */
+#define SNAPSHOT_RESTORE_MAX 3
+
+/**
+ * Uptime after which the operation is considered as stable (s)
+ */
+#define SNAPSHOT_STABLE_TIME 60
+
+/**
+ * Store the current runtime state of charger, DC/DC, load outputs and device status
+ *
+ * Should be called regularly (e.g. once per second) and before an intended reset.
+ */
+void snapshot_save();
+
+/**
+ * Restore the runtime state if a valid snapshot exists
+ *
+ * Must be called after the data storage was read and before the charger terminal is
+ * initialized. Timestamps are shifted, as the uptime starts from 0 again after the reset.
+ *
+ * @returns true if the state was restored
+ */
+bool snapshot_restore();
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "statistics.h"
+
+#include <zephyr/kernel.h>
+
+#include <math.h>
+
+// number of completed lower-level windows to complete a window
+static const uint16_t window_length[] = { STATS_SAMPLES_PER_SECOND, 60, 15 };
+
+void RollingStats::add_sample(float value)
+{
+    StatsWindow *results[] = { &sec_1, &min_1, &min_15 };
+
+    // input of the next level: the sample itself or the statistics of a completed window
+    float min = value;
+    float max = value;
+    float avg = value;
+    float mean_sq = value * value;
+
+    for (int i = 0; i < 3; i++) {
+        Accumulator *a = &acc[i];
+
+        if (a->count == 0 || min < a->min) {
+            a->min = min;
+        }
+        if (a->count == 0 || max > a->max) {
+            a->max = max;
+        }
+        a->sum = (a->count == 0) ? avg : a->sum + avg;
+        a->sum_sq = (a->count == 0) ? mean_sq : a->sum_sq + mean_sq;
+        a->count++;
+
+        if (a->count < window_length[i]) {
+            break;
+        }
+
+        // window completed: store results and pass them on to the next level
+        StatsWindow *res = results[i];
+        res->min = a->min;
+        res->max = a->max;
+        res->avg = a->sum / a->count;
+        res->rms = sqrtf(a->sum_sq / a->count);
+        a->count = 0;
+
+        min = res->min;
+        max = res->max;
+        avg = res->avg;
+        mean_sq = res->rms * res->rms;
+    }
+}
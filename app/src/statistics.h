@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) The Libre Solar Project Contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+/** @file
+ *
+ * @brief Statistics of measurement values over fixed time windows
+ */
+
+#include <stdint.h>
+
+/**
+ * Number of samples per second, i.e. calls of RollingStats::add_sample
+ *
+ * The windows are based on the number of samples, so the control thread calling add_sample must
+ * be scheduled with absolute timeouts to keep this rate independent of its processing time.
+ */
+#define STATS_SAMPLES_PER_SECOND CONFIG_CONTROL_FREQUENCY
+
+/**
+ * Statistics of a completed time window
+ */
+struct StatsWindow
+{
+    float min; ///< Minimum value
+    float avg; ///< Arithmetic mean
+    float max; ///< Maximum value
+    float rms; ///< Root mean square
+};
+
+/**
+ * Statistics engine for a single measurement value
+ *
+ * Calculates min/avg/max/RMS over the last completed 1 second, 1 minute and 15 minutes windows.
+ *
+ * The windows are cascaded: The results of each 1 s window are accumulated into the 1 min window
+ * and so on, so each new sample only requires a constant number of operations and no sample
+ * buffers are needed.
+ */
+class RollingStats
+{
+public:
+    /**
+     * Add new sample, must be called STATS_SAMPLES_PER_SECOND times per second
+     *
+     * @param value Measurement value
+     */
+    void add_sample(float value);
+
+    StatsWindow sec_1 = {};  ///< Statistics of last completed 1 s window
+    StatsWindow min_1 = {};  ///< Statistics of last completed 1 min window
+    StatsWindow min_15 = {}; ///< Statistics of last completed 15 min window
+
+private:
+    /**
+     * Intermediate values of the currently running window
+     */
+    struct Accumulator
+    {
+        float min;
+        float max;
+        float sum;
+        float sum_sq;
+        uint16_t count;
+    };
+
+    /**
+     * Accumulators for 1 s, 1 min and 15 min windows
+     */
+    Accumulator acc[3] = {};
+};
+
+#endif /* STATISTICS_H */
@@ -15,10 +15,15 @@ static void init_structs()
 {
     battery_conf_init(&bat_conf, BAT_TYPE_FLOODED, 6, 100);
     charger.init_terminal(&bat_conf);
+    charger.num_batteries_confidence = 100;
+    charger.num_batteries_detect_time = 0;
+    dev_stat.clear_error(ERR_BAT_NUM_UNKNOWN);
     charger.state = CHG_STATE_IDLE;
     charger.bat_temperature = 25;
+    charge_profile.num_steps = 0;
     bat_terminal.bus->voltage = 14.0;
     bat_terminal.bus->voltage_filtered = 14.0;
+    bat_terminal.bus->series_multiplier = 1;
     bat_terminal.current = 0;
 }
 
@@ -219,6 +224,197 @@ void stop_equalization_after_time_limit()
     TEST_ASSERT_EQUAL(CHG_STATE_FLOAT, charger.state);
 }
 
+void temperature_compensation_outside_deadband_only()
+{
+    start_if_everything_just_fine();
+    TEST_ASSERT_EQUAL_FLOAT(bat_conf.topping_voltage, bat_terminal.bus->sink_voltage_intercept);
+
+    charger.bat_temperature = 25.2;
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL_FLOAT(bat_conf.topping_voltage, bat_terminal.bus->sink_voltage_intercept);
+
+    charger.bat_temperature = 35;
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL_FLOAT(bat_conf.topping_voltage + bat_conf.temperature_compensation * 10,
+                            bat_terminal.bus->sink_voltage_intercept);
+}
+
+void setpoints_updated_after_conf_change()
+{
+    start_if_everything_just_fine();
+
+    bat_conf_user = bat_conf;
+    bat_conf_user.topping_voltage = bat_conf.topping_voltage - 0.1F;
+    battery_conf_overwrite(&bat_conf_user, &bat_conf, &charger);
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL_FLOAT(bat_conf_user.topping_voltage,
+                            bat_terminal.bus->sink_voltage_intercept);
+}
+
+void detect_two_batteries_after_observation_time()
+{
+    init_structs();
+    charger.num_batteries_confidence = 0;
+    bat_terminal.bus->voltage_filtered = 24.0;
+
+    for (int i = 0; i < 9; i++) {
+        TEST_ASSERT_EQUAL(false, charger.detect_num_batteries(&bat_conf, 60));
+    }
+    TEST_ASSERT_EQUAL(90, charger.num_batteries_confidence);
+    TEST_ASSERT_EQUAL(0, bat_terminal.pos_current_limit);
+
+    // no charging before detection is finished
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL(CHG_STATE_IDLE, charger.state);
+
+    TEST_ASSERT_EQUAL(true, charger.detect_num_batteries(&bat_conf, 60));
+    TEST_ASSERT_EQUAL(2, bat_terminal.bus->series_multiplier);
+    TEST_ASSERT_EQUAL(100, charger.num_batteries_confidence);
+
+    bat_terminal.bus->voltage = 24.0;
+    charger.time_state_changed = time(NULL) - bat_conf.time_limit_recharge - 1;
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL(CHG_STATE_BULK, charger.state);
+}
+
+void no_battery_detection_for_ambiguous_voltage()
+{
+    init_structs();
+    charger.num_batteries_confidence = 0;
+
+    // 29V matches the voltage range of 2 and 3 series batteries
+    bat_terminal.bus->voltage_filtered = 29.0;
+    for (int i = 0; i < 20; i++) {
+        charger.detect_num_batteries(&bat_conf, 60);
+    }
+    TEST_ASSERT_EQUAL(0, charger.num_batteries_confidence);
+
+    // restart observation if voltage changes to a different system voltage
+    bat_terminal.bus->voltage_filtered = 13.0;
+    for (int i = 0; i < 5; i++) {
+        charger.detect_num_batteries(&bat_conf, 60);
+    }
+    bat_terminal.bus->voltage_filtered = 26.0;
+    charger.detect_num_batteries(&bat_conf, 60);
+    TEST_ASSERT_EQUAL(10, charger.num_batteries_confidence);
+    TEST_ASSERT_EQUAL(1, bat_terminal.bus->series_multiplier);
+}
+
+void detect_deeply_discharged_batteries()
+{
+    init_structs();
+    charger.num_batteries_confidence = 0;
+
+    // 24V system slightly below absolute minimum voltage
+    bat_terminal.bus->voltage_filtered = 18.0;
+    for (int i = 0; i < 10; i++) {
+        charger.detect_num_batteries(&bat_conf, 60);
+    }
+    TEST_ASSERT_EQUAL(100, charger.num_batteries_confidence);
+    TEST_ASSERT_EQUAL(2, bat_terminal.bus->series_multiplier);
+    TEST_ASSERT_EQUAL(false, dev_stat.has_error(ERR_BAT_NUM_UNKNOWN));
+}
+
+void battery_detection_fallback_after_timeout()
+{
+    init_structs();
+    charger.num_batteries_confidence = 0;
+
+    // 24V system far below absolute minimum voltage doesn't match any range
+    bat_terminal.bus->voltage_filtered = 16.0;
+    for (int i = 0; i < 300; i++) {
+        TEST_ASSERT_EQUAL(false, charger.detect_num_batteries(&bat_conf, 60));
+    }
+    TEST_ASSERT_EQUAL(false, dev_stat.has_error(ERR_BAT_NUM_UNKNOWN));
+
+    // lowest multiplier without overcharging is used as fallback
+    TEST_ASSERT_EQUAL(true, charger.detect_num_batteries(&bat_conf, 60));
+    TEST_ASSERT_EQUAL(2, bat_terminal.bus->series_multiplier);
+    TEST_ASSERT_EQUAL(0, charger.num_batteries_confidence);
+    TEST_ASSERT_EQUAL(true, dev_stat.has_error(ERR_BAT_NUM_UNKNOWN));
+
+    // error is cleared after successful detection
+    bat_terminal.bus->voltage_filtered = 24.0;
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL(true, charger.detect_num_batteries(&bat_conf, 60));
+    }
+    TEST_ASSERT_EQUAL(100, charger.num_batteries_confidence);
+    TEST_ASSERT_EQUAL(false, dev_stat.has_error(ERR_BAT_NUM_UNKNOWN));
+}
+
+void battery_detection_considers_hardware_limit()
+{
+    init_structs();
+    charger.num_batteries_confidence = 0;
+
+    // 3 series batteries can't be charged with 32V hardware, so 29V must be a 24V system
+    bat_terminal.bus->voltage_filtered = 29.0;
+    for (int i = 0; i < 10; i++) {
+        charger.detect_num_batteries(&bat_conf, 32);
+    }
+    TEST_ASSERT_EQUAL(100, charger.num_batteries_confidence);
+    TEST_ASSERT_EQUAL(2, bat_terminal.bus->series_multiplier);
+}
+
+void temperature_estimation_follows_ambient()
+{
+    init_structs();
+    charger.ext_temp_sensor = false;
+    charger.bat_temp_estimated = false;
+    bat_terminal.current_filtered = 0;
+
+    // first call initializes estimation with ambient temperature
+    charger.estimate_temperature(&bat_conf, 30);
+    TEST_ASSERT_EQUAL_FLOAT(30, charger.bat_temperature);
+    TEST_ASSERT_EQUAL(true, charger.bat_temp_estimated);
+
+    // temperature should have changed by approx. 63% after one time constant
+    for (uint32_t i = 0; i < charger.temp_time_constant; i++) {
+        charger.estimate_temperature(&bat_conf, 20);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 20 + 10 * 0.368, charger.bat_temperature);
+
+    // external sensor has priority
+    charger.ext_temp_sensor = true;
+    charger.bat_temperature = 15;
+    charger.estimate_temperature(&bat_conf, 20);
+    TEST_ASSERT_EQUAL_FLOAT(15, charger.bat_temperature);
+    TEST_ASSERT_EQUAL(false, charger.bat_temp_estimated);
+}
+
+void temperature_estimation_includes_resistive_heating()
+{
+    init_structs();
+    charger.ext_temp_sensor = false;
+    charger.bat_temp_estimated = false;
+    bat_conf.internal_resistance = 0.1;
+    bat_terminal.current_filtered = -10; // discharging also heats up the battery
+
+    charger.estimate_temperature(&bat_conf, 25);
+    for (uint32_t i = 0; i < 10 * charger.temp_time_constant; i++) {
+        charger.estimate_temperature(&bat_conf, 25);
+    }
+    TEST_ASSERT_GREATER_THAN(26, charger.bat_temperature);
+
+    bat_terminal.current_filtered = 0;
+}
+
+void temperature_estimation_with_invalid_time_constant()
+{
+    init_structs();
+    charger.ext_temp_sensor = false;
+    charger.bat_temp_estimated = false;
+    bat_terminal.current_filtered = 0;
+    uint32_t time_constant = charger.temp_time_constant;
+
+    charger.estimate_temperature(&bat_conf, 30);
+    charger.temp_time_constant = 0;
+    charger.estimate_temperature(&bat_conf, 20);
+    TEST_ASSERT_FLOAT_WITHIN(0.5, 30, charger.bat_temperature);
+
+    charger.temp_time_constant = time_constant;
+}
+
 void restart_bulk_from_float_if_voltage_drops()
 {
     TEST_ASSERT(0);
@@ -277,6 +473,198 @@ void restart_discharge_if_allowed()
     TEST_ASSERT_LESS_THAN(0, bat_terminal.neg_current_limit);
 }
 
+void deep_discharge_not_counted_for_load_manager_shedding()
+{
+    init_structs();
+    charger.empty = false;
+    load.error_flags = 0;
+    load.low_voltage_disconnect = false;
+    charger.discharge_control(&bat_conf);
+    uint16_t deep_discharges = charger.num_deep_discharges;
+
+    // shedding requested by LoadManager at high SOC
+    load.error_flags = ERR_LOAD_SHEDDING;
+    charger.discharge_control(&bat_conf);
+    TEST_ASSERT_FALSE(charger.empty);
+    TEST_ASSERT_EQUAL(deep_discharges, charger.num_deep_discharges);
+
+    // low voltage disconnect
+    load.low_voltage_disconnect = true;
+    charger.discharge_control(&bat_conf);
+    TEST_ASSERT_TRUE(charger.empty);
+    TEST_ASSERT_EQUAL(deep_discharges + 1, charger.num_deep_discharges);
+
+    load.error_flags = 0;
+    load.low_voltage_disconnect = false;
+    charger.discharge_control(&bat_conf);
+    TEST_ASSERT_FALSE(charger.empty);
+}
+
+static void init_profile()
+{
+    // CC with 10 A up to 14.2 V, CV at 14.2 V until current drops below 2 A
+    charge_profile.num_steps = 2;
+    charge_profile.steps[0] = { .type = CHG_STEP_CC, .voltage = 14.2F, .current = 10.0F };
+    charge_profile.steps[1] = { .type = CHG_STEP_CV,
+                                .termination = CHG_TERM_CURRENT,
+                                .voltage = 14.2F,
+                                .current = 10.0F,
+                                .cutoff_current = 2.0F };
+}
+
+void profile_encode_decode_roundtrip()
+{
+    uint8_t buf[CHARGE_PROFILE_SIZE_MAX];
+    ChargeProfile decoded = {};
+
+    init_profile();
+    size_t len = charge_profile_encode(&charge_profile, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL(CHARGE_PROFILE_HEADER_SIZE + 2 * CHARGE_PROFILE_STEP_SIZE, len);
+    TEST_ASSERT_TRUE(charge_profile_decode(&decoded, buf, len, 14.7F, 20.0F));
+    TEST_ASSERT_EQUAL(2, decoded.num_steps);
+    TEST_ASSERT_EQUAL(CHG_STEP_CV, decoded.steps[1].type);
+    TEST_ASSERT_EQUAL(CHG_TERM_CURRENT, decoded.steps[1].termination);
+    TEST_ASSERT_EQUAL_FLOAT(14.2F, decoded.steps[1].voltage);
+    TEST_ASSERT_EQUAL_FLOAT(2.0F, decoded.steps[1].cutoff_current);
+}
+
+void profile_decode_rejects_invalid_data()
+{
+    uint8_t buf[CHARGE_PROFILE_SIZE_MAX];
+    ChargeProfile decoded = {};
+
+    init_profile();
+    size_t len = charge_profile_encode(&charge_profile, buf, sizeof(buf));
+
+    // voltage above allowed maximum
+    TEST_ASSERT_FALSE(charge_profile_decode(&decoded, buf, len, 14.0F, 20.0F));
+    TEST_ASSERT_EQUAL(0, decoded.num_steps);
+
+    // truncated data
+    TEST_ASSERT_FALSE(charge_profile_decode(&decoded, buf, len - 1, 14.7F, 20.0F));
+
+    // empty data disables the profile
+    decoded.num_steps = 1;
+    TEST_ASSERT_TRUE(charge_profile_decode(&decoded, buf, 0, 14.7F, 20.0F));
+    TEST_ASSERT_EQUAL(0, decoded.num_steps);
+}
+
+void profile_starts_with_first_step()
+{
+    init_structs();
+    init_profile();
+    charger.time_state_changed = time(NULL) - bat_conf.time_limit_recharge - 1;
+    bat_terminal.bus->voltage = bat_conf.recharge_voltage - 0.1;
+    bat_terminal.bus->voltage_filtered = bat_terminal.bus->voltage;
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL(CHG_STATE_PROFILE, charger.state);
+    TEST_ASSERT_EQUAL(0, charger.profile_step);
+
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL_FLOAT(10.0F, bat_terminal.pos_current_limit);
+}
+
+void profile_cc_to_cv_at_voltage_limit()
+{
+    profile_starts_with_first_step();
+
+    bat_terminal.bus->voltage = 14.3F;
+    bat_terminal.bus->voltage_filtered = bat_terminal.bus->voltage;
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL(CHG_STATE_PROFILE, charger.state);
+    TEST_ASSERT_EQUAL(1, charger.profile_step);
+}
+
+void profile_finished_at_cutoff_current()
+{
+    profile_cc_to_cv_at_voltage_limit();
+
+    bat_terminal.current = 2.5F;
+    bat_terminal.current_filtered = bat_terminal.current;
+    bat_terminal.bus->voltage = 14.2F - bat_terminal.current * bat_terminal.bus->sink_droop_res;
+    bat_terminal.bus->voltage_filtered = bat_terminal.bus->voltage;
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL(CHG_STATE_PROFILE, charger.state);
+
+    bat_terminal.current = 1.5F;
+    bat_terminal.current_filtered = bat_terminal.current;
+    bat_terminal.bus->voltage = 14.2F - bat_terminal.current * bat_terminal.bus->sink_droop_res;
+    bat_terminal.bus->voltage_filtered = bat_terminal.bus->voltage;
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL(CHG_STATE_IDLE, charger.state);
+    TEST_ASSERT_TRUE(charger.full);
+    TEST_ASSERT_EQUAL(0, bat_terminal.pos_current_limit);
+}
+
+void profile_rest_step_finished_after_time_limit()
+{
+    profile_starts_with_first_step();
+
+    charge_profile.steps[0] = { .type = CHG_STEP_REST,
+                                .termination = CHG_TERM_TIME,
+                                .duration = 60 };
+
+    charger.time_state_changed = time(NULL) - 59;
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL(0, charger.profile_step);
+    TEST_ASSERT_EQUAL(0, bat_terminal.pos_current_limit);
+
+    charger.time_state_changed = time(NULL) - 61;
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL(1, charger.profile_step);
+}
+
+void profile_restarted_after_change_to_shorter_profile()
+{
+    profile_cc_to_cv_at_voltage_limit();
+
+    // new profile with only one step uploaded while in second step
+    charge_profile.num_steps = 1;
+    bat_terminal.bus->voltage = 13.0F;
+    bat_terminal.bus->voltage_filtered = bat_terminal.bus->voltage;
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL(CHG_STATE_PROFILE, charger.state);
+    TEST_ASSERT_EQUAL(0, charger.profile_step);
+
+    // regular update of the profile via ThingSet
+    charger.profile_step = 1;
+    charger.restart_profile();
+    TEST_ASSERT_EQUAL(0, charger.profile_step);
+}
+
+void default_conf_passes_all_checks()
+{
+    BatConf conf = {};
+    uint32_t failed_rules = UINT32_MAX;
+    battery_conf_init(&conf, BAT_TYPE_FLOODED, 6, 100);
+    TEST_ASSERT_TRUE(battery_conf_check(&conf, &failed_rules));
+    TEST_ASSERT_EQUAL_UINT32(0, failed_rules);
+}
+
+void invalid_load_hysteresis_fails_check()
+{
+    BatConf conf = {};
+    uint32_t failed_rules = 0;
+    battery_conf_init(&conf, BAT_TYPE_FLOODED, 6, 100);
+    conf.load_reconnect_voltage = conf.load_disconnect_voltage + 0.2F;
+    TEST_ASSERT_FALSE(battery_conf_check(&conf, &failed_rules));
+    TEST_ASSERT_EQUAL_UINT32(BAT_CONF_RULE_LOAD_HYSTERESIS, failed_rules);
+}
+
+void float_checks_skipped_if_float_disabled()
+{
+    BatConf conf = {};
+    uint32_t failed_rules = 0;
+    battery_conf_init(&conf, BAT_TYPE_FLOODED, 6, 100);
+    conf.float_voltage = conf.topping_voltage + 1.0F;
+    TEST_ASSERT_FALSE(battery_conf_check(&conf, &failed_rules));
+    TEST_ASSERT_EQUAL_UINT32(BAT_CONF_RULE_FLOAT_TOPPING, failed_rules);
+
+    conf.float_enabled = false;
+    TEST_ASSERT_TRUE(battery_conf_check(&conf, &failed_rules));
+    TEST_ASSERT_EQUAL_UINT32(0, failed_rules);
+}
+
 void battery_values_propagated_to_lv_bus_int()
 {
     TEST_ASSERT(0);
@@ -320,13 +708,40 @@ int bat_charger_tests()
 
     // RUN_TEST(restart_bulk_from_float_if_voltage_drops);
 
-    // TODO: temperature compensation
+    RUN_TEST(temperature_compensation_outside_deadband_only);
+    RUN_TEST(setpoints_updated_after_conf_change);
+
+    RUN_TEST(detect_two_batteries_after_observation_time);
+    RUN_TEST(no_battery_detection_for_ambiguous_voltage);
+    RUN_TEST(detect_deeply_discharged_batteries);
+    RUN_TEST(battery_detection_fallback_after_timeout);
+    RUN_TEST(battery_detection_considers_hardware_limit);
+
+    RUN_TEST(temperature_estimation_follows_ambient);
+    RUN_TEST(temperature_estimation_includes_resistive_heating);
+    RUN_TEST(temperature_estimation_with_invalid_time_constant);
+
     // TODO: current compensation
 
     RUN_TEST(stop_discharge_at_low_voltage);
     RUN_TEST(stop_discharge_at_overtemp);
     RUN_TEST(stop_discharge_at_undertemp);
     RUN_TEST(restart_discharge_if_allowed);
+    RUN_TEST(deep_discharge_not_counted_for_load_manager_shedding);
+
+    // custom charge profiles
+    RUN_TEST(profile_encode_decode_roundtrip);
+    RUN_TEST(profile_decode_rejects_invalid_data);
+    RUN_TEST(profile_starts_with_first_step);
+    RUN_TEST(profile_cc_to_cv_at_voltage_limit);
+    RUN_TEST(profile_finished_at_cutoff_current);
+    RUN_TEST(profile_rest_step_finished_after_time_limit);
+    RUN_TEST(profile_restarted_after_change_to_shorter_profile);
+
+    // configuration plausibility checks
+    RUN_TEST(default_conf_passes_all_checks);
+    RUN_TEST(invalid_load_hysteresis_fails_check);
+    RUN_TEST(float_checks_skipped_if_float_disabled);
 
     // RUN_TEST(battery_values_propagated_to_lv_bus_int);
 
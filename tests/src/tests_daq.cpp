@@ -6,6 +6,7 @@
 
 #include "daq.h"
 #include "daq_stub.h"
+#include "half_bridge.h"
 #include "helper.h"
 #include "setup.h"
 #include "tests.h"
@@ -119,6 +120,31 @@ void adc_alert_lv_undervoltage_triggering()
     TEST_ASSERT_EQUAL(false, dev_stat.has_error(ERR_BAT_UNDERVOLTAGE)); // ToDo
 }
 
+void adc_alert_lv_undervoltage_keeps_dcdc_state()
+{
+    battery_conf_init(&bat_conf, BAT_TYPE_LFP, 4, 100);
+    daq_set_lv_limits(bat_conf.absolute_max_voltage, bat_conf.absolute_min_voltage);
+    dcdc.state = DCDC_CONTROL_MPPT;
+    half_bridge_start();
+
+    // short dip, e.g. caused by load inrush current
+    adcval.battery_voltage = bat_conf.absolute_min_voltage - 0.1;
+    prepare_adc_readings(adcval);
+    adc_update_value(ADC_POS(v_low));
+    adc_update_value(ADC_POS(v_low));
+
+    // PWM is disabled, but the DC/DC can restart in the next control cycle
+    TEST_ASSERT_EQUAL(false, half_bridge_enabled());
+    TEST_ASSERT_EQUAL(DCDC_CONTROL_MPPT, dcdc.state);
+
+    // reset values
+    adcval.battery_voltage = 13;
+    prepare_adc_readings(adcval);
+    prepare_adc_filtered();
+    daq_update();
+    dcdc.state = DCDC_CONTROL_OFF;
+}
+
 void adc_alert_lv_overvoltage_triggering()
 {
     dev_stat.clear_error(ERR_ANY_ERROR);
@@ -167,6 +193,63 @@ void adc_alert_hv_overvoltage_triggering()
     TEST_ASSERT_EQUAL(DCDC_CONTROL_OFF, dcdc.state);
 }
 
+void power_fail_stops_dcdc_and_load()
+{
+    adcval.battery_voltage = 13;
+    prepare_adc_readings(adcval);
+    prepare_adc_filtered();
+    daq_update();
+    daq_check_power_fail();
+
+    dcdc.state = DCDC_CONTROL_MPPT;
+    load.state = LOAD_STATE_ON;
+
+    // supply voltage collapses, e.g. because the battery was disconnected
+    adcval.battery_voltage = bat_conf.absolute_min_voltage * CONFIG_POWER_FAIL_VOLTAGE_PERCENT
+                                 / 100.0F
+                             - 0.5F;
+    prepare_adc_readings(adcval);
+    prepare_adc_filtered();
+    daq_update();
+    daq_check_power_fail();
+
+    TEST_ASSERT_EQUAL(DCDC_CONTROL_OFF, dcdc.state);
+    TEST_ASSERT_EQUAL(LOAD_STATE_OFF, load.state);
+
+    // reset values
+    adcval.battery_voltage = 13;
+    prepare_adc_readings(adcval);
+    prepare_adc_filtered();
+    daq_update();
+    daq_check_power_fail();
+}
+
+void load_thermal_model_ignores_synchronized_conversions()
+{
+    // scaling of the thermal model input is set up during calibration with zero currents
+    AdcValues zero = adcval;
+    zero.dcdc_current = 0;
+    zero.load_current = 0;
+    prepare_adc_readings(zero);
+    prepare_adc_filtered();
+    calibrate_current_sensors();
+
+    prepare_adc_readings(adcval);
+    prepare_adc_filtered();
+    load.thermal_state = 0;
+
+    // additional conversions synchronized to the PWM switch
+    adc_sample_synchronized = true;
+    adc_update_value(ADC_POS(i_load));
+    TEST_ASSERT_EQUAL(0, load.thermal_state);
+
+    adc_sample_synchronized = false;
+    adc_update_value(ADC_POS(i_load));
+    TEST_ASSERT_NOT_EQUAL(0, load.thermal_state);
+
+    load.thermal_state = 0;
+}
+
 void adc_alert_overflow_prevention()
 {
     // try to set an alert that overflows the 12-bit ADC resolution
@@ -206,9 +289,14 @@ int daq_tests()
     // RUN_TEST(check_temperature_readings);     // TODO
 
     RUN_TEST(adc_alert_lv_undervoltage_triggering);
+    RUN_TEST(adc_alert_lv_undervoltage_keeps_dcdc_state);
     RUN_TEST(adc_alert_lv_overvoltage_triggering);
     RUN_TEST(adc_alert_hv_overvoltage_triggering);
     RUN_TEST(adc_alert_overflow_prevention);
 
+    RUN_TEST(load_thermal_model_ignores_synchronized_conversions);
+
+    RUN_TEST(power_fail_stops_dcdc_and_load);
+
     return UNITY_END();
 }
@@ -10,7 +10,13 @@
 #include <stdio.h>
 #include <time.h>
 
+#include <zephyr/sys/crc.h>
+
+#include "crc_engine.h"
+#include "energy_log.h"
+#include "event_log.h"
 #include "setup.h"
+#include "snapshot.h"
 
 void reset_counters_at_start_of_day()
 {
@@ -18,10 +24,10 @@ void reset_counters_at_start_of_day()
 
     dev_stat.day_counter = 0;
 
-    solar_terminal.neg_energy_Wh = 10.0;
-    bat_terminal.neg_energy_Wh = 3.0;
-    bat_terminal.pos_energy_Wh = 4.0;
-    load.pos_energy_Wh = 9.0;
+    solar_terminal.neg_energy_mWs = 10 * ENERGY_MWS_PER_WH;
+    bat_terminal.neg_energy_mWs = 3 * ENERGY_MWS_PER_WH;
+    bat_terminal.pos_energy_mWs = 4 * ENERGY_MWS_PER_WH;
+    load.pos_energy_mWs = 9 * ENERGY_MWS_PER_WH;
 
     // 5 hours without sun
     for (int i = 0; i <= 5 * 60 * 60; i++) {
@@ -53,6 +59,35 @@ void reset_counters_at_start_of_day()
     TEST_ASSERT_EQUAL(0, load.pos_energy_Wh);
 }
 
+void total_energy_not_truncated_at_start_of_day()
+{
+    bat_terminal.reset_energy();
+    dev_stat.update_energy();
+    uint32_t total_start = dev_stat.bat_chg_total_Wh;
+
+    // remaining daylight of the current day
+    solar_terminal.bus->voltage = bat_terminal.bus->voltage + 1;
+    for (int i = 0; i < 19 * 60 * 60; i++) {
+        dev_stat.update_energy();
+    }
+
+    // two days with 0.6 Wh each should result in 1 Wh total
+    for (int day = 0; day < 2; day++) {
+        bat_terminal.pos_energy_mWs = 6 * ENERGY_MWS_PER_WH / 10;
+
+        solar_terminal.bus->voltage = bat_terminal.bus->voltage - 1;
+        for (int i = 0; i <= 5 * 60 * 60; i++) {
+            dev_stat.update_energy();
+        }
+        solar_terminal.bus->voltage = bat_terminal.bus->voltage + 1;
+        for (int i = 0; i < 19 * 60 * 60; i++) {
+            dev_stat.update_energy();
+        }
+    }
+
+    TEST_ASSERT_EQUAL(total_start + 1, dev_stat.bat_chg_total_Wh);
+}
+
 void dev_stat_new_solar_voltage_max()
 {
     solar_terminal.bus->voltage = 40;
@@ -119,11 +154,324 @@ void dev_stat_new_int_temp_max()
     TEST_ASSERT_EQUAL(22, dev_stat.int_temp_max);
 }
 
+void dev_stat_histograms_updated()
+{
+    battery_conf_init(&bat_conf, BAT_TYPE_FLOODED, 6, 100);
+    dev_stat.reset_histograms();
+
+    bat_terminal.bus->voltage = bat_conf.absolute_min_voltage - 1; // below range: first bin
+    charger.soc = 55;
+    charger.bat_temperature = 25;
+    bat_terminal.current = -30; // 0.3C discharging
+
+    dev_stat.update_histograms();
+    dev_stat.update_histograms();
+
+    TEST_ASSERT_EQUAL(2, dev_stat.bat_hist.voltage[0]);
+    TEST_ASSERT_EQUAL(2, dev_stat.bat_hist.soc[5]);
+    TEST_ASSERT_EQUAL(2, dev_stat.bat_hist.temp[9]);
+    TEST_ASSERT_EQUAL(2, dev_stat.bat_hist.c_rate[2]);
+
+    dev_stat.reset_histograms();
+    TEST_ASSERT_EQUAL(0, dev_stat.bat_hist.voltage[0]);
+}
+
+void dev_stat_histograms_with_invalid_values()
+{
+    battery_conf_init(&bat_conf, BAT_TYPE_FLOODED, 6, 100);
+    dev_stat.reset_histograms();
+
+    bat_terminal.bus->voltage = 1e12; // far above the range of int
+    charger.bat_temperature = NAN;    // e.g. failed sensor reading
+
+    dev_stat.update_histograms();
+
+    TEST_ASSERT_EQUAL(1, dev_stat.bat_hist.voltage[HIST_VOLTAGE_BINS - 1]);
+    TEST_ASSERT_EQUAL(1, dev_stat.bat_hist.temp[0]);
+
+    bat_terminal.bus->voltage = 12;
+    charger.bat_temperature = 25;
+    dev_stat.reset_histograms();
+}
+
+void dev_stat_histogram_counters_saturate()
+{
+    battery_conf_init(&bat_conf, BAT_TYPE_FLOODED, 6, 100);
+    dev_stat.reset_histograms();
+    dev_stat.bat_hist.voltage[HIST_VOLTAGE_BINS - 1] = UINT32_MAX - 1;
+    dev_stat.bat_hist.soc[HIST_SOC_BINS - 1] = UINT32_MAX - 1;
+
+    bat_terminal.bus->voltage = bat_conf.absolute_max_voltage + 1; // above range: last bin
+    charger.soc = 100;
+
+    dev_stat.update_histograms();
+    dev_stat.update_histograms();
+
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, dev_stat.bat_hist.voltage[HIST_VOLTAGE_BINS - 1]);
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, dev_stat.bat_hist.soc[HIST_SOC_BINS - 1]);
+}
+
+// simulates one day with sunrise after the given time (s) and sunset 12 hours later
+static int day_detector_run_day(DayDetector *det, uint32_t *time, int sunrise)
+{
+    int new_days = 0;
+    for (int i = 0; i < DAY_LENGTH; i++) {
+        bool sun = i >= sunrise && i < sunrise + 12 * 60 * 60;
+        new_days += det->update(sun, (*time)++);
+    }
+    return new_days;
+}
+
+void day_detector_storm_not_detected_as_sunrise()
+{
+    DayDetector det;
+    uint32_t time = 0;
+
+    // first sunrise detected after 6 hours of night (no statistics yet)
+    TEST_ASSERT_EQUAL(1, day_detector_run_day(&det, &time, 6 * 60 * 60));
+    TEST_ASSERT_EQUAL(1, day_detector_run_day(&det, &time, 6 * 60 * 60));
+    TEST_ASSERT_EQUAL(1, day_detector_run_day(&det, &time, 6 * 60 * 60));
+    TEST_ASSERT_EQUAL(6 * 60, det.sunrise_min);
+    TEST_ASSERT_EQUAL(18 * 60, det.sunset_min);
+
+    // storm or snow cover from 10:00 to 16:00 (6 hours without solar power)
+    int new_days = 0;
+    for (int i = 0; i < DAY_LENGTH; i++) {
+        int hour = i / (60 * 60);
+        bool sun = (hour >= 6 && hour < 10) || (hour >= 16 && hour < 18);
+        new_days += det.update(sun, time++);
+    }
+    TEST_ASSERT_EQUAL(1, new_days);
+}
+
+void day_detector_new_day_without_sunrise()
+{
+    DayDetector det;
+    uint32_t time = 0;
+
+    day_detector_run_day(&det, &time, 6 * 60 * 60);
+    day_detector_run_day(&det, &time, 6 * 60 * 60);
+
+    // no sun at all for two days: new day at expected sunrise + tolerance
+    int new_days = 0;
+    for (int i = 0; i < 2 * DAY_LENGTH; i++) {
+        if (det.update(false, time++)) {
+            new_days++;
+            TEST_ASSERT_EQUAL(8 * 60 * 60, (time - 1) % DAY_LENGTH);
+        }
+    }
+    TEST_ASSERT_EQUAL(2, new_days);
+}
+
+void day_detector_uses_local_time_if_clock_set()
+{
+    DayDetector det;
+    det.tz_offset = 120; // UTC+2
+    uint32_t time = 1700000000 - 1700000000 % DAY_LENGTH; // 00:00 UTC
+
+    TEST_ASSERT_FALSE(det.update(false, time));
+    TEST_ASSERT_EQUAL(6 * 60, det.sunrise_min);
+
+    // no solar input: new day at 08:00 local time = 06:00 UTC
+    int new_days = 0;
+    for (int i = 1; i < DAY_LENGTH; i++) {
+        if (det.update(false, time + i)) {
+            new_days++;
+            TEST_ASSERT_EQUAL(6 * 60 * 60, i);
+        }
+    }
+    TEST_ASSERT_EQUAL(1, new_days);
+}
+
+void energy_log_hourly_record_completed()
+{
+    EnergyLog log;
+    EnergyLogSample sample = {};
+    sample.timestamp = 3600;
+    sample.solar_in_total_Wh = 100;
+    sample.bat_voltage = 12.5;
+    sample.soc = 80;
+
+    TEST_ASSERT_EQUAL(0, log.update(sample));
+
+    for (int i = 1; i < 3600; i++) {
+        sample.timestamp++;
+        sample.bat_voltage = (i == 1000) ? 12.1 : (i == 2000) ? 13.9 : 12.5;
+        TEST_ASSERT_EQUAL(0, log.update(sample));
+    }
+
+    sample.timestamp++;
+    sample.solar_in_total_Wh = 150;
+    sample.soc = 90;
+    TEST_ASSERT_EQUAL(1U << ENERGY_LOG_HOURLY, log.update(sample));
+
+    EnergyLogRecord *rec = &log.completed[ENERGY_LOG_HOURLY];
+    TEST_ASSERT_EQUAL(7200, rec->timestamp);
+    TEST_ASSERT_EQUAL(50, rec->solar_in_Wh);
+    TEST_ASSERT_EQUAL(12100, rec->bat_voltage_min_mV);
+    TEST_ASSERT_EQUAL(13900, rec->bat_voltage_max_mV);
+    TEST_ASSERT_EQUAL(90, rec->soc);
+}
+
+void energy_log_hourly_record_restarted_when_clock_set()
+{
+    EnergyLog log;
+    EnergyLogSample sample = {};
+    sample.timestamp = 100;
+    sample.solar_in_total_Wh = 100;
+
+    log.update(sample);
+    for (int i = 1; i < 600; i++) {
+        sample.timestamp++;
+        TEST_ASSERT_EQUAL(0, log.update(sample));
+    }
+
+    // clock set to 2022-01-01 00:30 UTC
+    uint32_t clock = 1640997000;
+    sample.timestamp = clock;
+    sample.solar_in_total_Wh = 120;
+    TEST_ASSERT_EQUAL(1U << ENERGY_LOG_HOURLY, log.update(sample));
+
+    EnergyLogRecord *rec = &log.completed[ENERGY_LOG_HOURLY];
+    TEST_ASSERT_EQUAL(699, rec->timestamp);
+    TEST_ASSERT_EQUAL(20, rec->solar_in_Wh);
+
+    // next record ends at the full hour of the new clock
+    for (int i = 1; i < 1800; i++) {
+        sample.timestamp++;
+        TEST_ASSERT_EQUAL(0, log.update(sample));
+    }
+    sample.timestamp++;
+    sample.solar_in_total_Wh = 150;
+    TEST_ASSERT_EQUAL(1U << ENERGY_LOG_HOURLY, log.update(sample));
+    TEST_ASSERT_EQUAL(clock + 1800, rec->timestamp);
+    TEST_ASSERT_EQUAL(30, rec->solar_in_Wh);
+}
+
+void energy_log_daily_record_with_soc_at_dusk()
+{
+    EnergyLog log;
+    EnergyLogSample sample = {};
+    sample.day = 5;
+    sample.bat_dis_total_Wh = 10;
+    sample.bat_temp = 20;
+    sample.soc = 70;
+
+    log.update(sample);
+
+    sample.bat_temp = 35;
+    sample.seconds_zero_solar = ENERGY_LOG_DUSK_DELAY;
+    log.update(sample);
+
+    sample.soc = 40;
+    sample.bat_temp = 25;
+    sample.bat_dis_total_Wh = 30;
+    sample.seconds_zero_solar = 0;
+    sample.day = 6;
+    TEST_ASSERT_EQUAL(1U << ENERGY_LOG_DAILY, log.update(sample));
+
+    EnergyLogRecord *rec = &log.completed[ENERGY_LOG_DAILY];
+    TEST_ASSERT_EQUAL(5, rec->day);
+    TEST_ASSERT_EQUAL(20, rec->bat_dis_Wh);
+    TEST_ASSERT_EQUAL(35, rec->bat_temp_max);
+    TEST_ASSERT_EQUAL(70, rec->soc);
+}
+
+void error_flag_transitions_recorded_in_event_log()
+{
+    EventLogEntry entry;
+
+    dev_stat.clear_error(ERR_ANY_ERROR);
+    while (event_log_get(&entry)) {
+        // discard events of previous tests
+    }
+
+    bat_terminal.bus->voltage = 10.5;
+    dev_stat.set_error(ERR_BAT_UNDERVOLTAGE | ERR_INT_OVERTEMP);
+    dev_stat.set_error(ERR_BAT_UNDERVOLTAGE); // already set: no new event
+    dev_stat.clear_error(ERR_BAT_UNDERVOLTAGE | ERR_BAT_OVERVOLTAGE);
+
+    TEST_ASSERT_TRUE(event_log_get(&entry));
+    TEST_ASSERT_EQUAL(EVENT_SOURCE_DEVICE, entry.source);
+    TEST_ASSERT_EQUAL(0, entry.flag);
+    TEST_ASSERT_EQUAL(1, entry.active);
+    TEST_ASSERT_EQUAL_FLOAT(10.5, entry.bat_voltage);
+
+    TEST_ASSERT_TRUE(event_log_get(&entry));
+    TEST_ASSERT_EQUAL(13, entry.flag);
+    TEST_ASSERT_EQUAL(1, entry.active);
+
+    TEST_ASSERT_TRUE(event_log_get(&entry));
+    TEST_ASSERT_EQUAL(0, entry.flag);
+    TEST_ASSERT_EQUAL(0, entry.active);
+
+    TEST_ASSERT_FALSE(event_log_get(&entry));
+}
+
+void crc_engine_standard_crc32()
+{
+    static uint8_t buf[1024];
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = (uint8_t)(i * 7 + 3);
+    }
+
+    // check value of CRC-32 (IEEE 802.3)
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926, crc_engine_crc32("123456789", 9));
+
+    // unaligned start and end as well as lengths above the DMA threshold
+    TEST_ASSERT_EQUAL_HEX32(crc32_ieee(buf + 1, 6), crc_engine_crc32(buf + 1, 6));
+    TEST_ASSERT_EQUAL_HEX32(crc32_ieee(buf + 3, 1021), crc_engine_crc32(buf + 3, 1021));
+    TEST_ASSERT_EQUAL_HEX32(0, crc_engine_crc32(buf, 0));
+}
+
+void crc_engine_legacy_crc_does_not_affect_crc32()
+{
+    // words fed MSB first by the STM32 CRC unit in its default configuration
+    TEST_ASSERT_EQUAL_HEX32(0xAFF19057, crc_engine_crc32_legacy("123456789", 9));
+
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926, crc_engine_crc32("123456789", 9));
+    TEST_ASSERT_EQUAL_HEX32(0xAFF19057, crc_engine_crc32_legacy("123456789", 9));
+}
+
+void snapshot_restores_runtime_state()
+{
+    charger.state = CHG_STATE_FLOAT;
+    charger.soc = 87;
+    dev_stat.day_counter = 12;
+    bat_terminal.pos_energy_mWs = 123456;
+    snapshot_save();
+
+    charger.state = CHG_STATE_IDLE;
+    charger.soc = 0;
+    dev_stat.day_counter = 0;
+    bat_terminal.pos_energy_mWs = 0;
+    TEST_ASSERT_TRUE(snapshot_restore());
+
+    TEST_ASSERT_EQUAL(CHG_STATE_FLOAT, charger.state);
+    TEST_ASSERT_EQUAL(87, charger.soc);
+    TEST_ASSERT_EQUAL(12, dev_stat.day_counter);
+    TEST_ASSERT_EQUAL(123456, bat_terminal.pos_energy_mWs);
+}
+
+void snapshot_ignored_after_repeated_restores()
+{
+    snapshot_save();
+
+    for (int i = 0; i < SNAPSHOT_RESTORE_MAX; i++) {
+        TEST_ASSERT_TRUE(snapshot_restore());
+    }
+    TEST_ASSERT_FALSE(snapshot_restore());
+
+    // snapshot was invalidated
+    TEST_ASSERT_FALSE(snapshot_restore());
+}
+
 int device_status_tests()
 {
     UNITY_BEGIN();
 
     RUN_TEST(reset_counters_at_start_of_day);
+    RUN_TEST(total_energy_not_truncated_at_start_of_day);
 
     RUN_TEST(dev_stat_new_solar_voltage_max);
     RUN_TEST(dev_stat_new_bat_voltage_max);
@@ -135,5 +483,25 @@ int device_status_tests()
     RUN_TEST(dev_stat_new_bat_temp_max);
     RUN_TEST(dev_stat_new_int_temp_max);
 
+    RUN_TEST(day_detector_storm_not_detected_as_sunrise);
+    RUN_TEST(day_detector_new_day_without_sunrise);
+    RUN_TEST(day_detector_uses_local_time_if_clock_set);
+
+    RUN_TEST(dev_stat_histograms_updated);
+    RUN_TEST(dev_stat_histograms_with_invalid_values);
+    RUN_TEST(dev_stat_histogram_counters_saturate);
+
+    RUN_TEST(error_flag_transitions_recorded_in_event_log);
+
+    RUN_TEST(crc_engine_standard_crc32);
+    RUN_TEST(crc_engine_legacy_crc_does_not_affect_crc32);
+
+    RUN_TEST(snapshot_restores_runtime_state);
+    RUN_TEST(snapshot_ignored_after_repeated_restores);
+
+    RUN_TEST(energy_log_hourly_record_completed);
+    RUN_TEST(energy_log_hourly_record_restarted_when_clock_set);
+    RUN_TEST(energy_log_daily_record_with_soc_at_dusk);
+
     return UNITY_END();
 }
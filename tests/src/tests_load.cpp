@@ -26,6 +26,14 @@ static void load_drv_init()
     output_on = false;
 }
 
+static uint32_t soft_start_duration_ms;
+
+static void load_drv_soft_start(uint32_t duration_ms)
+{
+    soft_start_duration_ms = duration_ms;
+    output_on = true;
+}
+
 static void load_init(LoadOutput *l, bool on = false, int num_batteries = 1)
 {
     l->overvoltage = 14.6;
@@ -37,7 +45,7 @@ static void load_init(LoadOutput *l, bool on = false, int num_batteries = 1)
     l->bus->src_voltage_intercept = 12;
     l->bus->sink_current_margin = 10;
     l->bus->src_current_margin = -10;
-    l->junction_temperature = 25;
+    l->thermal_state = 0;
     l->error_flags = 0;
     l->enable = true;
 
@@ -75,6 +83,52 @@ static void control_off_to_on_if_everything_fine_dual_battery()
     TEST_ASSERT_EQUAL(LOAD_STATE_ON, load_out.state);
 }
 
+static void control_off_to_on_with_soft_start()
+{
+    DcBus bus = {};
+    LoadOutput load_out(&bus, &load_drv_set, &load_drv_init, NULL, &load_drv_soft_start);
+    load_init(&load_out);
+    load_out.soft_start_duration = 500;
+
+    load_out.enable = true;
+    load_out.control();
+    TEST_ASSERT_EQUAL(500, soft_start_duration_ms);
+    TEST_ASSERT_EQUAL(LOAD_STATE_SOFT_START, load_out.state);
+
+    // inrush current during ramp is accepted
+    load_out.current = LOAD_CURRENT_MAX * 1.5;
+    for (int i = 0; i < CONFIG_CONTROL_FREQUENCY / 2 - 1; i++) {
+        load_out.control();
+    }
+    TEST_ASSERT_EQUAL(LOAD_STATE_SOFT_START, load_out.state);
+
+    load_out.current = LOAD_CURRENT_MAX * 0.5;
+    load_out.control();
+    TEST_ASSERT_EQUAL(0, load_out.error_flags);
+    TEST_ASSERT_EQUAL(LOAD_STATE_ON, load_out.state);
+}
+
+static void control_soft_start_to_off_if_current_not_settled()
+{
+    DcBus bus = {};
+    LoadOutput load_out(&bus, &load_drv_set, &load_drv_init, NULL, &load_drv_soft_start);
+    load_init(&load_out);
+    load_out.soft_start_duration = 500;
+
+    load_out.enable = true;
+    load_out.control();
+    TEST_ASSERT_EQUAL(LOAD_STATE_SOFT_START, load_out.state);
+
+    // current stays above rated value for twice the soft-start duration
+    load_out.current = LOAD_CURRENT_MAX * 1.5;
+    for (int i = 0; i < CONFIG_CONTROL_FREQUENCY; i++) {
+        load_out.control();
+    }
+    TEST_ASSERT_EQUAL(ERR_LOAD_OVERCURRENT, load_out.error_flags);
+    TEST_ASSERT_EQUAL(LOAD_STATE_OFF, load_out.state);
+    TEST_ASSERT_EQUAL(false, output_on);
+}
+
 static void control_on_to_off_shedding()
 {
     DcBus bus = {};
@@ -85,6 +139,7 @@ static void control_on_to_off_shedding()
     load_out.control();
     TEST_ASSERT_EQUAL(ERR_LOAD_SHEDDING, load_out.error_flags);
     TEST_ASSERT_EQUAL(LOAD_STATE_OFF, load_out.state);
+    TEST_ASSERT_EQUAL(true, load_out.low_voltage_disconnect);
 }
 
 void control_on_to_off_overvoltage()
@@ -136,20 +191,39 @@ void control_on_to_off_overcurrent()
     load_init(&load_out, true);
 
     // current slightly below factor 2 so that it is not switched off immediately
-    load_out.current = DT_PROP(DT_CHILD(DT_PATH(outputs), load), current_max) * 1.9;
+    load_out.current = LOAD_CURRENT_MAX * 1.9;
+    uint32_t current_sq = 1.9 * 1.9 * (1U << LOAD_THERMAL_Q);
     load_out.control();
+    load_out.thermal_model_update(current_sq);
     TEST_ASSERT_EQUAL(LOAD_STATE_ON, load_out.state);
 
     // almost 2x current = 4x heat generation: Should definitely trigger after waiting one time
     // constant
-    int trigger_steps = DT_PROP(DT_PATH(pcb), mosfets_tau_ja) * CONFIG_CONTROL_FREQUENCY;
+    int trigger_steps = DT_PROP(DT_PATH(pcb), mosfets_tau_ja) * LOAD_THERMAL_MODEL_RATE;
     for (int i = 0; i <= trigger_steps; i++) {
-        load_out.control();
+        load_out.thermal_model_update(current_sq);
     }
     TEST_ASSERT_EQUAL(ERR_LOAD_OVERCURRENT, load_out.error_flags);
     TEST_ASSERT_EQUAL(LOAD_STATE_OFF, load_out.state);
 }
 
+void control_thermal_model_nominal_current()
+{
+    DcBus bus = {};
+    LoadOutput load_out(&bus, &load_drv_set, &load_drv_init, NULL);
+    load_init(&load_out, true);
+
+    // continuous operation at nominal current must not trigger overcurrent protection
+    load_out.current = LOAD_CURRENT_MAX;
+    load_out.control();
+    int steps = 10 * DT_PROP(DT_PATH(pcb), mosfets_tau_ja) * LOAD_THERMAL_MODEL_RATE;
+    for (int i = 0; i < steps; i++) {
+        load_out.thermal_model_update(1U << LOAD_THERMAL_Q);
+    }
+    TEST_ASSERT_EQUAL(0, load_out.error_flags);
+    TEST_ASSERT_EQUAL(LOAD_STATE_ON, load_out.state);
+}
+
 void control_on_to_off_voltage_dip()
 {
     DcBus bus = {};
@@ -289,6 +363,177 @@ void control_off_short_circuit_flag_reset()
     TEST_ASSERT_EQUAL(LOAD_STATE_ON, load_out.state);
 }
 
+void control_off_shedding_to_on_after_shedding_request_reset()
+{
+    DcBus bus = {};
+    LoadOutput load_out(&bus, &load_drv_set, &load_drv_init, NULL);
+    load_init(&load_out, true);
+
+    load_out.shedding_request = true;
+    load_out.control();
+    TEST_ASSERT_EQUAL(ERR_LOAD_SHEDDING, load_out.error_flags);
+    TEST_ASSERT_EQUAL(LOAD_STATE_OFF, load_out.state);
+    TEST_ASSERT_EQUAL(false, load_out.low_voltage_disconnect);
+
+    load_out.lvd_timestamp = time(NULL) - load_out.lvd_recovery_delay - 1;
+    load_out.control();
+    TEST_ASSERT_EQUAL(LOAD_STATE_OFF, load_out.state);
+
+    load_out.shedding_request = false;
+    load_out.control();
+    TEST_ASSERT_EQUAL(0, load_out.error_flags);
+    TEST_ASSERT_EQUAL(LOAD_STATE_ON, load_out.state);
+}
+
+void load_manager_sheds_lower_priority_first()
+{
+    DcBus bus = {};
+    LoadOutput low_prio(&bus, &load_drv_set, &load_drv_init, NULL);
+    LoadOutput high_prio(&bus, &load_drv_set, &load_drv_init, NULL);
+    LoadManager manager;
+
+    low_prio.priority = 1;
+    low_prio.shedding_soc = 40;
+    low_prio.reconnect_soc = 50;
+    high_prio.priority = 2;
+    high_prio.shedding_soc = 20;
+    high_prio.reconnect_soc = 30;
+
+    // add in wrong order to check sorting
+    manager.add_output(&high_prio);
+    manager.add_output(&low_prio);
+
+    manager.update(35, 1000, 0, 0);
+    TEST_ASSERT_EQUAL(true, low_prio.shedding_request);
+    TEST_ASSERT_EQUAL(false, high_prio.shedding_request);
+
+    manager.update(15, 1000, 0, 0);
+    TEST_ASSERT_EQUAL(true, low_prio.shedding_request);
+    TEST_ASSERT_EQUAL(true, high_prio.shedding_request);
+
+    // reconnection hysteresis of high priority output also keeps low priority output off
+    manager.update(25, 1000, 0, 0);
+    TEST_ASSERT_EQUAL(true, low_prio.shedding_request);
+    TEST_ASSERT_EQUAL(true, high_prio.shedding_request);
+
+    manager.update(35, 1000, 0, 0);
+    TEST_ASSERT_EQUAL(true, low_prio.shedding_request);
+    TEST_ASSERT_EQUAL(false, high_prio.shedding_request);
+
+    manager.update(55, 1000, 0, 0);
+    TEST_ASSERT_EQUAL(false, low_prio.shedding_request);
+    TEST_ASSERT_EQUAL(false, high_prio.shedding_request);
+}
+
+void load_manager_forecast_considers_solar_and_consumption()
+{
+    DcBus bus = {};
+    LoadOutput load_out(&bus, &load_drv_set, &load_drv_init, NULL);
+    LoadManager manager;
+    manager.add_output(&load_out);
+
+    // no forecast before the solar yield of a full day is known
+    manager.update(50, 1000, 100, 0);
+    manager.update(50, 1000, 200, 1);
+    TEST_ASSERT_EQUAL_FLOAT(50, manager.soc_forecast);
+
+    // 500 Wh solar during the previous day
+    manager.update(50, 1000, 700, 2);
+    TEST_ASSERT_EQUAL(500, manager.solar_yesterday_Wh);
+    TEST_ASSERT_EQUAL_FLOAT(100, manager.soc_forecast);
+
+    // 10 W constant consumption for several hours (240 Wh per day)
+    load_out.state = LOAD_STATE_ON;
+    load_out.power = 10;
+    for (int i = 0; i < 60 * 60 * 10; i++) {
+        manager.update(50, 1000, 700, 2);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.5, 50 + (500 - 240) / 10, manager.soc_forecast);
+}
+
+void schedule_on_after_dusk_for_configured_time()
+{
+    DcBus bus = {};
+    LoadOutput load_out(&bus, &load_drv_set, &load_drv_init, NULL);
+    load_init(&load_out, true);
+    load_out.schedule_enable = true;
+    load_out.schedule_dusk_min = 4 * 60;
+
+    // daytime
+    load_out.schedule_update(0, 0);
+    TEST_ASSERT_EQUAL(false, load_out.scheduled_on);
+    load_out.control();
+    TEST_ASSERT_EQUAL(LOAD_STATE_OFF, load_out.state);
+
+    // shortly after sunset (not yet considered as dusk)
+    load_out.schedule_update(LOAD_SCHEDULE_DUSK_DELAY - 1, 0);
+    TEST_ASSERT_EQUAL(false, load_out.scheduled_on);
+
+    load_out.schedule_update(LOAD_SCHEDULE_DUSK_DELAY, 0);
+    TEST_ASSERT_EQUAL(true, load_out.scheduled_on);
+    load_out.control();
+    TEST_ASSERT_EQUAL(LOAD_STATE_ON, load_out.state);
+
+    load_out.schedule_update(4 * 60 * 60, 0);
+    TEST_ASSERT_EQUAL(false, load_out.scheduled_on);
+}
+
+void schedule_on_before_predicted_dawn()
+{
+    DcBus bus = {};
+    LoadOutput load_out(&bus, &load_drv_set, &load_drv_init, NULL);
+    load_out.schedule_enable = true;
+    load_out.schedule_dawn_min = 60;
+
+    // first night: length unknown, so dawn can't be predicted
+    load_out.schedule_update(10 * 60 * 60, 0);
+    TEST_ASSERT_EQUAL(false, load_out.scheduled_on);
+
+    // sunrise after 10 hours of night
+    load_out.schedule_update(0, 0);
+
+    load_out.schedule_update(8 * 60 * 60, 0);
+    TEST_ASSERT_EQUAL(false, load_out.scheduled_on);
+
+    load_out.schedule_update(9 * 60 * 60, 0);
+    TEST_ASSERT_EQUAL(true, load_out.scheduled_on);
+
+    // stays on if the night is longer than predicted
+    load_out.schedule_update(11 * 60 * 60, 0);
+    TEST_ASSERT_EQUAL(true, load_out.scheduled_on);
+
+    load_out.schedule_update(0, 0);
+    TEST_ASSERT_EQUAL(false, load_out.scheduled_on);
+}
+
+void schedule_clock_window_across_midnight()
+{
+    DcBus bus = {};
+    LoadOutput load_out(&bus, &load_drv_set, &load_drv_init, NULL);
+    load_out.schedule_enable = true;
+    load_out.schedule_clock_on = 22 * 60;
+    load_out.schedule_clock_off = 6 * 60;
+
+    uint32_t day_start = 1600000000 - 1600000000 % (24 * 60 * 60);
+
+    load_out.schedule_update(0, day_start + 12 * 60 * 60);
+    TEST_ASSERT_EQUAL(false, load_out.scheduled_on);
+
+    load_out.schedule_update(0, day_start + 23 * 60 * 60);
+    TEST_ASSERT_EQUAL(true, load_out.scheduled_on);
+
+    load_out.schedule_update(0, day_start + 24 * 60 * 60 + 5 * 60 * 60);
+    TEST_ASSERT_EQUAL(true, load_out.scheduled_on);
+
+    load_out.schedule_update(0, day_start + 24 * 60 * 60 + 6 * 60 * 60);
+    TEST_ASSERT_EQUAL(false, load_out.scheduled_on);
+
+    // disabled schedule does not restrict the output
+    load_out.schedule_enable = false;
+    load_out.schedule_update(0, day_start + 12 * 60 * 60);
+    TEST_ASSERT_EQUAL(true, load_out.scheduled_on);
+}
+
 int load_tests()
 {
     UNITY_BEGIN();
@@ -296,10 +541,13 @@ int load_tests()
     // control tests
     RUN_TEST(control_off_to_on_if_everything_fine);
     RUN_TEST(control_off_to_on_if_everything_fine_dual_battery);
+    RUN_TEST(control_off_to_on_with_soft_start);
+    RUN_TEST(control_soft_start_to_off_if_current_not_settled);
     RUN_TEST(control_on_to_off_shedding);
     RUN_TEST(control_on_to_off_overvoltage);
     RUN_TEST(control_on_to_off_overvoltage_dual_battery);
     RUN_TEST(control_on_to_off_overcurrent);
+    RUN_TEST(control_thermal_model_nominal_current);
     RUN_TEST(control_on_to_off_voltage_dip);
     RUN_TEST(control_on_to_off_bus_limit);
     RUN_TEST(control_on_to_off_if_enable_false);
@@ -309,6 +557,16 @@ int load_tests()
     RUN_TEST(control_off_overvoltage_to_on_at_lower_voltage);
     RUN_TEST(control_off_overvoltage_to_on_at_lower_voltage_dual_battery);
     RUN_TEST(control_off_short_circuit_flag_reset);
+    RUN_TEST(control_off_shedding_to_on_after_shedding_request_reset);
+
+    // load manager tests
+    RUN_TEST(load_manager_sheds_lower_priority_first);
+    RUN_TEST(load_manager_forecast_considers_solar_and_consumption);
+
+    // schedule tests
+    RUN_TEST(schedule_on_after_dusk_for_configured_time);
+    RUN_TEST(schedule_on_before_predicted_dawn);
+    RUN_TEST(schedule_clock_window_across_midnight);
 
     // ToDo: What to do if port current is above the limit, but the hardware can still handle it?
 
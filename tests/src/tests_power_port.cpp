@@ -21,16 +21,30 @@ const float load_current = 1;
 const int sun_hours = 1;
 const int night_hours = 3;
 
+// energy integration at control loop frequency
+const int sample_interval_ms = 1000 / CONFIG_CONTROL_FREQUENCY;
+
+static int64_t timestamp_ms;
+
+static void energy_balance_for_hours(int hours)
+{
+    for (int i = 0; i < 60 * 60 * CONFIG_CONTROL_FREQUENCY * hours; i++) {
+        timestamp_ms += sample_interval_ms;
+        hv_terminal.energy_balance(timestamp_ms);
+        lv_terminal.energy_balance(timestamp_ms);
+        load.energy_balance(timestamp_ms);
+    }
+}
+
 void energy_calculation_init()
 {
     dev_stat.solar_in_total_Wh = 0;
     dev_stat.load_out_total_Wh = 0;
     dev_stat.bat_chg_total_Wh = 0;
     dev_stat.bat_dis_total_Wh = 0;
-    hv_terminal.neg_energy_Wh = 0.0;
-    load.pos_energy_Wh = 0.0;
-    lv_terminal.pos_energy_Wh = 0.0;
-    lv_terminal.neg_energy_Wh = 0.0;
+    hv_terminal.reset_energy();
+    load.reset_energy();
+    lv_terminal.reset_energy();
 
     // set desired measurement values
     adcval.bat_temperature = 25;
@@ -46,11 +60,12 @@ void energy_calculation_init()
     prepare_adc_filtered();
     daq_update();
 
-    for (int i = 0; i < 60 * 60 * sun_hours; i++) {
-        hv_terminal.energy_balance();
-        lv_terminal.energy_balance();
-        load.energy_balance();
-    }
+    // start with valid previous sample
+    hv_terminal.energy_balance(timestamp_ms);
+    lv_terminal.energy_balance(timestamp_ms);
+    load.energy_balance(timestamp_ms);
+
+    energy_balance_for_hours(sun_hours);
 
     // disable DC/DC = solar charging
     adcval.dcdc_current = 0;
@@ -58,11 +73,11 @@ void energy_calculation_init()
     prepare_adc_filtered();
     daq_update();
 
-    for (int i = 0; i < 60 * 60 * night_hours; i++) {
-        hv_terminal.energy_balance();
-        lv_terminal.energy_balance();
-        load.energy_balance();
-    }
+    energy_balance_for_hours(night_hours);
+
+    hv_terminal.update_energy_Wh();
+    lv_terminal.update_energy_Wh();
+    load.update_energy_Wh();
 }
 
 void charging_energy_calculation_valid()
@@ -97,6 +112,180 @@ void load_output_energy_calculation_valid()
         round(load.pos_energy_Wh));
 }
 
+void energy_integration_trapezoidal()
+{
+    DcBus bus;
+    PowerPort port(&bus);
+    bus.voltage = 10;
+
+    port.current = 0;
+    port.energy_balance(0);
+    port.current = 3.6;
+    port.energy_balance(1000);
+
+    // ramp from 0 to 36 W within 1 s
+    TEST_ASSERT_EQUAL(18000, port.pos_energy_mWs);
+    TEST_ASSERT_EQUAL(0, port.neg_energy_mWs);
+
+    // sign change from +36 W to -36 W: half of the interval in each direction
+    port.current = -3.6;
+    port.energy_balance(2000);
+    TEST_ASSERT_EQUAL(27000, port.pos_energy_mWs);
+    TEST_ASSERT_EQUAL(9000, port.neg_energy_mWs);
+}
+
+void energy_integration_skips_long_gaps()
+{
+    DcBus bus;
+    PowerPort port(&bus);
+    bus.voltage = 10;
+    port.current = 3.6;
+
+    // first sample and samples after a long gap are only used as start point
+    port.energy_balance(0);
+    port.energy_balance(ENERGY_BALANCE_MAX_GAP_MS + 1);
+    TEST_ASSERT_EQUAL(0, port.pos_energy_mWs);
+
+    port.energy_balance(ENERGY_BALANCE_MAX_GAP_MS + 501);
+    TEST_ASSERT_EQUAL(18000, port.pos_energy_mWs);
+}
+
+void energy_counter_no_precision_loss()
+{
+    DcBus bus;
+    PowerPort port(&bus);
+    bus.voltage = 12;
+    port.current = 1.0 / 12; // 1 W
+
+    // start with 10 kWh (float increments of 1 W for 100 ms would get lost)
+    port.pos_energy_mWs = 10000 * ENERGY_MWS_PER_WH;
+    for (int i = 0; i <= 36000; i++) {
+        port.energy_balance(i * 100);
+    }
+    port.update_energy_Wh();
+
+    TEST_ASSERT_EQUAL(10000 * ENERGY_MWS_PER_WH + 3600000, port.pos_energy_mWs);
+    TEST_ASSERT_EQUAL_FLOAT(10001.0, port.pos_energy_Wh);
+}
+
+void energy_integration_of_low_power()
+{
+    DcBus bus;
+    PowerPort port(&bus);
+    bus.voltage = 12;
+    port.current = 0.004 / 12; // 4 mW, i.e. 0.4 mWs per sample
+
+    for (int i = 0; i <= 36000; i++) {
+        port.energy_balance(i * 100);
+    }
+
+    TEST_ASSERT_FLOAT_WITHIN(1, 14400, port.pos_energy_mWs);
+}
+
+void energy_reset_returns_previous_values()
+{
+    DcBus bus;
+    PowerPort port(&bus);
+    port.pos_energy_mWs = 18000;
+    port.neg_energy_mWs = 9000;
+
+    int64_t pos_mWs, neg_mWs;
+    port.reset_energy(&pos_mWs, &neg_mWs);
+    TEST_ASSERT_EQUAL(18000, pos_mWs);
+    TEST_ASSERT_EQUAL(9000, neg_mWs);
+
+    port.get_energy(&pos_mWs, &neg_mWs);
+    TEST_ASSERT_EQUAL(0, pos_mWs);
+    TEST_ASSERT_EQUAL(0, neg_mWs);
+    TEST_ASSERT_EQUAL_FLOAT(0, port.pos_energy_Wh);
+}
+
+void statistics_one_second_window()
+{
+    RollingStats stats;
+
+    // alternating 0 and 2 A: avg 1 A, RMS sqrt(2) A
+    for (int i = 0; i < STATS_SAMPLES_PER_SECOND; i++) {
+        stats.add_sample((i % 2) * 2.0F);
+    }
+    TEST_ASSERT_EQUAL_FLOAT(0, stats.sec_1.min);
+    TEST_ASSERT_EQUAL_FLOAT(1, stats.sec_1.avg);
+    TEST_ASSERT_EQUAL_FLOAT(2, stats.sec_1.max);
+    TEST_ASSERT_EQUAL_FLOAT(sqrtf(2), stats.sec_1.rms);
+
+    // results are kept until the next window is completed
+    stats.add_sample(10);
+    TEST_ASSERT_EQUAL_FLOAT(2, stats.sec_1.max);
+}
+
+void statistics_keep_peaks_in_long_windows()
+{
+    RollingStats stats;
+
+    // 15 minutes of constant 5 W with a single peak of 100 W
+    for (int i = 0; i < 15 * 60 * STATS_SAMPLES_PER_SECOND; i++) {
+        stats.add_sample(i == 1234 ? 100 : 5);
+    }
+    TEST_ASSERT_EQUAL_FLOAT(5, stats.min_15.min);
+    TEST_ASSERT_EQUAL_FLOAT(100, stats.min_15.max);
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 5 + 95.0F / (15 * 60 * STATS_SAMPLES_PER_SECOND),
+                             stats.min_15.avg);
+
+    // the last minute did not contain the peak
+    TEST_ASSERT_EQUAL_FLOAT(5, stats.min_1.max);
+}
+
+void bus_margins_allocated_by_priority()
+{
+    DcBus bus;
+    PowerPort bat(&bus, true);
+    PowerPort mppt(&bus);
+    PowerPort pwm(&bus);
+
+    bus.add_port(&pwm, 0);
+    bus.add_port(&mppt, 1);
+
+    // battery at current limit, charged by both sources
+    bat.pos_current_limit = 10;
+    bat.current = 10;
+    mppt.current = -6;
+    pwm.current = -4;
+    bat.update_bus_current_margins();
+    bus.update_port_margins();
+
+    // the PWM switch must not increase the current anymore, but the MPPT may take it over
+    TEST_ASSERT_EQUAL_FLOAT(0, pwm.sink_current_margin());
+    TEST_ASSERT_EQUAL_FLOAT(4, mppt.sink_current_margin());
+
+    // MPPT exceeded the battery limit, so only the PWM switch has to reduce its current
+    mppt.current = -8;
+    bat.current = 12;
+    bat.update_bus_current_margins();
+    bus.update_port_margins();
+    TEST_ASSERT_EQUAL_FLOAT(-2, pwm.sink_current_margin());
+    TEST_ASSERT_EQUAL_FLOAT(2, mppt.sink_current_margin());
+}
+
+void bus_margins_of_unassigned_port_and_droop()
+{
+    DcBus bus;
+    PowerPort bat(&bus, true);
+    PowerPort pwm(&bus);
+
+    bat.pos_current_limit = 10;
+    bat.current = 3;
+    bat.update_bus_current_margins();
+    bus.sink_voltage_intercept = 14.4;
+
+    // ports not added to the bus get the margins of the entire bus
+    TEST_ASSERT_EQUAL_FLOAT(7, pwm.sink_current_margin());
+
+    // 5 A towards the bus with 0.1 Ohm droop resistance
+    bus.add_port(&pwm, 0, 0.1);
+    pwm.current = -5;
+    TEST_ASSERT_EQUAL_FLOAT(bus.sink_control_voltage() - 0.5F, pwm.sink_control_voltage());
+}
+
 int power_port_tests()
 {
     energy_calculation_init();
@@ -108,6 +297,17 @@ int power_port_tests()
     RUN_TEST(discharging_energy_calculation_valid);
     RUN_TEST(solar_input_energy_calculation_valid);
     RUN_TEST(load_output_energy_calculation_valid);
+    RUN_TEST(energy_integration_trapezoidal);
+    RUN_TEST(energy_integration_skips_long_gaps);
+    RUN_TEST(energy_counter_no_precision_loss);
+    RUN_TEST(energy_integration_of_low_power);
+    RUN_TEST(energy_reset_returns_previous_values);
+
+    RUN_TEST(statistics_one_second_window);
+    RUN_TEST(statistics_keep_peaks_in_long_windows);
+
+    RUN_TEST(bus_margins_allocated_by_priority);
+    RUN_TEST(bus_margins_of_unassigned_port_and_droop);
 
     return UNITY_END();
 }